@@ -6,6 +6,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <math.h>
+#include <setjmp.h>
 
 // GLEW _MUST_ be included first
 #ifdef USEGLEW
@@ -42,10 +43,203 @@
 #define Cos(th) cos(3.14159265/180*(th))
 #define Sin(th) sin(3.14159265/180*(th))
 
+//  Storage private to each thread (loaders also run in worker threads)
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//  Surface material
+typedef struct
+{
+   float Ka[4],Kd[4],Ks[4],Ns; //  Colors and shininess
+   float d;                    //  Transparency
+   unsigned int map;           //  Texture
+} Material;
+
+//  Range of mesh indexes drawn with one material
+typedef struct
+{
+   int first;  //  First index
+   int count;  //  Number of indexes
+   int mtl;    //  Material (-1 for none)
+} MeshGroup;
+
+//  Reduced level of detail sharing the vertexes of a mesh
+typedef struct
+{
+   int ni;              //  Number of indexes
+   unsigned int* index; //  Triangle indexes
+   MeshGroup* group;    //  Material groups (as many as the mesh)
+   float error;         //  Distance from the full mesh in mesh units
+   unsigned int ibo;    //  Index buffer object (0 until uploaded)
+} MeshLOD;
+
+//  Packed vertex sent to OpenGL (20 bytes instead of 32)
+typedef struct
+{
+   float x,y,z;         //  Position
+   signed char n[4];    //  Normal as signed bytes (the fourth pads)
+   unsigned short s,t;  //  Texture coordinates as half floats
+} PackedVertex;
+
+//  Triangle mesh
+//    Vertexes are interleaved as x,y,z,nx,ny,nz,s,t
+#define MESH_STRIDE 8
+typedef struct
+{
+   int nv;              //  Number of vertexes
+   int ni;              //  Number of indexes
+   float* vert;         //  Interleaved vertex data (NULL once packed unless drawn in immediate mode)
+   PackedVertex* packed;//  Packed copy drawn instead of vert (NULL if not packed)
+   unsigned int* index; //  Triangle indexes
+   int ng;              //  Number of groups (0 draws all indexes)
+   MeshGroup* group;    //  Material groups
+   int nm;              //  Number of materials
+   Material* mtl;       //  Materials used by groups
+   char** tex;          //  Texture file of each material (NULL for none)
+   unsigned int vbo;    //  Vertex buffer object (0 until uploaded)
+   unsigned int ibo;    //  Index buffer object (0 until uploaded)
+   int nl;              //  Number of reduced levels of detail
+   MeshLOD* lod;        //  Levels of detail from fine to coarse
+   void* map;           //  Mapped file holding vert and indexes (NULL if allocated)
+   size_t size;         //  Size of mapped file
+} Mesh;
+
+//  Scene graph node
+typedef struct
+{
+   int parent;       //  Parent node (-1 for root)
+   float local[16];  //  Transformation relative to parent
+   float world[16];  //  Cached transformation relative to the scene
+   int dirty;        //  Local transformation changed since last update
+   Mesh* mesh;       //  Mesh to draw (NULL for grouping nodes)
+   int material;     //  Material (defined by the application)
+} SceneNode;
+
+//  Scene graph
+typedef struct
+{
+   int n;            //  Number of nodes
+   int max;          //  Number of nodes allocated
+   SceneNode* node;  //  Nodes with parents before children
+} Scene;
+
+//  Mesh queued for drawing
+typedef struct
+{
+   int material;          //  Material (defined by the application)
+   unsigned int texture;  //  Texture (0 for none)
+   Mesh* mesh;            //  Mesh to draw
+   float mat[16];         //  Model matrix
+} RenderItem;
+
+//  Render queue sorted by material and texture
+typedef struct
+{
+   int n;             //  Number of items
+   int max;           //  Number of items allocated
+   RenderItem* item;  //  Items
+} RenderQueue;
+
+//  Node of a bounding volume hierarchy
+typedef struct
+{
+   float min[3],max[3];  //  Bounding box of the items below
+   int left;             //  First child (the second follows it), -1 for leaves
+   int first,count;      //  Items below in the item list
+} BVHNode;
+
+//  Bounding volume hierarchy over boxes
+typedef struct
+{
+   int n;          //  Number of nodes
+   BVHNode* node;  //  Nodes with the root first
+   int* item;      //  Item numbers grouped by node
+} BVH;
+
+//  Light for the per pixel lighting shaders
+typedef struct
+{
+   float position[4];  //  Position (w=0 for a directional light)
+   float color[3];     //  Color
+   float radius;       //  Distance where the light fades out (0 for never)
+} Light;
+
+//  Levels of a texture read from a file and not yet in OpenGL
+//    Levels are BGR or BGRA rows padded to 4 bytes or S3TC blocks
+#define TEX_LEVELS 16
+typedef struct
+{
+   int bpp;                               //  Bytes per texel of the image (3 or 4)
+   int compressed;                        //  S3TC blocks instead of rows
+   unsigned int format;                   //  Internal format
+   unsigned int pixels;                   //  Format of rows (0 for blocks)
+   int n;                                 //  Number of levels
+   int generate;                          //  Build the other levels with glGenerateMipmap
+   int w[TEX_LEVELS],h[TEX_LEVELS];       //  Size of each level
+   int size[TEX_LEVELS];                  //  Bytes of each level
+   const unsigned char* data[TEX_LEVELS]; //  Texels of each level
+   unsigned char* buf[TEX_LEVELS];        //  Allocated levels
+   const unsigned char* map;              //  Mapped file holding levels (NULL if none)
+   size_t len;                            //  Length of mapped file
+   unsigned char* flip;                   //  Level 0 of a top down BMP file
+} TexImage;
+
+//  Status of an asset loading in the background
+#define ASSET_ERROR    -1
+#define ASSET_QUEUED    0
+#define ASSET_READING   1
+#define ASSET_UPLOADING 2
+#define ASSET_READY     3
+
+//  Rendering counters (reset by the application)
+typedef struct
+{
+   long draws;     //  Draw calls
+   long vertexes;  //  Vertexes drawn (indexes times instances)
+   long states;    //  Color, material and texture changes sent to OpenGL
+   long skipped;   //  Redundant changes skipped
+} RenderStats;
+extern RenderStats Stats;
+
+//  Texture cache counters
+typedef struct
+{
+   long hits;        //  Loads shared with a resident texture
+   long misses;      //  Loads read from file
+   long evictions;   //  Unused textures deleted to stay under the budget
+   int  textures;    //  Resident textures
+   long long bytes;  //  Video memory of resident textures
+} TextureStats;
+extern TextureStats TexStats;
+
+//  SIMD kernel sets
+#define SIMD_SCALAR 0  //  Portable C
+#define SIMD_SSE    1  //  4 floats at a time
+#define SIMD_AVX2   2  //  8 floats at a time with fused multiply add
+
+//  Mesh draw modes
+#define MESH_IMMEDIATE 0  //  glBegin/glEnd per triangle
+#define MESH_ARRAY     1  //  Client side vertex arrays
+#define MESH_VBO       2  //  Vertex and index buffer objects
+//  Mesh vertex formats
+#define MESH_FLOAT     0  //  32 byte float vertexes
+#define MESH_PACKED    1  //  20 byte packed vertexes
+
+//  OBJ file readers
+#define OBJ_STDIO 0  //  Line reader with sscanf
+#define OBJ_MMAP  1  //  Memory mapped file with in place scanner
+
+//  Texture compression
+#define TEX_RGB   0  //  Texels as stored in the file
+#define TEX_BC1   1  //  S3TC compressed (BC1 for RGB, BC3 with alpha)
+
 #ifdef __GNUC__
 void Print(const char* format , ...) __attribute__ ((format(printf,1,2)));
 void Fatal(const char* format , ...) __attribute__ ((format(printf,1,2))) __attribute__ ((noreturn));
@@ -53,10 +247,101 @@ void Fatal(const char* format , ...) __attribute__ ((format(printf,1,2))) __attr
 void Print(const char* format , ...);
 void Fatal(const char* format , ...);
 #endif
+jmp_buf* FatalJump(jmp_buf* env);
+const char* FatalMessage(void);
+const void* MapFile(const char* file,size_t* len);
+void UnmapFile(const void* buf,size_t len);
+char* CacheName(const char* file,const char* ext);
 unsigned int LoadTexBMP(const char* file);
+TexImage* ReadTexBMP(const char* file,int mode);
+unsigned int UploadTexImage(const TexImage* tex);
+void FreeTexImage(TexImage* tex);
+int  TexMode(int mode);
+void TexCache(int on);
+unsigned int GetTexture(const char* file);
+unsigned int FindTexture(const char* file);
+unsigned int AddTexture(const char* file,unsigned int tex);
+void ReleaseTexture(unsigned int tex);
+void TextureBudget(int mb);
 void Project(double fov,double asp,double dim);
+float ProjectedSize(const float mat[16],float r);
+void Frustum(const float view[16],float plane[6][4]);
+void GetProjection(double* fov,double* asp,double* dim);
 void ErrCheck(const char* where);
 int  LoadOBJ(const char* file);
+Mesh* NewMesh(int nv,int ni);
+void  FreeMesh(Mesh* mesh);
+void  DrawMesh(Mesh* mesh);
+void  DrawMeshLOD(Mesh* mesh,int level);
+void  UploadMesh(Mesh* mesh);
+void  MeshMode(int mode);
+int   MeshFormat(int format);
+void  PackMesh(Mesh* mesh);
+void  DrawMeshInstanced(Mesh* mesh,int n);
+Mesh* LoadOBJMesh(const char* file);
+Mesh* ReadOBJMesh(const char* file);
+void  LoadMeshTextures(Mesh* mesh);
+int   LoadMeshAsync(const char* file);
+int   LoadTextureAsync(const char* file);
+int   AssetStatus(int id);
+const char* AssetError(int id);
+Mesh* AssetMesh(int id);
+unsigned int AssetTexture(int id);
+int   UploadAssets(int bytes);
+void  AssetThreads(int n);
+void  FreeAsset(int id);
+void  OBJMode(int mode);
+void  OBJThreads(int n);
+void  OBJCache(int on);
+void  OBJLevels(int n);
+int   CreateShaderProg(const char* VertFile,const char* FragFile);
+void  MatIdentity(float m[16]);
+void  MatMultiply(float m[16],const float a[16],const float b[16]);
+void  MatTranslate(float m[16],float x,float y,float z);
+void  MatRotate(float m[16],float th,float x,float y,float z);
+void  MatScale(float m[16],float x,float y,float z);
+int   MatInverse(float m[16],const float a[16]);
+int   AddNode(Scene* scene,int parent,const float local[16],Mesh* mesh,int material);
+void  SetNodeMatrix(Scene* scene,int k,const float local[16]);
+int   UpdateScene(Scene* scene);
+void  DrawScene(Scene* scene,void (*material)(int));
+void  FreeScene(Scene* scene);
+void  ResetState(void);
+void  SetColor(const float color[4]);
+void  SetMaterialfv(GLenum pname,const float* v);
+void  SetMaterialf(GLenum pname,float v);
+void  BindTexture(unsigned int texture);
+void  UseMaterial(const Material* mtl);
+void  QueueMesh(RenderQueue* queue,Mesh* mesh,const float mat[16],int material,unsigned int texture);
+void  QueueScene(RenderQueue* queue,Scene* scene,const float base[16]);
+void  FlushQueue(RenderQueue* queue,void (*material)(int));
+Mesh* CylinderMesh(int n);
+Mesh* TorusMesh(int n,float ratio);
+Mesh* SphereMesh(int n);
+Mesh* PrimitiveLOD(Mesh* mesh,const float mat[16]);
+void  OptimizeMesh(Mesh* mesh);
+float MeshACMR(const Mesh* mesh,int size);
+void  SimplifyMesh(Mesh* mesh,int n);
+void  FreeMeshLOD(Mesh* mesh);
+int   MeshLevel(const Mesh* mesh,const float mat[16]);
+void  MeshBounds(const Mesh* mesh,float min[3],float max[3]);
+int   BoxVisible(const float plane[6][4],const float min[3],const float max[3]);
+int   SphereVisible(const float plane[6][4],const float center[3],float r);
+void  BuildBVH(BVH* bvh,const float* box,int n);
+void  FreeBVH(BVH* bvh);
+int   CullBVH(const BVH* bvh,const float plane[6][4],int* visible);
+void  SetLights(const Light* light,int n,const float view[16]);
+void  UseLights(int prog);
+void  ShadowMap(int size,int pcf);
+void  BeginShadow(const float light[3],const float center[3],float radius,float view[16]);
+void  EndShadow(void);
+void  UseShadow(int prog,const float view[16],int on);
+void  LightClusters(int on);
+void  LightThreads(int n);
+int   SIMDMode(int mode);
+void  RingSoA(int n,const float* u,const float* v,float a,float h,float b,float c,
+              float* pu,float* pv,float* pw,float* nu,float* nv,float* nw);
+void  TransformSoA(const float mat[16],int n,const float* x,const float* y,const float* z,float* X,float* Y,float* Z);
 
 #ifdef __cplusplus
 }
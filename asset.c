@@ -0,0 +1,684 @@
+//  CSCIx229 library
+//  Loading meshes and textures in the background
+#include "CSCIx229.h"
+#ifndef _WIN32
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+//
+//  LoadMeshAsync and LoadTextureAsync queue a file and return at once.
+//  Worker threads read it into memory with ReadOBJMesh or ReadTexBMP,
+//  which need no OpenGL, and UploadAssets, called every frame on the
+//  OpenGL thread, copies at most a budget of bytes to buffer objects and
+//  textures (texels through a pixel buffer object), so no frame waits for
+//  a whole file.  Until an asset is ready AssetMesh draws a box (the bounds
+//  of the mesh once it is read) and AssetTexture a grey texture.
+//
+//  Fatal while loading is caught, leaving the asset in ASSET_ERROR with
+//  the message in AssetError instead of ending the program.  Memory held
+//  by a reader when it fails is not freed.
+//
+//  The textures of the materials of a mesh are queued when the mesh has
+//  been read and drawn grey until they are uploaded.
+//
+
+#define ASSET_MESH    0
+#define ASSET_TEXTURE 1
+
+//  Asset
+typedef struct
+{
+   int used;            //  Slot in use
+   int type;            //  ASSET_MESH or ASSET_TEXTURE
+   int status;          //  ASSET_QUEUED to ASSET_READY or ASSET_ERROR
+   int freed;           //  Freed while being read
+   char* file;          //  File name
+   int mode;            //  TexMode of a texture
+   char* error;         //  Message of Fatal
+   Mesh* mesh;          //  Mesh read by a worker
+   TexImage* image;     //  Texture levels read by a worker
+   int piece;           //  Buffer or level being uploaded
+   size_t done;         //  Bytes or rows of the piece uploaded
+   unsigned int tex;    //  Texture being uploaded
+   Mesh* box;           //  Box of the mesh bounds
+   int* pending;        //  Texture asset of each material (-1 for none)
+} asset_t;
+
+static asset_t* asset=NULL;
+//  Slots up to the last one in use and allocated
+static int count=0,size=0;
+//  Threads reading files (0 for one per processor)
+static int assetthreads=0;
+static int started=0;
+//  Placeholders
+static Mesh* unitbox=NULL;
+static unsigned int grey=0;
+//  Pixel buffer object for texels
+static unsigned int pbo=0;
+
+#ifdef _WIN32
+#define LOCK()
+#define UNLOCK()
+#else
+static pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  work=PTHREAD_COND_INITIALIZER;
+#define LOCK()   pthread_mutex_lock(&lock)
+#define UNLOCK() pthread_mutex_unlock(&lock)
+#endif
+
+//
+//  Set number of threads reading files
+//    0 uses one thread per processor (set before the first load)
+//
+void AssetThreads(int n)
+{
+   assetthreads = n;
+}
+
+//
+//  Copy string
+//
+static char* Copy(const char* str)
+{
+   char* s = (char*)malloc(strlen(str)+1);
+   if (!s) Fatal("Cannot allocate memory\n");
+   strcpy(s,str);
+   return s;
+}
+
+//
+//  Read the file of an asset
+//    Returns the message of Fatal or NULL
+//
+static char* ReadAsset(int type,const char* file,int mode,Mesh** mesh,TexImage** image)
+{
+   jmp_buf env;
+   if (setjmp(env)) return Copy(FatalMessage());
+   FatalJump(&env);
+   if (type==ASSET_MESH)
+      *mesh = ReadOBJMesh(file);
+   else
+      *image = ReadTexBMP(file,mode);
+   FatalJump(NULL);
+   return NULL;
+}
+
+//
+//  Clear the slot of an asset (call locked)
+//
+static void Forget(int id)
+{
+   asset_t* a = asset+id;
+   free(a->file);
+   free(a->error);
+   free(a->pending);
+   memset(a,0,sizeof(asset_t));
+   //  Scans stop at the last slot in use
+   while (count>0 && !asset[count-1].used)
+      count--;
+}
+
+//
+//  Read the next queued asset (call locked)
+//    Returns 0 if nothing is queued
+//
+static int ReadNext(void)
+{
+   int id=-1;
+   for (int k=0;k<count && id<0;k++)
+      if (asset[k].used && asset[k].status==ASSET_QUEUED)
+         id = k;
+   if (id<0) return 0;
+   asset[id].status = ASSET_READING;
+   int type = asset[id].type;
+   int mode = asset[id].mode;
+   //  The name stays until the read is done
+   const char* file = asset[id].file;
+   UNLOCK();
+   Mesh* mesh=NULL;
+   TexImage* image=NULL;
+   char* error = ReadAsset(type,file,mode,&mesh,&image);
+   LOCK();
+   asset_t* a = asset+id;
+   if (a->freed)
+   {
+      //  Nobody wants it any more (meshes read have no buffers or textures yet)
+      if (mesh) FreeMesh(mesh);
+      FreeTexImage(image);
+      free(error);
+      Forget(id);
+   }
+   else
+   {
+      a->mesh = mesh;
+      a->image = image;
+      a->error = error;
+      a->status = error ? ASSET_ERROR : ASSET_UPLOADING;
+   }
+   return 1;
+}
+
+#ifndef _WIN32
+//
+//  Worker thread reading files
+//
+static void* Worker(void* arg)
+{
+   LOCK();
+   for (;;)
+      if (!ReadNext())
+         pthread_cond_wait(&work,&lock);
+   return NULL;
+}
+#endif
+
+//
+//  Start worker threads
+//
+static void Start(void)
+{
+   if (started) return;
+   started = 1;
+#ifndef _WIN32
+   int n = assetthreads;
+   if (n<1) n = sysconf(_SC_NPROCESSORS_ONLN);
+   if (n<1) n = 1;
+   for (int k=0;k<n;k++)
+   {
+      pthread_t thread;
+      if (pthread_create(&thread,NULL,Worker,NULL)) Fatal("Cannot create thread\n");
+      pthread_detach(thread);
+   }
+#endif
+}
+
+//
+//  Add an asset
+//    Reuses the first free slot
+//
+static int NewAsset(int type,const char* file,int status)
+{
+   char* name = Copy(file);
+   LOCK();
+   int id=0;
+   while (id<count && asset[id].used)
+      id++;
+   if (id==size)
+   {
+      int n = size ? 2*size : 64;
+      asset_t* grown = (asset_t*)realloc(asset,n*sizeof(asset_t));
+      if (!grown)
+      {
+         UNLOCK();
+         free(name);
+         Fatal("Cannot allocate %d assets\n",n);
+      }
+      asset = grown;
+      size = n;
+   }
+   if (id==count) count++;
+   asset_t* a = asset+id;
+   memset(a,0,sizeof(asset_t));
+   a->used = 1;
+   a->type = type;
+   a->status = status;
+   a->file = name;
+   a->mode = TexMode(-1);
+   UNLOCK();
+   return id;
+}
+
+//
+//  Wake a worker for a queued asset
+//
+static void Queue(void)
+{
+   Start();
+#ifndef _WIN32
+   LOCK();
+   pthread_cond_signal(&work);
+   UNLOCK();
+#endif
+}
+
+//
+//  Load OBJ file into a mesh in the background
+//    Returns the asset
+//
+int LoadMeshAsync(const char* file)
+{
+   int id = NewAsset(ASSET_MESH,file,ASSET_QUEUED);
+   Queue();
+   return id;
+}
+
+//
+//  Load texture from BMP file in the background
+//    Resident textures (see GetTexture) are shared at once
+//    Returns the asset
+//
+int LoadTextureAsync(const char* file)
+{
+   unsigned int tex = FindTexture(file);
+   int id = NewAsset(ASSET_TEXTURE,file,tex ? ASSET_READY : ASSET_QUEUED);
+   if (tex)
+      asset[id].tex = tex;
+   else
+      Queue();
+   return id;
+}
+
+//
+//  Box mesh from x0,y0,z0 to x1,y1,z1
+//
+static Mesh* Box(const float* lo,const float* hi)
+{
+   Mesh* mesh = NewMesh(24,36);
+   float* v = mesh->vert;
+   for (int f=0;f<6;f++)
+   {
+      //  Face f is along axis a on side s
+      int a=f/2,s=f%2;
+      int b=(a+1)%3,c=(a+2)%3;
+      for (int k=0;k<4;k++)
+      {
+         float p[3],n[3]={0,0,0};
+         int u = (k==1 || k==2);
+         int w = (k>=2);
+         //  Counterclockwise seen from outside
+         if (!s) u = !u;
+         p[a] = s ? hi[a] : lo[a];
+         p[b] = u ? hi[b] : lo[b];
+         p[c] = w ? hi[c] : lo[c];
+         n[a] = s ? 1 : -1;
+         memcpy(v,p,3*sizeof(float));
+         memcpy(v+3,n,3*sizeof(float));
+         v[6] = u;
+         v[7] = w;
+         v += MESH_STRIDE;
+      }
+      unsigned int* i = mesh->index+6*f;
+      i[0] = 4*f; i[1] = 4*f+1; i[2] = 4*f+2;
+      i[3] = 4*f; i[4] = 4*f+2; i[5] = 4*f+3;
+   }
+   if (MeshFormat(-1)==MESH_PACKED) PackMesh(mesh);
+   return mesh;
+}
+
+//
+//  Status of an asset
+//
+int AssetStatus(int id)
+{
+   LOCK();
+   int status = (id>=0 && id<count && asset[id].used) ? asset[id].status : ASSET_ERROR;
+   UNLOCK();
+   return status;
+}
+
+//
+//  Message of an asset that failed (NULL if none)
+//
+const char* AssetError(int id)
+{
+   LOCK();
+   const char* error = (id>=0 && id<count && asset[id].used) ? asset[id].error : NULL;
+   UNLOCK();
+   return error;
+}
+
+//
+//  Mesh of an asset
+//    Until it is ready returns a box, of the mesh bounds once it is read
+//    Returns NULL if it failed
+//
+Mesh* AssetMesh(int id)
+{
+   int status = AssetStatus(id);
+   if (status==ASSET_ERROR) return NULL;
+   if (status==ASSET_READY) return asset[id].mesh;
+   if (asset[id].box) return asset[id].box;
+   if (!unitbox)
+   {
+      const float lo[] = {-0.5,-0.5,-0.5},hi[] = {0.5,0.5,0.5};
+      unitbox = Box(lo,hi);
+   }
+   return unitbox;
+}
+
+//
+//  Grey texture drawn until textures are ready
+//
+static unsigned int Grey(void)
+{
+   if (!grey)
+   {
+      const unsigned char texel[] = {128,128,128,0};
+      int bound;
+      glGetIntegerv(GL_TEXTURE_BINDING_2D,&bound);
+      glGenTextures(1,&grey);
+      glBindTexture(GL_TEXTURE_2D,grey);
+      glTexImage2D(GL_TEXTURE_2D,0,GL_RGB8,1,1,0,GL_RGB,GL_UNSIGNED_BYTE,texel);
+      glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+      glBindTexture(GL_TEXTURE_2D,bound);
+   }
+   return grey;
+}
+
+//
+//  Texture of an asset
+//    Returns a grey texture until it is ready and if it failed
+//
+unsigned int AssetTexture(int id)
+{
+   return AssetStatus(id)==ASSET_READY ? asset[id].tex : Grey();
+}
+
+//
+//  Free an asset
+//    Ready meshes are freed and textures released
+//
+void FreeAsset(int id)
+{
+   LOCK();
+   if (id<0 || id>=count || !asset[id].used)
+   {
+      UNLOCK();
+      return;
+   }
+   asset_t a = asset[id];
+   //  The worker frees it when done
+   if (a.status==ASSET_READING)
+   {
+      asset[id].freed = 1;
+      UNLOCK();
+      return;
+   }
+   asset[id].pending = NULL;
+   Forget(id);
+   UNLOCK();
+   //  Textures of materials
+   for (int k=0;a.pending && a.mesh && k<a.mesh->nm;k++)
+      if (a.pending[k]>=0) FreeAsset(a.pending[k]);
+   free(a.pending);
+   if (a.mesh) FreeMesh(a.mesh);
+   if (a.box) FreeMesh(a.box);
+   FreeTexImage(a.image);
+   if (a.status==ASSET_READY && a.type==ASSET_TEXTURE)
+      ReleaseTexture(a.tex);
+   else if (a.tex)
+      glDeleteTextures(1,&a.tex);
+}
+
+//
+//  Buffer object of piece k of a mesh and the bytes to copy to it
+//    Returns 0 past the last piece
+//
+static size_t MeshPiece(Mesh* mesh,int k,unsigned int* target,unsigned int** buffer,const void** data)
+{
+   if (k==0)
+   {
+      *target = GL_ARRAY_BUFFER;
+      *buffer = &mesh->vbo;
+      *data = mesh->packed ? (const void*)mesh->packed : (const void*)mesh->vert;
+      return mesh->nv*(mesh->packed ? sizeof(PackedVertex) : MESH_STRIDE*sizeof(float));
+   }
+   *target = GL_ELEMENT_ARRAY_BUFFER;
+   if (k==1)
+   {
+      *buffer = &mesh->ibo;
+      *data = mesh->index;
+      return mesh->ni*sizeof(unsigned int);
+   }
+   if (k-2>=mesh->nl) return 0;
+   MeshLOD* lod = mesh->lod+k-2;
+   *buffer = &lod->ibo;
+   *data = lod->index;
+   return lod->ni*sizeof(unsigned int);
+}
+
+//
+//  Copy up to bytes of a mesh to buffer objects
+//    Returns the bytes copied and sets status to ready when done
+//
+static size_t UploadMeshPart(asset_t* a,size_t bytes)
+{
+   size_t copied=0;
+   while (copied<bytes)
+   {
+      unsigned int target,*buffer;
+      const void* data;
+      size_t len = MeshPiece(a->mesh,a->piece,&target,&buffer,&data);
+      //  Done
+      if (!len && a->piece>=2)
+      {
+         a->status = ASSET_READY;
+         break;
+      }
+      if (!*buffer) glGenBuffers(1,buffer);
+      glBindBuffer(target,*buffer);
+      if (a->done==0) glBufferData(target,len,NULL,GL_STATIC_DRAW);
+      size_t n = len-a->done;
+      if (n>bytes-copied) n = bytes-copied;
+      if (n) glBufferSubData(target,a->done,n,(const char*)data+a->done);
+      glBindBuffer(target,0);
+      copied += n;
+      a->done += n;
+      if (a->done>=len)
+      {
+         a->piece++;
+         a->done = 0;
+      }
+   }
+   return copied;
+}
+
+//
+//  Copy up to bytes of texels to a texture through the pixel buffer object
+//    Copies at least one row (or row of blocks)
+//    Returns the bytes copied and sets status to ready when done
+//
+static size_t UploadTexturePart(asset_t* a,size_t bytes)
+{
+   TexImage* img = a->image;
+   //  Make every level before copying texels
+   if (!a->tex)
+   {
+      int max;
+      glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max);
+      if (img->w[0]>max || img->h[0]>max) Fatal("%dx%d texture is larger than %d\n",img->w[0],img->h[0],max);
+      glGenTextures(1,&a->tex);
+      glBindTexture(GL_TEXTURE_2D,a->tex);
+      for (int k=0;k<img->n;k++)
+         if (img->compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D,k,img->format,img->w[k],img->h[k],0,img->size[k],NULL);
+         else
+            glTexImage2D(GL_TEXTURE_2D,k,img->format,img->w[k],img->h[k],0,img->pixels,GL_UNSIGNED_BYTE,NULL);
+      if (!img->generate) glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,img->n-1);
+      glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+   }
+   if (!pbo) glGenBuffers(1,&pbo);
+   glBindTexture(GL_TEXTURE_2D,a->tex);
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER,pbo);
+   glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+   glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+   glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+   size_t copied=0;
+   while (copied<bytes && a->piece<img->n)
+   {
+      int k = a->piece;
+      int w=img->w[k],h=img->h[k];
+      //  Rows of texels or of 4x4 blocks
+      int rows = img->compressed ? (h+3)/4 : h;
+      size_t stride = img->size[k]/rows;
+      int r = (bytes-copied)/stride;
+      if (r<1) r = 1;
+      if (r>rows-(int)a->done) r = rows-a->done;
+      size_t n = r*stride;
+      //  A fresh buffer each time so the copy never waits for the last upload
+      glBufferData(GL_PIXEL_UNPACK_BUFFER,n,NULL,GL_STREAM_DRAW);
+      void* p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,0,n,GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+      //  Restore the pixel store before Fatal since UploadAssets catches it
+      if (!p)
+      {
+         glPopClientAttrib();
+         Fatal("Cannot map pixel buffer object\n");
+      }
+      memcpy(p,img->data[k]+a->done*stride,n);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      if (img->compressed)
+      {
+         int y = 4*a->done;
+         int dy = (4*r<h-y) ? 4*r : h-y;
+         glCompressedTexSubImage2D(GL_TEXTURE_2D,k,0,y,w,dy,img->format,n,NULL);
+      }
+      else
+         glTexSubImage2D(GL_TEXTURE_2D,k,0,a->done,w,r,img->pixels,GL_UNSIGNED_BYTE,NULL);
+      copied += n;
+      a->done += r;
+      if (a->done>=rows)
+      {
+         a->piece++;
+         a->done = 0;
+      }
+   }
+   glPopClientAttrib();
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER,0);
+   //  Share the finished texture
+   if (a->piece>=img->n)
+   {
+      if (img->generate) glGenerateMipmap(GL_TEXTURE_2D);
+      FreeTexImage(img);
+      a->image = NULL;
+      a->tex = AddTexture(a->file,a->tex);
+      a->status = ASSET_READY;
+   }
+   return copied;
+}
+
+//
+//  Queue the textures of the materials of a mesh that has been read
+//
+static void QueueMaterials(int id)
+{
+   Mesh* mesh = asset[id].mesh;
+   float lo[3],hi[3];
+   MeshBounds(mesh,lo,hi);
+   asset[id].box = Box(lo,hi);
+   int* pending = (int*)malloc((mesh->nm+1)*sizeof(int));
+   if (!pending) Fatal("Cannot allocate memory\n");
+   for (int k=0;k<mesh->nm;k++)
+   {
+      pending[k] = (mesh->tex && mesh->tex[k]) ? LoadTextureAsync(mesh->tex[k]) : -1;
+      if (pending[k]>=0) mesh->mtl[k].map = Grey();
+   }
+   //  The array may have moved
+   asset[id].pending = pending;
+}
+
+//
+//  Give materials of a mesh their textures when they are ready
+//
+static void UseMaterials(int id)
+{
+   int waiting=0;
+   for (int k=0;k<asset[id].mesh->nm;k++)
+   {
+      int t = asset[id].pending[k];
+      int status = AssetStatus(t);
+      if (t<0) continue;
+      if (status!=ASSET_READY && status!=ASSET_ERROR)
+      {
+         waiting = 1;
+         continue;
+      }
+      //  The mesh takes the reference to the texture
+      Material* mtl = asset[id].mesh->mtl+k;
+      if (status==ASSET_READY)
+         mtl->map = asset[t].tex;
+      else
+      {
+         fprintf(stderr,"%s",asset[t].error);
+         mtl->map = 0;
+      }
+      LOCK();
+      Forget(t);
+      UNLOCK();
+      asset[id].pending[k] = -1;
+   }
+   if (!waiting)
+   {
+      free(asset[id].pending);
+      asset[id].pending = NULL;
+   }
+}
+
+//
+//  Copy assets read in the background to OpenGL
+//    Call every frame from the OpenGL thread
+//    Copies about bytes (everything if bytes<=0)
+//    Returns the number of assets that were still loading
+//
+int UploadAssets(int bytes)
+{
+   size_t budget = bytes>0 ? (size_t)bytes : (size_t)-1;
+   int loading=0;
+#ifdef _WIN32
+   //  No worker threads, so read one file per call
+   ReadNext();
+#endif
+   //  Keep the state the application expects
+   int bound;
+   glGetIntegerv(GL_TEXTURE_BINDING_2D,&bound);
+   for (int id=0;;id++)
+   {
+      //  Workers trim count and clear slots, so read them locked
+      LOCK();
+      int more = id<count;
+      int status = (more && asset[id].used) ? asset[id].status : ASSET_ERROR;
+      UNLOCK();
+      if (!more) break;
+      if (status==ASSET_ERROR) continue;
+      //  Materials waiting for textures
+      if (status==ASSET_READY)
+      {
+         if (asset[id].pending) UseMaterials(id);
+         continue;
+      }
+      if (status==ASSET_QUEUED || status==ASSET_READING)
+      {
+         loading++;
+         continue;
+      }
+      loading++;
+      if (!budget) continue;
+      //  Catch Fatal so one bad file does not end the program
+      jmp_buf env;
+      if (setjmp(env))
+      {
+         LOCK();
+         asset[id].error = (char*)malloc(strlen(FatalMessage())+1);
+         if (asset[id].error) strcpy(asset[id].error,FatalMessage());
+         asset[id].status = ASSET_ERROR;
+         UNLOCK();
+         glBindBuffer(GL_PIXEL_UNPACK_BUFFER,0);
+         continue;
+      }
+      FatalJump(&env);
+      size_t n;
+      if (asset[id].type==ASSET_MESH)
+      {
+         if (!asset[id].box) QueueMaterials(id);
+         n = UploadMeshPart(asset+id,budget);
+      }
+      else
+         n = UploadTexturePart(asset+id,budget);
+      FatalJump(NULL);
+      budget = n<budget ? budget-n : 0;
+   }
+   glBindTexture(GL_TEXTURE_2D,bound);
+   return loading;
+}
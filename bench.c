@@ -0,0 +1,1031 @@
+/*
+ *  Headless benchmark of the bicycle viewer
+ *
+ *  Renders display() into an EGL pbuffer (Mesa llvmpipe works, no GPU or
+ *  window needed) for a fixed number of frames per scripted scene and
+ *  reports frame time percentiles and rendering counters as JSON.
+ *
+ *  Times the SIMD ring and point transform kernels with each kernel set, and
+ *  binning street lights into clusters on one thread and on every processor,
+ *  and loading a BMP atlas with padded rows like LoadTexBMP used to (stdio
+ *  and swapping to RGB) and with the memory mapped BGR upload of level 0.
+ *  The atlas is then loaded mipmapped by glGenerateMipmap and BC1
+ *  compressed, building the texture cache and from it, reporting the size,
+ *  error and draw time of each.  Hundreds of
+ *  props loading a few textures are timed with and without sharing them.
+ *  An OBJ file switching materials of a big MTL library is loaded twice,
+ *  the second time with the library already read.
+ *  Also loads an OBJ file with the stdio line reader and the memory mapped
+ *  scanner, single threaded and on every processor, and from the binary mesh
+ *  cache, and compares their throughput.  Uncached loads with the default
+ *  settings are timed for LoadOBJMesh (with levels of detail) and LoadOBJ.
+ *  The triangles of the model are
+ *  then shuffled and optimized for the vertex cache, reporting the average
+ *  cache miss ratio (ACMR) and draw time of each order, and the size and draw
+ *  time of its float and packed vertexes.  The model and a large texture are
+ *  loaded at once and in the background with an upload budget per frame,
+ *  reporting the longest frame of uploading.  Without -obj a synthetic
+ *  scanned surface is written to hw5bench.obj and removed afterwards.
+ *
+ *  Usage: hw5bench [-immediate|-array|-vbo] [-float|-packed] [-frames N] [-size WxH] [-obj file]
+ */
+#include "CSCIx229.h"
+#include <time.h>
+#include <unistd.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// State and callbacks from hw5.c
+extern int th, ph, m, light, moveLight, ride, meshMode, meshFormat, lod, cull, shaderLight, streetLights, clusters, shadows, shadowSize, ground;
+void display();
+void reshape(int width, int height);
+void idle();
+void buildFleet(int n);
+void buildStreetLights(int n);
+extern Light *lights;
+extern float view[16];
+
+// Size of the offscreen image
+int width = 640;
+int height = 360;
+
+// Scripted scene
+typedef struct BenchScene
+{
+   const char *name; // Name in the report
+   int fleet;        // Number of bicycles (0 for a single bicycle)
+   int projection;   // 0 for orthogonal, 1 for perspective
+   int light;        // Lighting on or off
+   int ride;         // Spin the wheels
+   int lod;          // Level of detail by size on screen
+   int cull;         // Skip bicycles outside the view
+   int shader;       // Per pixel lighting shader
+   int lights;       // Street lights (per pixel lighting only)
+   int clusters;     // Shade only the lights of each cluster
+   int shadows;      // Shadow map size (0 for no shadows)
+   int still;        // Keep the light still
+   int ground;       // Draw the ground without shadows
+} BenchScene;
+
+const BenchScene scenes[] = {
+    {"single-orthogonal", 0, 0, 1, 0, 1, 1},
+    {"single-perspective", 0, 1, 1, 1, 1, 1},
+    {"single-unlit", 0, 1, 0, 0, 1, 1},
+    {"fleet-100", 100, 1, 1, 1, 1, 1},
+    {"fleet-1000", 1000, 1, 1, 0, 1, 1},
+    {"fleet-1000-full-detail", 1000, 1, 1, 0, 0, 1},
+    {"fleet-1000-no-culling", 1000, 1, 1, 0, 1, 0},
+    {"fleet-10000", 10000, 1, 1, 0, 1, 1},
+    {"single-shader", 0, 1, 1, 0, 1, 1, 1, 0, 1},
+    {"single-shader-ground", 0, 1, 1, 0, 1, 1, 1, 0, 1, 0, 0, 1},
+    {"single-shadow", 0, 1, 1, 0, 1, 1, 1, 0, 1, 2048, 0},
+    {"single-shadow-still-light", 0, 1, 1, 0, 1, 1, 1, 0, 1, 2048, 1},
+    {"fleet-100-shader", 100, 1, 1, 1, 1, 1, 1, 0},
+    {"fleet-100-256-lights-unclustered", 100, 1, 1, 1, 1, 1, 1, 256, 0},
+    {"fleet-100-256-lights", 100, 1, 1, 1, 1, 1, 1, 256, 1},
+    {"fleet-100-1024-lights", 100, 1, 1, 1, 1, 1, 1, 1024, 1},
+};
+
+// Wall clock time in milliseconds
+double now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return 1e3 * t.tv_sec + 1e-6 * t.tv_nsec;
+}
+
+// Sort doubles in increasing order
+int compare(const void *a, const void *b)
+{
+   double x = *(const double *)a;
+   double y = *(const double *)b;
+   return (x > y) - (x < y);
+}
+
+// Value at quantile q of a sorted array
+double percentile(const double *t, int n, double q)
+{
+   return t[(int)(q * (n - 1) + 0.5)];
+}
+
+// Create an offscreen OpenGL context
+void createContext(int width, int height)
+{
+   // Prefer the surfaceless Mesa platform which needs no display server
+   EGLDisplay display = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+   const char *ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+   if (ext && strstr(ext, "EGL_MESA_platform_surfaceless"))
+   {
+      PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+      if (getPlatformDisplay)
+         display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+   }
+#endif
+   if (display == EGL_NO_DISPLAY)
+      display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+   if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+      Fatal("Cannot initialize EGL\n");
+
+   // True color pbuffer with a depth buffer
+   const EGLint attributes[] = {
+       EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+       EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+       EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+       EGL_DEPTH_SIZE, 24,
+       EGL_NONE};
+   EGLConfig config;
+   EGLint n;
+   if (!eglChooseConfig(display, attributes, &config, 1, &n) || n < 1)
+      Fatal("No EGL pbuffer configuration with desktop OpenGL\n");
+   const EGLint size[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+   EGLSurface surface = eglCreatePbufferSurface(display, config, size);
+   if (surface == EGL_NO_SURFACE)
+      Fatal("Cannot create %dx%d pbuffer\n", width, height);
+
+   // Compatibility profile context for the fixed function pipeline
+   eglBindAPI(EGL_OPENGL_API);
+   EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+   if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context))
+      Fatal("Cannot create OpenGL context\n");
+}
+
+// Render frames of one scene and print its report
+void runScene(const BenchScene *scene, int frames)
+{
+   // Set up the scene
+   buildFleet(scene->fleet);
+   m = scene->projection;
+   light = scene->light;
+   ride = scene->ride;
+   lod = scene->lod;
+   cull = scene->cull;
+   shaderLight = scene->shader;
+   buildStreetLights(scene->lights);
+   clusters = scene->clusters;
+   shadows = scene->shadows > 0;
+   if (shadows)
+      shadowSize = scene->shadows;
+   moveLight = !scene->still;
+   ground = scene->ground;
+   th = 0;
+   ph = 20;
+   reshape(width, height);
+
+   // Warm up caches, buffers and shaders
+   display();
+
+   // Orbit the camera once while the light moves
+   double *t = (double *)malloc(frames * sizeof(double));
+   if (!t)
+      Fatal("Cannot allocate %d frame times\n", frames);
+   memset(&Stats, 0, sizeof(Stats));
+   for (int i = 0; i < frames; i++)
+   {
+      th = 360 * i / frames;
+      idle();
+      double t0 = now();
+      display();
+      t[i] = now() - t0;
+   }
+   ErrCheck(scene->name);
+
+   // Report
+   double sum = 0;
+   for (int i = 0; i < frames; i++)
+      sum += t[i];
+   qsort(t, frames, sizeof(double), compare);
+   printf("    {\"name\": \"%s\", \"bicycles\": %d, \"frames\": %d,\n", scene->name, scene->fleet ? scene->fleet : 1, frames);
+   printf("     \"frame_ms\": {\"mean\": %.3f, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+          sum / frames, t[0], percentile(t, frames, 0.5), percentile(t, frames, 0.9), percentile(t, frames, 0.99), t[frames - 1]);
+   printf("     \"per_frame\": {\"draw_calls\": %.1f, \"vertexes\": %.1f, \"state_changes\": %.1f, \"state_changes_skipped\": %.1f}}",
+          (double)Stats.draws / frames, (double)Stats.vertexes / frames, (double)Stats.states / frames, (double)Stats.skipped / frames);
+   free(t);
+}
+
+// Write a bumpy grid of n by n quads as an OBJ file like a scanned model
+void writeOBJ(const char *file, int n)
+{
+   FILE *f = fopen(file, "w");
+   if (!f)
+      Fatal("Cannot create %s\n", file);
+   for (int i = 0; i <= n; i++)
+      for (int j = 0; j <= n; j++)
+      {
+         double x = (double)i / n;
+         double y = (double)j / n;
+         double z = 0.05 * Sin(720 * x) * Cos(1080 * y);
+         fprintf(f, "v %.6f %.6f %.6f\n", 2 * x - 1, 2 * y - 1, z);
+         fprintf(f, "vt %.6f %.6f\n", x, y);
+         fprintf(f, "vn %.6f %.6f %.6f\n", -z, z, sqrt(1 - 2 * z * z));
+      }
+   for (int i = 0; i < n; i++)
+      for (int j = 0; j < n; j++)
+      {
+         int k = i * (n + 1) + j + 1;
+         fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", k, k, k, k + n + 1, k + n + 1, k + n + 1,
+                 k + n + 2, k + n + 2, k + n + 2, k + 1, k + 1, k + 1);
+      }
+   fclose(f);
+}
+
+// Best time of three loads of an OBJ file into a mesh in buffer objects
+double loadOBJ(const char *file, int mode, int threads, int cache, Mesh **mesh)
+{
+   double best = 0;
+   OBJMode(mode);
+   OBJThreads(threads);
+   OBJCache(cache);
+   OBJLevels(0);
+   for (int k = 0; k < 3; k++)
+   {
+      FreeMesh(*mesh);
+      double t0 = now();
+      *mesh = LoadOBJMesh(file);
+      UploadMesh(*mesh);
+      glFinish();
+      double t = now() - t0;
+      if (k == 0 || t < best)
+         best = t;
+   }
+   return best;
+}
+
+// Best time of five draws of a mesh
+double drawMesh(Mesh *mesh)
+{
+   double best = 0;
+   glMatrixMode(GL_PROJECTION);
+   glLoadIdentity();
+   glMatrixMode(GL_MODELVIEW);
+   glLoadIdentity();
+   glDisable(GL_LIGHTING);
+   for (int k = 0; k < 5; k++)
+   {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      double t0 = now();
+      DrawMesh(mesh);
+      glFinish();
+      double t = now() - t0;
+      if (k == 0 || t < best)
+         best = t;
+   }
+   return best;
+}
+
+// Shuffle the triangles of a mesh like a scanner export, optimize it and print the report
+void runOptimize(const Mesh *loaded)
+{
+   Mesh *mesh = NewMesh(loaded->nv, loaded->ni);
+   memcpy(mesh->vert, loaded->vert, MESH_STRIDE * mesh->nv * sizeof(float));
+   memcpy(mesh->index, loaded->index, mesh->ni * sizeof(unsigned int));
+   srand(1);
+   for (int k = mesh->ni / 3 - 1; k > 0; k--)
+   {
+      int j = rand() % (k + 1);
+      for (int i = 0; i < 3; i++)
+      {
+         unsigned int t = mesh->index[3 * k + i];
+         mesh->index[3 * k + i] = mesh->index[3 * j + i];
+         mesh->index[3 * j + i] = t;
+      }
+   }
+   float shuffled = MeshACMR(mesh, 16);
+   double tshuffled = drawMesh(mesh);
+   double t0 = now();
+   OptimizeMesh(mesh);
+   double topt = now() - t0;
+   float optimized = MeshACMR(mesh, 16);
+   UploadMesh(mesh);
+   double toptimized = drawMesh(mesh);
+
+   printf("          \"acmr_loaded\": %.3f, \"acmr_shuffled\": %.3f, \"acmr_optimized\": %.3f, \"optimize_ms\": %.1f,\n",
+          MeshACMR(loaded, 16), shuffled, optimized, topt);
+   printf("          \"draw_shuffled_ms\": %.2f, \"draw_optimized_ms\": %.2f,\n", tshuffled, toptimized);
+   FreeMesh(mesh);
+}
+
+// Build levels of detail of a mesh and print the report
+void runSimplify(Mesh *mesh)
+{
+   double t0 = now();
+   SimplifyMesh(mesh, 3);
+   double tsimplify = now() - t0;
+   UploadMesh(mesh);
+   printf("          \"simplify_ms\": %.1f, \"levels\": [", tsimplify);
+   for (int l = 0; l <= mesh->nl; l++)
+   {
+      int ni = l ? mesh->lod[l - 1].ni : mesh->ni;
+      float error = l ? mesh->lod[l - 1].error : 0;
+      double t = 1e30;
+      for (int k = 0; k < 5; k++)
+      {
+         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+         double t1 = now();
+         DrawMeshLOD(mesh, l);
+         glFinish();
+         t = fmin(t, now() - t1);
+      }
+      printf("%s{\"triangles\": %d, \"error\": %.5f, \"draw_ms\": %.2f}", l ? ", " : "", ni / 3, error, t);
+   }
+   printf("],\n");
+}
+
+// Compare float and packed vertexes of a mesh at full detail and print the report
+void runPacked(Mesh *mesh)
+{
+   glMatrixMode(GL_PROJECTION);
+   glLoadIdentity();
+   glMatrixMode(GL_MODELVIEW);
+   glLoadIdentity();
+   glDisable(GL_LIGHTING);
+   double t[2];
+   for (int packed = 0; packed < 2; packed++)
+   {
+      // Drop the packed copy to draw the floats
+      if (packed)
+         PackMesh(mesh);
+      else if (mesh->packed)
+      {
+         free(mesh->packed);
+         mesh->packed = NULL;
+         glDeleteBuffers(1, &mesh->vbo);
+         mesh->vbo = 0;
+      }
+      UploadMesh(mesh);
+      t[packed] = 1e30;
+      for (int k = 0; k < 5; k++)
+      {
+         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+         double t0 = now();
+         DrawMeshLOD(mesh, 0);
+         glFinish();
+         t[packed] = fmin(t[packed], now() - t0);
+      }
+   }
+   // Packing drops the floats unless they are drawn in immediate mode
+   double host = ((mesh->vert ? MESH_STRIDE * sizeof(float) : 0) + sizeof(PackedVertex)) * mesh->nv / 1048576.0;
+   printf("          \"float_vertex_mb\": %.1f, \"packed_vertex_mb\": %.1f, \"packed_host_mb\": %.1f, \"draw_float_ms\": %.2f, \"draw_packed_ms\": %.2f,\n",
+          MESH_STRIDE * sizeof(float) * mesh->nv / 1048576.0, sizeof(PackedVertex) * mesh->nv / 1048576.0, host, t[0], t[1]);
+}
+
+// Time the ring and transform kernels with each SIMD kernel set and print the report
+void runSIMD()
+{
+   const char *names[] = {"scalar", "sse", "avx2"};
+   // Rings of 25 vertexes like a 24 segment torus and a million points
+   const int n = 25, rings = 200000, points = 1 << 20;
+   float *buf = (float *)malloc((8 * n + 3 * points) * sizeof(float));
+   if (!buf)
+      Fatal("Cannot allocate kernel buffers\n");
+   float *u = buf, *v = buf + n, *R = buf + 2 * n, *P = buf + 8 * n;
+   for (int k = 0; k < n; k++)
+   {
+      u[k] = Cos(10 * k);
+      v[k] = Sin(10 * k);
+   }
+   for (int k = 0; k < 3 * points; k++)
+      P[k] = k % 1000;
+   float mat[16];
+   MatIdentity(mat);
+   MatRotate(mat, 30, 1, 1, 0);
+   MatTranslate(mat, 1, 2, 3);
+
+   int best = SIMDMode(-1);
+   printf("  \"simd\": {\"supported\": \"%s\", \"ring_vertexes\": %d, \"rings\": %d, \"points\": %d,\n", names[best], n, rings, points);
+   double ring[3], transform[3];
+   for (int mode = 0; mode <= best; mode++)
+   {
+      SIMDMode(mode);
+      ring[mode] = transform[mode] = 1e30;
+      for (int k = 0; k < 3; k++)
+      {
+         double t0 = now();
+         for (int i = 0; i < rings; i++)
+            RingSoA(n, u, v, 1 + 0.001 * i, 0.5, 0.3, 0.7, R, R + n, R + 2 * n, R + 3 * n, R + 4 * n, R + 5 * n);
+         double t1 = now();
+         TransformSoA(mat, points, P, P + points, P + 2 * points, P, P + points, P + 2 * points);
+         double t2 = now();
+         ring[mode] = fmin(ring[mode], t1 - t0);
+         transform[mode] = fmin(transform[mode], t2 - t1);
+      }
+   }
+   for (int mode = 0; mode <= best; mode++)
+      printf("           \"%s_ring_ms\": %.2f, \"%s_transform_ms\": %.2f,\n", names[mode], ring[mode], names[mode], transform[mode]);
+   printf("           \"ring_speedup\": %.1f, \"transform_speedup\": %.1f},\n", ring[0] / ring[best], transform[0] / transform[best]);
+   SIMDMode(-1);
+   free(buf);
+}
+
+// Time binning lights into clusters on one thread and on every processor and print the report
+void runLights()
+{
+   const int n = 4096;
+   int threads = sysconf(_SC_NPROCESSORS_ONLN);
+   m = 1;
+   reshape(width, height);
+   buildStreetLights(n);
+   LightClusters(1);
+   double t[2];
+   for (int k = 0; k < 2; k++)
+   {
+      LightThreads(k ? 0 : 1);
+      t[k] = 1e30;
+      for (int i = 0; i < 5; i++)
+      {
+         double t0 = now();
+         SetLights(lights + 1, n, view);
+         t[k] = fmin(t[k], now() - t0);
+      }
+   }
+   LightThreads(0);
+   buildStreetLights(0);
+   printf("  \"lights\": {\"lights\": %d, \"threads\": %d, \"bin_ms\": %.2f, \"bin_threads_ms\": %.2f},\n", n, threads, t[0], t[1]);
+}
+
+// Write a w by h BMP file of 3 or 4 bytes per pixel with a pattern, top down if h<0
+void writeBMP(const char *file, int w, int h, int bpp)
+{
+   FILE *f = fopen(file, "wb");
+   if (!f)
+      Fatal("Cannot create %s\n", file);
+   int dy = abs(h);
+   int stride = (bpp * w + 3) & ~3;
+   unsigned char head[54] = {'B', 'M'};
+   unsigned int v[] = {2, 54 + stride * dy, 10, 54, 14, 40, 18, w, 22, h, 34, stride * dy};
+   for (int k = 0; k < 12; k += 2)
+      for (int i = 0; i < 4; i++)
+         head[v[k] + i] = v[k + 1] >> (8 * i);
+   head[26] = 1;
+   head[28] = 8 * bpp;
+   fwrite(head, 54, 1, f);
+   unsigned char *row = (unsigned char *)calloc(stride, 1);
+   for (int j = 0; j < dy; j++)
+   {
+      for (int i = 0; i < bpp * w; i++)
+         row[i] = i * 7 + j * 13;
+      fwrite(row, stride, 1, f);
+   }
+   free(row);
+   fclose(f);
+}
+
+// Load a BMP file like LoadTexBMP did before, with stdio and swapping to RGB
+unsigned int loadBMPstdio(const char *file)
+{
+   FILE *f = fopen(file, "rb");
+   unsigned char head[54];
+   if (!f || fread(head, 54, 1, f) != 1)
+      Fatal("Cannot read %s\n", file);
+   int dx = head[18] | head[19] << 8 | head[20] << 16 | head[21] << 24;
+   int dy = head[22] | head[23] << 8 | head[24] << 16 | head[25] << 24;
+   unsigned int size = 3 * dx * dy;
+   unsigned char *image = (unsigned char *)malloc(size);
+   if (!image || fread(image, size, 1, f) != 1)
+      Fatal("Cannot read %s\n", file);
+   fclose(f);
+   for (unsigned int k = 0; k < size; k += 3)
+   {
+      unsigned char temp = image[k];
+      image[k] = image[k + 2];
+      image[k + 2] = temp;
+   }
+   unsigned int tex;
+   glGenTextures(1, &tex);
+   glBindTexture(GL_TEXTURE_2D, tex);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, dx, dy, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+   free(image);
+   return tex;
+}
+
+// Best time of three loads of a BMP file into a texture
+double loadBMP(const char *file, unsigned int (*load)(const char *))
+{
+   double best = 0;
+   for (int k = 0; k < 3; k++)
+   {
+      double t0 = now();
+      unsigned int tex = load(file);
+      glFinish();
+      double t = now() - t0;
+      glDeleteTextures(1, &tex);
+      if (k == 0 || t < best)
+         best = t;
+   }
+   return best;
+}
+
+// Upload level 0 of a BMP file from the mapping without building mipmaps
+unsigned int loadBMPlevel0(const char *file)
+{
+   TexImage *img = ReadTexBMP(file, TEX_RGB);
+   img->generate = 0;
+   unsigned int tex = UploadTexImage(img);
+   FreeTexImage(img);
+   return tex;
+}
+
+// Check that a texture holds the pattern of writeBMP
+void checkBMP(const char *file, int w, int h, int bpp)
+{
+   unsigned int tex = LoadTexBMP(file);
+   unsigned char *pix = (unsigned char *)malloc(bpp * w * abs(h));
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+   glGetTexImage(GL_TEXTURE_2D, 0, bpp == 4 ? GL_BGRA : GL_BGR, GL_UNSIGNED_BYTE, pix);
+   glPixelStorei(GL_PACK_ALIGNMENT, 4);
+   // Top down files have the first row at the top
+   for (int j = 0; j < abs(h); j++)
+      for (int i = 0; i < bpp * w; i++)
+         if (pix[j * bpp * w + i] != (unsigned char)(i * 7 + (h < 0 ? abs(h) - 1 - j : j) * 13))
+            Fatal("Texture from %s differs at row %d byte %d\n", file, j, i);
+   glDeleteTextures(1, &tex);
+   free(pix);
+}
+
+// Best time of five draws of a texture repeated 16 times across the image
+double drawTexture(unsigned int tex)
+{
+   double best = 0;
+   glMatrixMode(GL_PROJECTION);
+   glLoadIdentity();
+   glMatrixMode(GL_MODELVIEW);
+   glLoadIdentity();
+   glDisable(GL_LIGHTING);
+   glDisable(GL_DEPTH_TEST);
+   glEnable(GL_TEXTURE_2D);
+   glBindTexture(GL_TEXTURE_2D, tex);
+   glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+   for (int k = 0; k < 5; k++)
+   {
+      glClear(GL_COLOR_BUFFER_BIT);
+      double t0 = now();
+      glBegin(GL_QUADS);
+      glTexCoord2f(0, 0);
+      glVertex2f(-1, -1);
+      glTexCoord2f(16, 0);
+      glVertex2f(+1, -1);
+      glTexCoord2f(16, 16);
+      glVertex2f(+1, +1);
+      glTexCoord2f(0, 16);
+      glVertex2f(-1, +1);
+      glEnd();
+      glFinish();
+      double t = now() - t0;
+      if (k == 0 || t < best)
+         best = t;
+   }
+   glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+   glDisable(GL_TEXTURE_2D);
+   glEnable(GL_DEPTH_TEST);
+   return best;
+}
+
+// Megabytes of every level of the bound texture
+double textureMB()
+{
+   double size = 0;
+   for (int k = 0;; k++)
+   {
+      int w, compressed, n;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, k, GL_TEXTURE_WIDTH, &w);
+      if (w == 0)
+         break;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, k, GL_TEXTURE_COMPRESSED, &compressed);
+      if (compressed)
+         glGetTexLevelParameteriv(GL_TEXTURE_2D, k, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &n);
+      else
+      {
+         int h;
+         glGetTexLevelParameteriv(GL_TEXTURE_2D, k, GL_TEXTURE_HEIGHT, &h);
+         n = 3 * w * h;
+      }
+      size += n;
+   }
+   return size / 1048576.0;
+}
+
+// Root mean square difference between level 0 of a texture and the pattern of writeBMP
+double textureError(unsigned int tex, int w, int h)
+{
+   unsigned char *pix = (unsigned char *)malloc(3 * w * h);
+   glBindTexture(GL_TEXTURE_2D, tex);
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+   glGetTexImage(GL_TEXTURE_2D, 0, GL_BGR, GL_UNSIGNED_BYTE, pix);
+   glPixelStorei(GL_PACK_ALIGNMENT, 4);
+   double err = 0;
+   for (int j = 0; j < h; j++)
+      for (int i = 0; i < 3 * w; i++)
+      {
+         int d = pix[j * 3 * w + i] - (unsigned char)(i * 7 + j * 13);
+         err += d * d;
+      }
+   free(pix);
+   return sqrt(err / (3.0 * w * h));
+}
+
+// Compare BMP loaders on an atlas with padded rows, then the mipmapped and
+// compressed texture cache, and print the report
+void runBMP()
+{
+   const char *file = "hw5bench.bmp";
+   const int w = 4095, h = 4096;
+   TexMode(TEX_RGB);
+   TexCache(0);
+   // Odd widths and top down files load correctly
+   writeBMP(file, 33, -17, 3);
+   checkBMP(file, 33, -17, 3);
+   writeBMP(file, 31, 19, 4);
+   checkBMP(file, 31, 19, 4);
+   writeBMP(file, w, h, 3);
+   checkBMP(file, w, h, 3);
+   // Level 0 as LoadTexBMP used to, then with glGenerateMipmap as LoadTexBMP does now
+   double tslow = loadBMP(file, loadBMPstdio);
+   double tfast = loadBMP(file, loadBMPlevel0);
+   double tmip = loadBMP(file, LoadTexBMP);
+   printf("  \"bmp\": {\"width\": %d, \"height\": %d, \"megabytes\": %.1f, \"stdio_ms\": %.1f, \"mmap_ms\": %.1f, \"speedup\": %.1f,\n",
+          w, h, ((3 * w + 3) & ~3) * h / 1048576.0, tslow, tfast, tslow / tfast);
+
+   // Level 0 only, mipmapped, then BC1 building the cache and from it
+   unsigned int tex[3];
+   tex[0] = loadBMPlevel0(file);
+   double mb[3], draw[3];
+   mb[0] = textureMB();
+   tex[1] = LoadTexBMP(file);
+   mb[1] = textureMB();
+   TexCache(1);
+   TexMode(TEX_BC1);
+   remove("hw5bench.bmp.cache");
+   double t0 = now();
+   tex[2] = LoadTexBMP(file);
+   glFinish();
+   double tbuild = now() - t0;
+   glDeleteTextures(1, tex + 2);
+   double tcache = loadBMP(file, LoadTexBMP);
+   tex[2] = LoadTexBMP(file);
+   mb[2] = textureMB();
+   for (int k = 0; k < 3; k++)
+      draw[k] = drawTexture(tex[k]);
+   double err = textureError(tex[2], w, h);
+   if (textureError(tex[1], w, h))
+      Fatal("Mipmapped texture differs from %s\n", file);
+   glDeleteTextures(3, tex);
+   TexMode(TEX_RGB);
+   remove(file);
+   remove("hw5bench.bmp.cache");
+   printf("          \"level0_mb\": %.1f, \"mipmap_mb\": %.1f, \"bc1_mb\": %.1f,\n", mb[0], mb[1], mb[2]);
+   printf("          \"mipmap_ms\": %.1f, \"generate_mipmap_ms\": %.1f, \"bc1_build_ms\": %.1f, \"bc1_cache_ms\": %.1f, \"bc1_rms_error\": %.1f,\n",
+          tmip, tmip - tfast, tbuild, tcache, err);
+   printf("          \"draw_level0_ms\": %.2f, \"draw_mipmap_ms\": %.2f, \"draw_bc1_ms\": %.2f},\n", draw[0], draw[1], draw[2]);
+}
+
+// Share textures between hundreds of props and OBJ files and print the report
+void runTextures()
+{
+   const int files = 4, props = 300;
+   char name[64];
+   TexCache(0);
+   for (int k = 0; k < files; k++)
+   {
+      sprintf(name, "hw5bench%d.bmp", k);
+      writeBMP(name, 256, 256, 3);
+   }
+
+   // Every prop loads its own texture
+   unsigned int *tex = (unsigned int *)malloc(props * sizeof(unsigned int));
+   double t0 = now();
+   for (int k = 0; k < props; k++)
+   {
+      sprintf(name, "hw5bench%d.bmp", k % files);
+      tex[k] = LoadTexBMP(name);
+   }
+   glFinish();
+   double tload = now() - t0;
+   glDeleteTextures(props, tex);
+
+   // Props share textures by path (alternately spelled ./file)
+   TextureStats start = TexStats;
+   t0 = now();
+   for (int k = 0; k < props; k++)
+   {
+      sprintf(name, "%shw5bench%d.bmp", k % 2 ? "./" : "", k % files);
+      tex[k] = GetTexture(name);
+   }
+   glFinish();
+   double tshare = now() - t0;
+   double mb = (TexStats.bytes - start.bytes) / 1048576.0;
+   if (TexStats.misses - start.misses != files || TexStats.hits - start.hits != props - files)
+      Fatal("Texture cache shared %ld of %d textures\n", TexStats.hits - start.hits, props);
+
+   // Materials of OBJ files using the same texture share it too
+   FILE *f = fopen("hw5bench_tex.mtl", "w");
+   if (!f)
+      Fatal("Cannot create hw5bench_tex.mtl\n");
+   for (int k = 0; k < 3; k++)
+      fprintf(f, "newmtl m%d\nKd 1 1 1\nmap_Kd hw5bench0.bmp\n", k);
+   fclose(f);
+   f = fopen("hw5bench_tex.obj", "w");
+   if (!f)
+      Fatal("Cannot create hw5bench_tex.obj\n");
+   fprintf(f, "mtllib hw5bench_tex.mtl\nv 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvn 0 0 1\n");
+   for (int k = 0; k < 3; k++)
+      fprintf(f, "usemtl m%d\nf 1/1/1 2/1/1 3/1/1\n", k);
+   fclose(f);
+   OBJCache(0);
+   start = TexStats;
+   Mesh *obj[2];
+   for (int k = 0; k < 2; k++)
+      obj[k] = LoadOBJMesh("hw5bench_tex.obj");
+   if (TexStats.misses != start.misses || TexStats.hits - start.hits != 6 || obj[0]->mtl[2].map != tex[0])
+      Fatal("OBJ materials do not share textures\n");
+   for (int k = 0; k < 2; k++)
+      FreeMesh(obj[k]);
+   OBJCache(1);
+
+   // Unused textures stay resident until over the budget, least recently used first
+   for (int k = props - 1; k >= 0; k--)
+      ReleaseTexture(tex[k]);
+   int resident = TexStats.textures;
+   start = TexStats;
+   TextureBudget(0);
+   int evicted = TexStats.evictions - start.evictions;
+   TextureBudget(256);
+   if (resident != files || evicted != files || TexStats.textures != 0)
+      Fatal("Texture cache kept %d of %d unused textures\n", TexStats.textures, resident);
+
+   for (int k = 0; k < files; k++)
+   {
+      sprintf(name, "hw5bench%d.bmp", k);
+      remove(name);
+   }
+   remove("hw5bench_tex.obj");
+   remove("hw5bench_tex.mtl");
+   TexCache(1);
+   free(tex);
+   printf("  \"textures\": {\"props\": %d, \"files\": %d, \"hits\": %ld, \"misses\": %ld, \"evictions\": %ld,\n",
+          props, files, TexStats.hits, TexStats.misses, TexStats.evictions);
+   printf("               \"load_ms\": %.1f, \"shared_ms\": %.1f, \"load_mb\": %.1f, \"shared_mb\": %.1f, \"speedup\": %.1f},\n",
+          tload, tshare, props * mb / files, mb, tload / tshare);
+}
+
+// Draw one frame of a loading mesh and texture and return the time uploading
+double assetFrame(int model, int tex, int bytes, int *loading)
+{
+   double t0 = now();
+   *loading = UploadAssets(bytes);
+   glFinish();
+   double t = now() - t0;
+   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+   glEnable(GL_TEXTURE_2D);
+   glBindTexture(GL_TEXTURE_2D, AssetTexture(tex));
+   Mesh *mesh = AssetMesh(model);
+   if (mesh)
+      DrawMesh(mesh);
+   glDisable(GL_TEXTURE_2D);
+   glFinish();
+   return t;
+}
+
+// Compare loading a model and texture at once with loading them in the background
+void runAssets(const char *file)
+{
+   const int budget = 4 << 20;
+   writeBMP("hw5bench_asset.bmp", 2048, 2048, 3);
+   TexCache(0);
+
+   // Everything in one frame
+   double t0 = now();
+   Mesh *mesh = LoadOBJMesh(file);
+   UploadMesh(mesh);
+   unsigned int tex = LoadTexBMP("hw5bench_asset.bmp");
+   glFinish();
+   double tsync = now() - t0;
+   FreeMesh(mesh);
+   glDeleteTextures(1, &tex);
+
+   // Background threads read, frames upload a few megabytes each
+   int frames = 0, loading = 1;
+   double worst = 0;
+   t0 = now();
+   int m = LoadMeshAsync(file);
+   int t = LoadTextureAsync("hw5bench_asset.bmp");
+   while (loading)
+   {
+      worst = fmax(worst, assetFrame(m, t, budget, &loading));
+      frames++;
+   }
+   double tasync = now() - t0;
+   if (AssetStatus(m) != ASSET_READY || AssetStatus(t) != ASSET_READY)
+      Fatal("Assets did not load: %s\n", AssetError(AssetStatus(m) == ASSET_ERROR ? m : t));
+   FreeAsset(m);
+   FreeAsset(t);
+
+   // Missing and broken files fail without ending the program
+   FILE *f = fopen("hw5bench_bad.bmp", "wb");
+   if (!f)
+      Fatal("Cannot create hw5bench_bad.bmp\n");
+   fprintf(f, "BM not really a bitmap");
+   fclose(f);
+   m = LoadMeshAsync("hw5bench_missing.obj");
+   t = LoadTextureAsync("hw5bench_bad.bmp");
+   while (loading || AssetStatus(m) == ASSET_QUEUED || AssetStatus(m) == ASSET_READING)
+      assetFrame(m, t, budget, &loading);
+   if (AssetStatus(m) != ASSET_ERROR || AssetStatus(t) != ASSET_ERROR || !AssetError(m) || !AssetError(t))
+      Fatal("Bad files did not fail\n");
+   FreeAsset(m);
+   FreeAsset(t);
+
+   remove("hw5bench_asset.bmp");
+   remove("hw5bench_bad.bmp");
+   TexCache(1);
+   printf("  \"assets\": {\"sync_ms\": %.1f, \"async_ms\": %.1f, \"frames\": %d, \"budget_mb\": %d, \"worst_upload_ms\": %.1f, \"stall_reduction\": %.1f}\n",
+          tsync, tasync, frames, budget >> 20, worst, tsync / worst);
+}
+
+// Load an OBJ file with many material switches from a big MTL library twice
+void runMaterials()
+{
+   const int materials = 4000, switches = 100000;
+   FILE *f = fopen("hw5bench_lib.mtl", "w");
+   if (!f)
+      Fatal("Cannot create hw5bench_lib.mtl\n");
+   for (int k = 0; k < materials; k++)
+      fprintf(f, "newmtl material%d\nKa 0 0 0\nKd %d 0 0\nKs 0 0 0\nNs 10\n", k, k);
+   fclose(f);
+   f = fopen("hw5bench_lib.obj", "w");
+   if (!f)
+      Fatal("Cannot create hw5bench_lib.obj\n");
+   fprintf(f, "mtllib hw5bench_lib.mtl\nv 0 0 0\nv 1 0 0\nv 0 1 0\n");
+   for (int k = 0; k < switches; k++)
+      fprintf(f, "usemtl material%d\nf 1 2 3\n", (int)(7919L * k % materials));
+   fclose(f);
+
+   // The second load finds the library already read
+   OBJCache(0);
+   OBJLevels(0);
+   double t[2];
+   Mesh *mesh[2];
+   for (int k = 0; k < 2; k++)
+   {
+      double t0 = now();
+      mesh[k] = ReadOBJMesh("hw5bench_lib.obj");
+      t[k] = now() - t0;
+   }
+   // Every switch is its own group with the right material
+   for (int k = 0; k < 2; k++)
+   {
+      if (mesh[k]->nm != materials || mesh[k]->ng != switches)
+         Fatal("Mesh has %d materials and %d groups\n", mesh[k]->nm, mesh[k]->ng);
+      for (int g = 0; g < switches; g++)
+         if (mesh[k]->mtl[mesh[k]->group[g].mtl].Kd[0] != 7919L * g % materials)
+            Fatal("Group %d has the wrong material\n", g);
+      FreeMesh(mesh[k]);
+   }
+   OBJLevels(3);
+   OBJCache(1);
+   remove("hw5bench_lib.obj");
+   remove("hw5bench_lib.mtl");
+   printf("  \"materials\": {\"materials\": %d, \"switches\": %d, \"first_load_ms\": %.1f, \"library_load_ms\": %.1f},\n",
+          materials, switches, t[0], t[1]);
+}
+
+// Compare OBJ readers and print the report
+void runOBJ(const char *file)
+{
+   // Synthetic model of about 40 MB
+   const char *temp = "hw5bench.obj";
+   if (!file)
+      writeOBJ(file = temp, 512);
+   FILE *f = fopen(file, "rb");
+   if (!f)
+      Fatal("Cannot open %s\n", file);
+   fseek(f, 0, SEEK_END);
+   double mb = ftell(f) / 1048576.0;
+   fclose(f);
+
+   // Load with both readers, keeping float vertexes to compare, optimize and simplify
+   MeshFormat(MESH_FLOAT);
+   Mesh *slow = NULL, *fast = NULL;
+   int threads = sysconf(_SC_NPROCESSORS_ONLN);
+   double tslow = loadOBJ(file, OBJ_STDIO, 1, 0, &slow);
+   double tfast = loadOBJ(file, OBJ_MMAP, 1, 0, &fast);
+   Mesh *par = NULL;
+   double tpar = loadOBJ(file, OBJ_MMAP, threads, 0, &par);
+   // The first load writes the cache if needed
+   Mesh *cached = NULL;
+   OBJCache(1);
+   OBJLevels(0);
+   FreeMesh(LoadOBJMesh(file));
+   double tcache = loadOBJ(file, OBJ_MMAP, 0, 1, &cached);
+   OBJMode(OBJ_MMAP);
+   OBJThreads(0);
+   OBJLevels(3);
+   MeshFormat(meshFormat);
+   // Default settings without the cache: LoadOBJMesh builds levels of detail, LoadOBJ does not
+   OBJCache(0);
+   double t0 = now();
+   Mesh *levels = LoadOBJMesh(file);
+   UploadMesh(levels);
+   glFinish();
+   double tlevels = now() - t0;
+   FreeMesh(levels);
+   t0 = now();
+   int list = LoadOBJ(file);
+   glFinish();
+   double tlist = now() - t0;
+   glDeleteLists(list, 1);
+   OBJCache(1);
+   if (slow->nv != fast->nv || slow->ni != fast->ni || memcmp(slow->index, fast->index, slow->ni * sizeof(unsigned int)))
+      Fatal("OBJ readers disagree on %s\n", file);
+   if (par->nv != fast->nv || par->ni != fast->ni || memcmp(par->vert, fast->vert, MESH_STRIDE * fast->nv * sizeof(float)))
+      Fatal("Threaded OBJ reader disagrees on %s\n", file);
+   if (!cached->map || cached->nv != fast->nv || cached->ni != fast->ni || memcmp(cached->vert, fast->vert, MESH_STRIDE * fast->nv * sizeof(float)))
+      Fatal("Mesh cache disagrees on %s\n", file);
+   double diff = 0;
+   for (int k = 0; k < MESH_STRIDE * slow->nv; k++)
+      diff = fmax(diff, fabs(slow->vert[k] - fast->vert[k]));
+
+   printf("  \"obj\": {\"file\": \"%s\", \"megabytes\": %.1f, \"vertexes\": %d, \"triangles\": %d,\n",
+          file == temp ? "synthetic" : file, mb, fast->nv, fast->ni / 3);
+   printf("          \"stdio_ms\": %.1f, \"mmap_ms\": %.1f, \"stdio_mb_per_s\": %.1f, \"mmap_mb_per_s\": %.1f,\n",
+          tslow, tfast, 1e3 * mb / tslow, 1e3 * mb / tfast);
+   printf("          \"threads\": %d, \"mmap_threads_ms\": %.1f, \"mmap_threads_mb_per_s\": %.1f,\n",
+          threads, tpar, 1e3 * mb / tpar);
+   printf("          \"cache_ms\": %.1f, \"cache_mb_per_s\": %.1f,\n", tcache, 1e3 * mb / tcache);
+   printf("          \"default_mesh_ms\": %.1f, \"default_display_list_ms\": %.1f,\n", tlevels, tlist);
+   runOptimize(fast);
+   runSimplify(fast);
+   runPacked(fast);
+   printf("          \"speedup\": %.1f, \"threads_speedup\": %.1f, \"cache_speedup\": %.1f, \"max_difference\": %g},\n",
+          tslow / tfast, tslow / tpar, tslow / tcache, diff);
+   runAssets(file);
+   FreeMesh(cached);
+   FreeMesh(par);
+   FreeMesh(slow);
+   FreeMesh(fast);
+   if (file == temp)
+   {
+      remove(temp);
+      remove("hw5bench.obj.cache");
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   int frames = 60;
+   const char *obj = NULL;
+
+   // Command line
+   for (int i = 1; i < argc; i++)
+   {
+      if (!strcmp(argv[i], "-immediate"))
+         meshMode = MESH_IMMEDIATE;
+      else if (!strcmp(argv[i], "-array"))
+         meshMode = MESH_ARRAY;
+      else if (!strcmp(argv[i], "-vbo"))
+         meshMode = MESH_VBO;
+      else if (!strcmp(argv[i], "-float"))
+         meshFormat = MESH_FLOAT;
+      else if (!strcmp(argv[i], "-packed"))
+         meshFormat = MESH_PACKED;
+      else if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+         frames = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-size") && i + 1 < argc)
+         sscanf(argv[++i], "%dx%d", &width, &height);
+      else if (!strcmp(argv[i], "-obj") && i + 1 < argc)
+         obj = argv[++i];
+      else
+         Fatal("Usage: %s [-immediate|-array|-vbo] [-float|-packed] [-frames N] [-size WxH] [-obj file]\n", argv[0]);
+   }
+   if (frames < 1 || width < 1 || height < 1)
+      Fatal("Invalid frame count or size\n");
+
+   // Same setup as main() in hw5.c
+   createContext(width, height);
+   MeshMode(meshMode);
+   MeshFormat(meshFormat);
+   glEnable(GL_DEPTH_TEST);
+
+   // Run every scene
+   printf("{\n  \"renderer\": \"%s\",\n  \"version\": \"%s\",\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+   printf("  \"mesh\": \"%s\",\n  \"format\": \"%s\",\n  \"width\": %d,\n  \"height\": %d,\n  \"scenes\": [\n",
+          meshMode == MESH_VBO ? "vbo" : meshMode == MESH_ARRAY ? "array" : "immediate",
+          meshFormat == MESH_PACKED ? "packed" : "float", width, height);
+   int n = sizeof(scenes) / sizeof(scenes[0]);
+   for (int k = 0; k < n; k++)
+   {
+      runScene(&scenes[k], frames);
+      printf("%s\n", k < n - 1 ? "," : "");
+      fflush(stdout);
+   }
+   printf("  ],\n");
+   runSIMD();
+   runLights();
+   runBMP();
+   runTextures();
+   runMaterials();
+   runOBJ(obj);
+   printf("}\n");
+   return 0;
+}
@@ -0,0 +1,202 @@
+//  CSCIx229 library
+//  Bounding volumes and view frustum culling
+#include "CSCIx229.h"
+
+//
+//  Objects are bounded by axis aligned boxes kept in a bounding volume
+//  hierarchy.  CullBVH walks it against the planes from Frustum, skipping
+//  subtrees outside the view and taking subtrees inside the view whole, so
+//  the work grows with the number of visible objects rather than the total.
+//
+
+//  Most objects in a leaf
+#define LEAF 4
+
+//
+//  Bounding box of the vertexes of a mesh
+//
+void MeshBounds(const Mesh* mesh,float min[3],float max[3])
+{
+   for (int i=0;i<3;i++)
+   {
+      min[i] = mesh->nv ? +1e30 : 0;
+      max[i] = mesh->nv ? -1e30 : 0;
+   }
+   for (int k=0;k<mesh->nv;k++)
+   {
+      //  Packed meshes may only have the packed positions
+      const float* p = mesh->vert ? mesh->vert+MESH_STRIDE*k : &mesh->packed[k].x;
+      for (int i=0;i<3;i++)
+      {
+         float x = p[i];
+         if (x<min[i]) min[i] = x;
+         if (x>max[i]) max[i] = x;
+      }
+   }
+}
+
+//
+//  Test a box against the view volume
+//    Returns 0 if outside, 1 if crossing a plane and 2 if inside
+//
+int BoxVisible(const float plane[6][4],const float min[3],const float max[3])
+{
+   int in=2;
+   for (int k=0;k<6;k++)
+   {
+      const float* P = plane[k];
+      //  Corners farthest inside and outside the plane
+      float far  = P[3],near = P[3];
+      for (int i=0;i<3;i++)
+      {
+         far  += P[i]*(P[i]>0 ? max[i] : min[i]);
+         near += P[i]*(P[i]>0 ? min[i] : max[i]);
+      }
+      if (far<0) return 0;
+      if (near<0) in = 1;
+   }
+   return in;
+}
+
+//
+//  Test a sphere against the view volume
+//    Returns 0 if outside, 1 if crossing a plane and 2 if inside
+//
+int SphereVisible(const float plane[6][4],const float center[3],float r)
+{
+   int in=2;
+   for (int k=0;k<6;k++)
+   {
+      const float* P = plane[k];
+      float d = P[0]*center[0]+P[1]*center[1]+P[2]*center[2]+P[3];
+      if (d<-r) return 0;
+      if (d<r) in = 1;
+   }
+   return in;
+}
+
+//
+//  Box of items first to first+count-1
+//
+static void Bound(const BVH* bvh,const float* box,int first,int count,float min[3],float max[3])
+{
+   for (int i=0;i<3;i++)
+   {
+      min[i] = +1e30;
+      max[i] = -1e30;
+   }
+   for (int k=first;k<first+count;k++)
+   {
+      const float* b = box+6*bvh->item[k];
+      for (int i=0;i<3;i++)
+      {
+         if (b[i]<min[i])   min[i] = b[i];
+         if (b[i+3]>max[i]) max[i] = b[i+3];
+      }
+   }
+}
+
+//
+//  Center of an item along an axis used to sort items
+//
+static const float* sortbox;
+static int sortaxis;
+static int CompareCenter(const void* a,const void* b)
+{
+   const float* A = sortbox+6*(*(const int*)a);
+   const float* B = sortbox+6*(*(const int*)b);
+   float x = A[sortaxis]+A[sortaxis+3];
+   float y = B[sortaxis]+B[sortaxis+3];
+   return (x>y) - (x<y);
+}
+
+//
+//  Split node k at the median of its longest axis
+//
+static void Split(BVH* bvh,const float* box,int k)
+{
+   BVHNode* node = bvh->node+k;
+   Bound(bvh,box,node->first,node->count,node->min,node->max);
+   node->left = -1;
+   if (node->count<=LEAF) return;
+   //  Sort items by center along the longest axis
+   int axis=0;
+   for (int i=1;i<3;i++)
+      if (node->max[i]-node->min[i]>node->max[axis]-node->min[axis]) axis = i;
+   sortbox = box;
+   sortaxis = axis;
+   qsort(bvh->item+node->first,node->count,sizeof(int),CompareCenter);
+   //  Children are stored next to each other
+   int left = bvh->n;
+   bvh->n += 2;
+   node = bvh->node+k;
+   node->left = left;
+   int half = node->count/2;
+   bvh->node[left] = (BVHNode){{0,0,0},{0,0,0},-1,node->first,half};
+   bvh->node[left+1] = (BVHNode){{0,0,0},{0,0,0},-1,node->first+half,node->count-half};
+   Split(bvh,box,left);
+   Split(bvh,box,left+1);
+}
+
+//
+//  Build hierarchy over n boxes
+//    box holds the minimum x,y,z and maximum x,y,z of each item
+//
+void BuildBVH(BVH* bvh,const float* box,int n)
+{
+   FreeBVH(bvh);
+   //  A binary tree with at least one item per leaf has fewer than 2n nodes
+   bvh->node = (BVHNode*)malloc((2*n+1)*sizeof(BVHNode));
+   bvh->item = (int*)malloc((n+1)*sizeof(int));
+   if (!bvh->node || !bvh->item) Fatal("Cannot allocate hierarchy of %d boxes\n",n);
+   for (int k=0;k<n;k++)
+      bvh->item[k] = k;
+   bvh->n = 1;
+   bvh->node[0] = (BVHNode){{0,0,0},{0,0,0},-1,0,n};
+   Split(bvh,box,0);
+}
+
+//
+//  Free hierarchy
+//
+void FreeBVH(BVH* bvh)
+{
+   free(bvh->node);
+   free(bvh->item);
+   bvh->n = 0;
+   bvh->node = NULL;
+   bvh->item = NULL;
+}
+
+//
+//  Add visible items of node k to the list
+//
+static int Visit(const BVH* bvh,const float plane[6][4],int k,int inside,int* visible,int n)
+{
+   const BVHNode* node = bvh->node+k;
+   //  Skip subtrees outside, stop testing inside
+   if (!inside)
+   {
+      int in = BoxVisible(plane,node->min,node->max);
+      if (!in) return n;
+      inside = (in==2);
+   }
+   if (node->left<0 || inside)
+   {
+      memcpy(visible+n,bvh->item+node->first,node->count*sizeof(int));
+      return n+node->count;
+   }
+   n = Visit(bvh,plane,node->left,0,visible,n);
+   return Visit(bvh,plane,node->left+1,0,visible,n);
+}
+
+//
+//  List items whose boxes may be in the view volume
+//    visible needs room for every item
+//    Returns the number of visible items
+//
+int CullBVH(const BVH* bvh,const float plane[6][4],int* visible)
+{
+   if (!bvh->n || !bvh->node[0].count) return 0;
+   return Visit(bvh,plane,0,0,visible,0);
+}
@@ -2,6 +2,33 @@
 //  Willem A. (Vlakkies) Schreuder
 #include "CSCIx229.h"
 
+//
+//  Threads loading in the background catch Fatal with FatalJump and get
+//  the message from FatalMessage instead of ending the program
+//
+#define LEN 1024  //  Maximum length of message
+static THREAD_LOCAL jmp_buf* jump=NULL;
+static THREAD_LOCAL char message[LEN];
+
+//
+//  Jump to env (from setjmp) on Fatal in this thread (NULL exits again)
+//    Returns the previous env so it can be restored
+//
+jmp_buf* FatalJump(jmp_buf* env)
+{
+   jmp_buf* prev = jump;
+   jump = env;
+   return prev;
+}
+
+//
+//  Message of the last Fatal caught in this thread
+//
+const char* FatalMessage(void)
+{
+   return message;
+}
+
 //
 //  Print message to stderr and exit
 //
@@ -9,6 +36,15 @@ void Fatal(const char* format , ...)
 {
    va_list args;
    va_start(args,format);
+   if (jump)
+   {
+      //  Keep message and return to setjmp
+      jmp_buf* env = jump;
+      jump = NULL;
+      vsnprintf(message,LEN,format,args);
+      va_end(args);
+      longjmp(*env,1);
+   }
    vfprintf(stderr,format,args);
    va_end(args);
    exit(1);
@@ -2,6 +2,7 @@
  *  Lorenz Attractor Visualization
  */
 #include "CSCIx229.h"
+#include <stddef.h>
 #ifdef USEGLEW
 #include <GL/glew.h>
 #endif
@@ -16,6 +17,15 @@
 #ifndef RES
 #define RES 1
 #endif
+//  The headless benchmark (compiled with -DBENCH) has no window or fonts
+#ifdef BENCH
+#undef glutSwapBuffers
+#undef glutPostRedisplay
+#undef glutBitmapCharacter
+#define glutSwapBuffers() glFinish()
+#define glutPostRedisplay()
+#define glutBitmapCharacter(font, ch) ((void)(ch))
+#endif
 
 //-----------------------------------------------------------
 // Struct declarations
@@ -73,6 +83,31 @@ typedef struct EllipseStruct
    double rMinor; // Minor radius
 } EllipseStruct;
 
+// Placement of one bicycle
+typedef struct Transform
+{
+   Point origin;    // Position of the seat post
+   Point direction; // Forward direction
+   Point scale;     // Scale in each direction
+} Transform;
+
+// Primitive placed relative to its parent
+typedef struct Part
+{
+   Mesh *mesh;    // Cached unit primitive
+   float mat[16]; // Placement of the primitive
+   int material;  // Bicycle material
+} Part;
+
+// Material settings for bicycle parts
+typedef struct BikeMaterial
+{
+   float color[4];          // glColor (ambient and diffuse with GL_COLOR_MATERIAL)
+   float shininess;         // Specular exponent
+   float specular[4];       // Specular color
+   float ambientDiffuse[4]; // Ambient and diffuse color
+} BikeMaterial;
+
 double Tan(double theta)
 {
    return tan(theta * 3.1415926535 / 180.0);
@@ -96,6 +131,19 @@ double Ez = -1.0;        // first person camera z position
 int axes = 1;  // Display axes or not
 int light = 1; // Lighting on or off
 int moveLight = 1; // Move light in idle or not
+int meshMode = MESH_VBO; // How geometry is sent to OpenGL (chosen at startup)
+int meshFormat = MESH_PACKED; // Packed or float vertexes (chosen at startup)
+int lod = 1;       // Pick primitive segments by size on screen or not
+int cull = 1;      // Skip objects outside the view or not
+int shaderLight = 0; // Per pixel lighting shader or fixed function lighting
+int clusters = 1;    // Shade only the lights near each pixel (per pixel lighting only)
+int shadows = 0;     // Shadows of the moving light on a ground (per pixel lighting only)
+int ground = 0;      // Draw the ground without shadows too (benchmark baseline)
+int shadowSize = 1024; // Width and height of the shadow map (chosen at startup)
+int shadowPCF = 3;     // Width of the shadow filter in texels (chosen at startup)
+char *modelFile = NULL; // OBJ model loaded in the background (chosen at startup)
+int model = -1;         // Asset of the model
+int uploadMB = 4;       // Megabytes copied to OpenGL per frame while loading (chosen at startup)
 
 // Light values
 int one = 1;       // Unit value
@@ -109,6 +157,57 @@ int diffuse = 50;  // Diffuse intensity (%)
 int specular = 50;  // Specular intensity (%)
 int zh = 90;       // Light azimuth
 float ylight = 0;  // Elevation of light
+int streetLights = 0;  // Number of street lights (per pixel lighting only)
+Light *lights = NULL;  // Moving light followed by the street lights
+
+//  Colors for materials and light properties
+#define WHITE {1.0, 1.0, 1.0, 1.0}
+#define RED {1.0, 0.0, 0.0, 1.0}
+#define LIGHTGREY {0.7882352941176471, 0.7882352941176471, 0.7882352941176471, 1.0}
+#define DARKGREY {0.392156862745098, 0.392156862745098, 0.392156862745098, 1.0}
+#define SILVER {0.8196078431372549, 0.8196078431372549, 0.8196078431372549, 1.0}
+#define BLACK {0.0, 0.0, 0.0, 1.0}
+
+// Bicycle materials
+enum {SEATPOST, CHROME, FRAME, HANDLEBAR, SEAT, RUBBER};
+const BikeMaterial bikeMaterials[] = {
+    {LIGHTGREY, 64.0, LIGHTGREY, LIGHTGREY}, // Grey
+    {SILVER, 128.0, WHITE, BLACK},           // Chrome silver
+    {RED, 128.0, WHITE, RED},                // Chrome red (for speed)
+    {DARKGREY, 1.0, DARKGREY, DARKGREY},     // Darker grey - not as shiny
+    {DARKGREY, 4.0, LIGHTGREY, LIGHTGREY},   // Seat
+    {BLACK, 0.0, DARKGREY, BLACK},           // Black rubber
+};
+
+// Bicycle scene graph
+Scene bike = {0, 0, NULL}; // Built the first time a bicycle is drawn
+int steerNode;             // Handlebars, fork and front wheel
+int frontSpinNode;         // Front wheel
+int rearSpinNode;          // Rear wheel
+Point steerPivot;          // Top of the head tube
+Point steerAxis;           // Direction of the head tube
+Point frontHub;            // Front axle
+Point rearHub;             // Rear axle
+Point bikeCenter;          // Center of the bounding sphere
+double bikeRadius = 0.0;   // Radius of the bounding sphere (any steering angle)
+double groundHeight = 0.0; // Height of the bottom of the wheels
+double steer = 0.0;        // Steering angle in degrees
+double spin = 0.0;         // Wheel rotation in degrees
+int ride = 0;              // Spin the wheels in idle or not
+
+// Parts waiting to be drawn, sorted by material
+RenderQueue queue = {0, 0, NULL};
+
+// Viewing transformation of the current frame
+float view[16];
+float frustum[6][4]; // View volume planes in world coordinates
+
+// Fleet of bicycles
+int fleet = 0;                // Number of bicycles in the fleet (0 for a single bicycle)
+Transform *fleetBikes = NULL; // Placement of each bicycle in the fleet
+BVH fleetTree = {0, NULL, NULL}; // Bounding volume hierarchy of the fleet
+int *fleetVisible = NULL;        // Bicycles found in the view volume
+Transform *fleetDrawn = NULL;    // Placement of the visible bicycles
 
 /*
  *  Check for OpenGL errors
@@ -120,18 +219,6 @@ void ErrCheck(const char *where)
       fprintf(stderr, "ERROR: %s [%s]\n", gluErrorString(err), where);
 }
 
-/*
- *  Print message to stderr and exit
- */
-void Fatal(const char *format, ...)
-{
-   va_list args;
-   va_start(args, format);
-   vfprintf(stderr, format, args);
-   va_end(args);
-   exit(1);
-}
-
 /*
  *  Convenience routine to output raster text
  *  Use VARARGS to make this more flexible
@@ -162,9 +249,23 @@ Angle computeAngles(Point dir)
    return angles;
 }
 
-// Lets you specify the center of the two end points of the cylinder and draws it with the associated radius
-// Enhanced version with global coordinate coloring
-void drawCylinder(Point p1, Point p2, double r)
+// Build the matrix that moves the origin to a point, aligns the khat vector with an axis and then scales
+// Same as glTranslated, three glRotated and glScaled
+void placement(float mat[16], Point origin, Point axis, Point scale)
+{
+   // Compute the angles for aligning khat with the axis vector
+   Angle angles = computeAngles(axis);
+
+   MatIdentity(mat);
+   MatTranslate(mat, origin.x, origin.y, origin.z);
+   MatRotate(mat, angles.th, 0.0, 0.0, 1.0);  // Rotate about Z axis
+   MatRotate(mat, angles.ph, 0.0, 1.0, 0.0);  // Rotate about Y axis
+   MatRotate(mat, angles.psi, 1.0, 0.0, 0.0); // Rotate about X axis
+   MatScale(mat, scale.x, scale.y, scale.z);
+}
+
+// Place a cylinder between the centers of its two end caps
+void cylinderPart(Part *part, Point p1, Point p2, double r)
 {
    // Compute the direction vector from p1 to p2
    Point dir = {
@@ -175,170 +276,144 @@ void drawCylinder(Point p1, Point p2, double r)
    // Compute the length of the cylinder
    double length = sqrt(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z);
 
-   // Compute the angles for aligning the cylinder with the direction vector
-   Angle angles = computeAngles(dir);
-
-   // Save current transformation matrix
-   glPushMatrix();
-
-   // Set the origin to be the base of the cylinder
-   glTranslated(p1.x, p1.y, p1.z);
-
-   // Apply rotations
-   glRotated(angles.th, 0.0, 0.0, 1.0);  // Rotate about Z axis
-   glRotated(angles.ph, 0.0, 1.0, 0.0);  // Rotate about Y axis
-   glRotated(angles.psi, 1.0, 0.0, 0.0); // Rotate about X axis
+   // Stretch the unit cylinder to the requested radius and length
+   placement(part->mat, p1, dir, (Point){r, r, length});
 
-   // Body of the cylinder
    const int deltaDegree = 15; // degrees per segment
-   glBegin(GL_QUAD_STRIP);
-   for (int degree = 0; degree <= 360; degree += deltaDegree)
-   {
-      double x = r * Cos(degree);
-      double y = r * Sin(degree);
-
-      // Bottom vertex - compute global position
-      glNormal3d(Cos(degree), Sin(degree), 0.0); // Normal points outwards
-      glVertex3d(x, y, 0.0);
-
-      // Top vertex - compute global position
-      glNormal3d(Cos(degree), Sin(degree), 0.0); // Normal points outwards
-      glVertex3d(x, y, length);
-   }
-   glEnd();
-
-   // Top circle
-   glBegin(GL_TRIANGLE_FAN);
-   // Center vertex
-   glNormal3d(0.0, 0.0, 1.0); // Normal points forward
-   glVertex3d(0.0, 0.0, length);
-
-   for (int degree = 0; degree <= 360; degree += deltaDegree)
-   {
-      double x = r * Cos(degree);
-      double y = r * Sin(degree);
-      glNormal3d(0.0, 0.0, 1.0); // Normal points forward
-      glVertex3d(x, y, length);
-   }
-   glEnd();
-
-   // Bottom circle
-   glBegin(GL_TRIANGLE_FAN);
-   // Center vertex
-   glNormal3d(0.0, 0.0, -1.0); // Normal points backward
-   glVertex3d(0.0, 0.0, 0.0);
+   part->mesh = CylinderMesh(360 / deltaDegree);
+}
 
-   for (int degree = 0; degree <= 360; degree += deltaDegree)
-   {
-      double x = r * Cos(degree);
-      double y = r * Sin(degree);
-      glNormal3d(0.0, 0.0, -1.0); // Normal points backward
-      glVertex3d(x, y, 0.0);
-   }
-   glEnd();
+// Place a torus
+void torusPart(Part *part, Torus t)
+{
+   // Scale the unit torus to the major radius
+   placement(part->mat, t.center, t.axis, (Point){t.rMajor, t.rMajor, t.rMajor});
 
-   // Restore transformation matrix
-   glPopMatrix();
+   // Use the unit torus with the same tube to ring ratio
+   const int deltaDegree = 15; // degrees per segment
+   part->mesh = TorusMesh(360 / deltaDegree, t.rMinor / t.rMajor);
 }
 
-void drawTorus(Torus t)
+// Place an ellipse
+void ellipsePart(Part *part, EllipseStruct e)
 {
-   // Save current transformation matrix
-   glPushMatrix();
-
-   // Set the origin to be the center of the torus
-   glTranslated(t.center.x, t.center.y, t.center.z);
+   // Scale by the major and minor axes
+   placement(part->mat, e.center, e.axis, (Point){e.rMinor, e.rMajor, e.rMajor});
 
-   // Compute the angles for aligning the torus with the axis vector
-   Angle angles = computeAngles(t.axis);
+   const int deltaDegree = 15; // degrees per segment
+   part->mesh = SphereMesh(360 / deltaDegree);
+}
 
-   // Apply rotations
-   glRotated(angles.th, 0.0, 0.0, 1.0);  // Rotate about Z axis
-   glRotated(angles.ph, 0.0, 1.0, 0.0);  // Rotate about Y axis
-   glRotated(angles.psi, 1.0, 0.0, 0.0); // Rotate about X axis
+// Primitive with the level of detail suited to its size on screen
+// model places the primitive in the world
+Mesh *partLOD(Mesh *mesh, const float model[16])
+{
+   if (!lod)
+      return mesh;
+   float mat[16];
+   MatMultiply(mat, view, model);
+   return PrimitiveLOD(mesh, mat);
+}
 
-   // Draw torus using quad strips
-   double deltaDegree = 15; // degrees per segment
-   for (double theta = 0; theta <= 360; theta += deltaDegree)
+// Draw the model loaded in the background next to the bicycle
+// A box stands in for it until it is uploaded
+void drawModel()
+{
+   static Mesh *fitted = NULL; // Mesh the size was taken from
+   static float center[3], size = 1.0;
+   Mesh *mesh = AssetMesh(model);
+   if (!mesh)
+      return;
+   // Fit the model in a unit cube
+   if (mesh != fitted)
    {
-      glBegin(GL_QUAD_STRIP);
-
-      for (double phi = 0; phi <= 360; phi += deltaDegree)
+      float min[3], max[3];
+      MeshBounds(mesh, min, max);
+      size = 0.0;
+      for (int i = 0; i < 3; i++)
       {
-         // Equation for torus
-         double x1 = (t.rMajor + t.rMinor * Cos(theta)) * Cos(phi);
-         double y1 = (t.rMajor + t.rMinor * Cos(theta)) * Sin(phi);
-         double z1 = t.rMinor * Sin(theta);
-         glNormal3d(Cos(theta) * Cos(phi), Cos(theta) * Sin(phi), Sin(theta));
-         glVertex3d(x1, y1, z1);
-
-         double x2 = (t.rMajor + t.rMinor * Cos(theta + deltaDegree)) * Cos(phi + deltaDegree);
-         double y2 = (t.rMajor + t.rMinor * Cos(theta + deltaDegree)) * Sin(phi + deltaDegree);
-         double z2 = t.rMinor * Sin(theta + deltaDegree);
-         glNormal3d(Cos(theta + deltaDegree) * Cos(phi + deltaDegree),
-                    Cos(theta + deltaDegree) * Sin(phi + deltaDegree),
-                    Sin(theta + deltaDegree));
-         glVertex3d(x2, y2, z2);
+         center[i] = (min[i] + max[i]) / 2;
+         size = fmax(size, max[i] - min[i]);
       }
-      glEnd();
+      if (size <= 0.0)
+         size = 1.0;
+      fitted = mesh;
    }
-
-   // Restore transformation matrix to whatever it was before we drew the torus
+   glPushMatrix();
+   glTranslated(2.0, 0.5, 0.0);
+   glScaled(1 / size, 1 / size, 1 / size);
+   glTranslated(-center[0], -center[1], -center[2]);
+   glColor3f(1.0, 1.0, 1.0);
+   DrawMesh(mesh);
    glPopMatrix();
 }
 
-void drawEllipse(EllipseStruct e)
+// Draw a part using the current material
+void drawPart(Part *part)
 {
-   // Save current transformation matrix
    glPushMatrix();
+   glMultMatrixf(part->mat);
+   DrawMesh(partLOD(part->mesh, part->mat));
+   glPopMatrix();
+}
 
-   // Set the origin to be the center of the ellipse
-   glTranslated(e.center.x, e.center.y, e.center.z);
-
-   // Compute the angles for aligning the ellipse with the axis vector
-   Angle angles = computeAngles(e.axis);
-
-   // Apply rotations
-   glRotated(angles.th, 0.0, 0.0, 1.0);  // Rotate about Z axis
-   glRotated(angles.ph, 0.0, 1.0, 0.0);  // Rotate about Y axis
-   glRotated(angles.psi, 1.0, 0.0, 0.0); // Rotate about X axis
-
-   // Scale by the major and minor axes
-   glScaled(e.rMinor, 1.0 * e.rMajor, e.rMajor);
+// Lets you specify the center of the two end points of the cylinder and draws it with the associated radius
+void drawCylinder(Point p1, Point p2, double r)
+{
+   Part part;
+   cylinderPart(&part, p1, p2, r);
+   drawPart(&part);
+}
 
-   //  Latitude bands
-   double deltaDegree = 15; // degrees per segment
-   for (int ph = -90; ph < 90; ph += deltaDegree)
-   {
-      glBegin(GL_QUAD_STRIP);
-      for (int th = 0; th <= 360; th += deltaDegree)
-      {
-         double x1 = Sin(th) * Cos(ph);
-         double y1 = Sin(ph);
-         double z1 = Cos(th) * Cos(ph);
+void drawTorus(Torus t)
+{
+   Part part;
+   torusPart(&part, t);
+   drawPart(&part);
+}
 
-         double x2 = Sin(th) * Cos(ph + deltaDegree);
-         double y2 = Sin(ph + deltaDegree);
-         double z2 = Cos(th) * Cos(ph + deltaDegree);
+void drawEllipse(EllipseStruct e)
+{
+   Part part;
+   ellipsePart(&part, e);
+   drawPart(&part);
+}
 
-         glNormal3d(x1, y1, z1);
-         glVertex3d(x1, y1, z1);
+// Set one of the bicycle materials
+void setBikeMaterial(int k)
+{
+   // Values that are already set are skipped
+   const BikeMaterial *mat = &bikeMaterials[k];
+   SetColor(mat->color);
+   SetMaterialf(GL_SHININESS, mat->shininess);
+   SetMaterialfv(GL_SPECULAR, mat->specular);
+   SetMaterialfv(GL_AMBIENT_AND_DIFFUSE, mat->ambientDiffuse);
+}
 
-         glNormal3d(x2, y2, z2);
-         glVertex3d(x2, y2, z2);
-      }
-      glEnd();
-   }
+// Distance between two points
+double pointDistance(Point a, Point b)
+{
+   return sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z));
+}
 
-   // Restore transformation matrix to whatever it was before we drew the ellipse
-   glPopMatrix();
+// Grow the bicycle bounding sphere to hold a ball of radius r around a point
+void boundBike(Point p, double r)
+{
+   double d = pointDistance(p, bikeCenter) + r;
+   if (d > bikeRadius)
+      bikeRadius = d;
 }
 
-void drawBicycle(Point origin, Point direction, Point scale)
+// Add a part to the bicycle scene graph
+int addPart(int parent, Part part, int material)
 {
-   // Reference angle for forward direction
-   Angle forward = computeAngles(direction);
+   return AddNode(&bike, parent, part.mat, part.mesh, material);
+}
 
+// Build the bicycle scene graph relative to the seat post
+// This only needs to be done once, steering and wheel spin are applied in updateBike
+void buildBike()
+{
    // Bike parameters for Specialized S-Works Diverge
    // Sourced: https://geometrygeeks.bike/compare/specialized-diverge-s-works-2021-54,cannondale-topstone-carbon-2020-md,3t-cycling-exploro-2020-m/
    // All dimensions in m and degrees
@@ -398,84 +473,492 @@ void drawBicycle(Point origin, Point direction, Point scale)
    Point handleBarEndRight = handlebarRight;
    handleBarEndRight.x += 0.1;
 
-   //  Colors for materials and light properties
-   float white[] = {1.0, 1.0, 1.0, 1.0};
-   float red[] = {1.0, 0.0, 0.0, 1.0};
-   float lightGrey[] = {0.7882352941176471, 0.7882352941176471, 0.7882352941176471, 1.0};
-   float darkGrey[] = {0.392156862745098, 0.392156862745098, 0.392156862745098, 1.0};
-   float silver[] = {0.8196078431372549, 0.8196078431372549, 0.8196078431372549, 1.0};
-   float black[] = {0.0, 0.0, 0.0, 1.0};
-
-   // Apply rotation
-   glPushMatrix();
-   glTranslated(origin.x, origin.y, origin.z);
-   glRotated(forward.th, 0.0, 0.0, 1.0);  // Rotate about Z axis
-   glRotated(forward.ph, 0.0, 1.0, 0.0);  // Rotate about Y axis
-   glRotated(forward.psi, 1.0, 0.0, 0.0); // Rotate about X axis
-   glScaled(scale.x, scale.y, scale.z);   // Scale to desired size
+   // Pivots for the moving parts
+   steerPivot = headTubeTop;
+   steerAxis = (Point){headTubeTop.x - headTubeBottom.x, headTubeTop.y - headTubeBottom.y, headTubeTop.z - headTubeBottom.z};
+   frontHub = frontAxle;
+   rearHub = rearAxle;
+   groundHeight = rearAxle.y - wheelRadius - 0.0254;
+
+   // Bounding sphere from the frame points, centered between the axles and from the ground to the seat
+   bikeCenter = (Point){0.0, 0.5 * (rearAxle.y - wheelRadius + seatTubeTop.y), 0.5 * (rearAxle.z + frontAxle.z)};
+   bikeRadius = 0.0;
+   Point framePoints[] = {seatPost, seatTubeTop, seatTubeBottom, midHeadTube, headTubeTop, headTubeBottom, rearAxleLeft, rearAxleRight};
+   for (int i = 0; i < (int)(sizeof(framePoints) / sizeof(Point)); i++)
+      boundBike(framePoints[i], r);
+   boundBike(rearAxle, wheelRadius + 0.0254);
+   boundBike(seatTubeTop, 0.1);
+   // Steering turns the front about the head tube, so bound the front parts by their reach from the pivot
+   Point steerPoints[] = {frontAxleLeft, frontAxleRight, handleBarEndLeft, handleBarEndRight};
+   for (int i = 0; i < (int)(sizeof(steerPoints) / sizeof(Point)); i++)
+      boundBike(steerPivot, pointDistance(steerPoints[i], steerPivot) + 1.1 * r);
+   boundBike(steerPivot, pointDistance(frontAxle, steerPivot) + wheelRadius + 0.0254);
+
+   // The frame is the root, the steering turns about the head tube and the wheels spin about the axles
+   int frame = AddNode(&bike, -1, NULL, NULL, 0);
+   steerNode = AddNode(&bike, frame, NULL, NULL, 0);
+   frontSpinNode = AddNode(&bike, steerNode, NULL, NULL, 0);
+   rearSpinNode = AddNode(&bike, frame, NULL, NULL, 0);
+   Part part;
 
    // Grey color
-   glColor4f(lightGrey[0], lightGrey[1], lightGrey[2], lightGrey[3]);
-   glMaterialf( GL_FRONT_AND_BACK, GL_SHININESS, 64.0);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, lightGrey);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, lightGrey);
-   drawCylinder(seatPost, seatTubeTop, r);         // Actual seat post
+   cylinderPart(&part, seatPost, seatTubeTop, r);         // Actual seat post
+   addPart(frame, part, SEATPOST);
 
    // Chrome silver
-   glColor4f(silver[0], silver[1], silver[2], silver[3]);
-   glMaterialf( GL_FRONT_AND_BACK, GL_SHININESS, 128.0);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, white);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, black);
-   drawCylinder(rearAxleLeft, rearAxleRight, r);   // Rear axle
-   drawCylinder(frontAxleLeft, frontAxleRight, r); // Front axle
+   cylinderPart(&part, rearAxleLeft, rearAxleRight, r);   // Rear axle
+   addPart(frame, part, CHROME);
+   cylinderPart(&part, frontAxleLeft, frontAxleRight, r); // Front axle
+   addPart(steerNode, part, CHROME);
 
    // Chrome red (for speed)
-   glColor4f(red[0], red[1], red[2], red[3]);
-   glMaterialf( GL_FRONT_AND_BACK, GL_SHININESS, 128.0);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, white);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, red);
-   drawCylinder(headTubeBottom, headTubeTop, r);    // Head tube
-   drawCylinder(seatPost, midHeadTube, r);          // Top tube
-   drawCylinder(seatTubeBottom, headTubeBottom, r); // Down tube? No name on the diagram
-   drawCylinder(seatPost, rearAxleRight, r);        // Chain stay right
-   drawCylinder(seatPost, seatTubeBottom, r);       // Seat tube
-   drawCylinder(seatTubeBottom, rearAxleRight, r);  // Seat stay right
-   drawCylinder(seatPost, rearAxleLeft, r);         // Chain stay left
-   drawCylinder(seatTubeBottom, rearAxleLeft, r);   // Seat stay left
-
-   drawCylinder(headTubeBottom, frontAxleRight, r); // Right fork
-   drawCylinder(headTubeBottom, frontAxleLeft, r);  // Left fork
+   cylinderPart(&part, headTubeBottom, headTubeTop, r);    // Head tube
+   addPart(frame, part, FRAME);
+   cylinderPart(&part, seatPost, midHeadTube, r);          // Top tube
+   addPart(frame, part, FRAME);
+   cylinderPart(&part, seatTubeBottom, headTubeBottom, r); // Down tube? No name on the diagram
+   addPart(frame, part, FRAME);
+   cylinderPart(&part, seatPost, rearAxleRight, r);        // Chain stay right
+   addPart(frame, part, FRAME);
+   cylinderPart(&part, seatPost, seatTubeBottom, r);       // Seat tube
+   addPart(frame, part, FRAME);
+   cylinderPart(&part, seatTubeBottom, rearAxleRight, r);  // Seat stay right
+   addPart(frame, part, FRAME);
+   cylinderPart(&part, seatPost, rearAxleLeft, r);         // Chain stay left
+   addPart(frame, part, FRAME);
+   cylinderPart(&part, seatTubeBottom, rearAxleLeft, r);   // Seat stay left
+   addPart(frame, part, FRAME);
+
+   cylinderPart(&part, headTubeBottom, frontAxleRight, r); // Right fork
+   addPart(steerNode, part, FRAME);
+   cylinderPart(&part, headTubeBottom, frontAxleLeft, r);  // Left fork
+   addPart(steerNode, part, FRAME);
 
    // Darker grey - not as shiny
-   glColor4f(darkGrey[0], darkGrey[1], darkGrey[2], darkGrey[3]);
-   glMaterialf( GL_FRONT_AND_BACK, GL_SHININESS, 1.0);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, darkGrey);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, darkGrey);
-   drawCylinder(handlebarLeft, handlebarRight, r); // Handlebars
-
+   cylinderPart(&part, handlebarLeft, handlebarRight, r); // Handlebars
+   addPart(steerNode, part, HANDLEBAR);
 
-   // Draw seat
+   // Seat
    EllipseStruct seat = {seatTubeTop, midHeadTube, 0.1, 0.05};
-   glMaterialf( GL_FRONT_AND_BACK, GL_SHININESS, 4.0);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, lightGrey);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, lightGrey);
-   drawEllipse(seat);
-
-   // Draw wheels - black rubber
-   glColor4f(black[0], black[1], black[2], black[3]);
-   glMaterialf( GL_FRONT_AND_BACK, GL_SHININESS, 0.0);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, darkGrey);
-   glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, black);
+   ellipsePart(&part, seat);
+   addPart(frame, part, SEAT);
+
+   // Wheels - black rubber
    Torus frontWheel = {(Point){frontAxle.x, frontAxle.y, frontAxle.z}, (Point){1.0, 0.0, 0.0}, wheelRadius, 0.0254};
-   drawTorus(frontWheel);
+   torusPart(&part, frontWheel);
+   addPart(frontSpinNode, part, RUBBER);
    Torus rearWheel = {(Point){rearAxle.x, rearAxle.y, rearAxle.z}, (Point){1.0, 0.0, 0.0}, wheelRadius, 0.0254};
-   drawTorus(rearWheel);
+   torusPart(&part, rearWheel);
+   addPart(rearSpinNode, part, RUBBER);
+
+   // Handlebar grips - black rubber
+   cylinderPart(&part, gripLeft, handleBarEndLeft, 1.1*r);
+   addPart(steerNode, part, RUBBER);
+   cylinderPart(&part, gripRight, handleBarEndRight, 1.1*r);
+   addPart(steerNode, part, RUBBER);
+}
 
-   // Draw handlebar grips - black rubber
-   drawCylinder(gripLeft, handleBarEndLeft, 1.1*r);
-   drawCylinder(gripRight, handleBarEndRight, 1.1*r);
+// Rotation of th degrees about an axis through a pivot point
+void pivot(float mat[16], Point p, Point axis, double th)
+{
+   MatIdentity(mat);
+   MatTranslate(mat, p.x, p.y, p.z);
+   MatRotate(mat, th, axis.x, axis.y, axis.z);
+   MatTranslate(mat, -p.x, -p.y, -p.z);
+}
 
-   glPopMatrix();
+// Bring the bicycle scene graph up to date
+// Only the steering and wheels are recomputed, and only when they moved
+void updateBike()
+{
+   static double lastSteer = 0.0;
+   static double lastSpin = 0.0;
+   float mat[16];
+
+   if (!bike.n)
+      buildBike();
+   if (steer != lastSteer)
+   {
+      pivot(mat, steerPivot, steerAxis, lastSteer = steer);
+      SetNodeMatrix(&bike, steerNode, mat);
+   }
+   if (spin != lastSpin)
+   {
+      pivot(mat, frontHub, (Point){1.0, 0.0, 0.0}, spin);
+      SetNodeMatrix(&bike, frontSpinNode, mat);
+      pivot(mat, rearHub, (Point){1.0, 0.0, 0.0}, lastSpin = spin);
+      SetNodeMatrix(&bike, rearSpinNode, mat);
+   }
+   UpdateScene(&bike);
+}
+
+// Bounding sphere of a bicycle placed by mat
+// Returns the radius
+double bikeBounds(const float mat[16], float center[3])
+{
+   Point c = bikeCenter;
+   double s = 0.0;
+   for (int i = 0; i < 3; i++)
+   {
+      center[i] = mat[i] * c.x + mat[4 + i] * c.y + mat[8 + i] * c.z + mat[12 + i];
+      s = fmax(s, sqrt(mat[4 * i] * mat[4 * i] + mat[4 * i + 1] * mat[4 * i + 1] + mat[4 * i + 2] * mat[4 * i + 2]));
+   }
+   return s * bikeRadius;
+}
+
+// Queue a bicycle to be drawn by the next FlushQueue
+void drawBicycle(Point origin, Point direction, Point scale)
+{
+   // Only recompute the placement when the bicycle moves
+   static Transform last = {{0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+   static float mat[16];
+   if (memcmp(&origin, &last.origin, sizeof(Point)) || memcmp(&direction, &last.direction, sizeof(Point)) || memcmp(&scale, &last.scale, sizeof(Point)))
+   {
+      last = (Transform){origin, direction, scale};
+      placement(mat, origin, direction, scale);
+   }
+
+   updateBike();
+
+   // Skip bicycles outside the view
+   float center[3];
+   double radius = bikeBounds(mat, center);
+   if (cull && !SphereVisible(frustum, center, radius))
+      return;
+
+   // Queue the parts to be drawn sorted by material
+   for (int k = 0; k < bike.n; k++)
+   {
+      SceneNode *node = &bike.node[k];
+      if (!node->mesh)
+         continue;
+      float world[16];
+      MatMultiply(world, mat, node->world);
+      QueueMesh(&queue, partLOD(node->mesh, world), world, node->material, 0);
+   }
+}
+
+// Instance of a bicycle in the fleet sorted by distance
+typedef struct Instance
+{
+   float depth;   // Distance in front of the eye
+   float mat[16]; // Placement
+} Instance;
+
+// Sort instances from near to far
+int compareDepth(const void *a, const void *b)
+{
+   float x = ((const Instance *)a)->depth;
+   float y = ((const Instance *)b)->depth;
+   return (x > y) - (x < y);
+}
+
+// Primitive for a bicycle part on one instance
+Mesh *instanceLOD(const Instance *inst, const SceneNode *node)
+{
+   float world[16];
+   MatMultiply(world, inst->mat, node->world);
+   return partLOD(node->mesh, world);
+}
+
+// Shader program for bicycle parts
+typedef struct PartShader
+{
+   int prog;     // Program
+   int instance; // Location of the instance matrix attribute
+   int part;     // Location of the part matrix uniform
+   int lighting; // Location of the lighting switch uniform
+} PartShader;
+
+// Shader for the current lighting
+// Fixed function light 0 per vertex, or every light per pixel
+PartShader *partShader()
+{
+   static PartShader shaders[2];
+   int lit = light && shaderLight;
+   PartShader *s = &shaders[lit];
+   // Compile the shader the first time through
+   if (!s->prog)
+   {
+      s->prog = lit ? CreateShaderProg("lighting.vert", "lighting.frag") : CreateShaderProg("instance.vert", "instance.frag");
+      s->instance = glGetAttribLocation(s->prog, "Instance");
+      s->part = glGetUniformLocation(s->prog, "Part");
+      s->lighting = glGetUniformLocation(s->prog, "Lighting");
+   }
+   return s;
+}
+
+// Place n street lights in a square grid centered on the origin
+void buildStreetLights(int n)
+{
+   streetLights = n;
+   lights = (Light *)realloc(lights, (n + 1) * sizeof(Light));
+   if (!lights)
+      Fatal("Cannot allocate %d lights\n", n + 1);
+   int side = ceil(sqrt(n));
+   for (int i = 0; i < n; i++)
+   {
+      Light *l = &lights[i + 1];
+      l->position[0] = 3.0 * (i % side - 0.5 * (side - 1));
+      l->position[1] = 1.5;
+      l->position[2] = 3.0 * (i / side - 0.5 * (side - 1));
+      l->position[3] = 1.0;
+      // Alternate warm and cool lamps
+      l->color[0] = i % 2 ? 0.6 : 1.0;
+      l->color[1] = 0.8;
+      l->color[2] = i % 2 ? 1.0 : 0.5;
+      l->radius = 4.0;
+   }
+}
+
+// Start per pixel lighting for parts drawn one at a time
+void useLighting()
+{
+   PartShader *s = partShader();
+   const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+   glUseProgram(s->prog);
+   UseLights(s->prog);
+   glUniform3f(glGetUniformLocation(s->prog, "Intensity"), 0.01 * ambient, 0.01 * diffuse, 0.01 * specular);
+   glUniformMatrix4fv(s->part, 1, GL_FALSE, identity);
+   UseShadow(s->prog, view, shadows);
+   // The instance matrix is the identity when not drawing instances
+   for (int i = 0; i < 4; i++)
+      glVertexAttrib4fv(s->instance + i, identity + 4 * i);
+}
+
+// Point the instance attributes at the matrix of instance first
+void instanceAttributes(int loc, int first)
+{
+   for (int i = 0; i < 4; i++)
+      glVertexAttribPointer(loc + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void *)(first * sizeof(Instance) + offsetof(Instance, mat) + 4 * i * sizeof(float)));
+}
+
+// Draw many bicycles at once
+// Each part is drawn for every bicycle with a single instanced draw call
+void drawBicycles(const Transform *bikes, int count)
+{
+   // Instancing needs buffer objects, otherwise draw one bicycle at a time
+   if (meshMode != MESH_VBO)
+   {
+      for (int i = 0; i < count; i++)
+         drawBicycle(bikes[i].origin, bikes[i].direction, bikes[i].scale);
+      return;
+   }
+
+   PartShader *shader = partShader();
+   int instanceLoc = shader->instance;
+   int partLoc = shader->part;
+
+   // Copy the bicycle matrices to the instance buffer from near to far
+   static unsigned int buffer = 0;
+   static int size = 0;
+   static Instance *inst = NULL;
+   static float *eye = NULL; // Bicycle origins in x, y and z arrays moved to eye coordinates
+   if (!buffer)
+      glGenBuffers(1, &buffer);
+   if (count > size)
+   {
+      size = count;
+      inst = (Instance *)realloc(inst, size * sizeof(Instance));
+      eye = (float *)realloc(eye, 3 * size * sizeof(float));
+      if (!inst || !eye)
+         Fatal("Cannot allocate %d instance matrices\n", size);
+   }
+   for (int i = 0; i < count; i++)
+   {
+      Point p = bikes[i].origin;
+      placement(inst[i].mat, p, bikes[i].direction, bikes[i].scale);
+      eye[i] = p.x;
+      eye[size + i] = p.y;
+      eye[2 * size + i] = p.z;
+   }
+   // Depth of every bicycle with one batch transform
+   TransformSoA(view, count, eye, eye + size, eye + 2 * size, eye, eye + size, eye + 2 * size);
+   for (int i = 0; i < count; i++)
+      inst[i].depth = -eye[2 * size + i];
+   if (lod)
+      qsort(inst, count, sizeof(Instance), compareDepth);
+   glBindBuffer(GL_ARRAY_BUFFER, buffer);
+   glBufferData(GL_ARRAY_BUFFER, count * sizeof(Instance), inst, GL_STREAM_DRAW);
+
+   // One matrix per instance takes four attribute slots
+   glUseProgram(shader->prog);
+   glUniform1i(shader->lighting, glIsEnabled(GL_LIGHTING));
+   for (int i = 0; i < 4; i++)
+   {
+      glEnableVertexAttribArray(instanceLoc + i);
+      glVertexAttribDivisor(instanceLoc + i, 1);
+   }
+
+   // Draw each part of every bicycle
+   updateBike();
+   ResetState();
+   int material = -1;
+   for (int k = 0; k < bike.n; k++)
+   {
+      SceneNode *node = &bike.node[k];
+      if (!node->mesh)
+         continue;
+      if (node->material != material)
+         setBikeMaterial(material = node->material);
+      glUniformMatrix4fv(partLoc, 1, GL_FALSE, node->world);
+      // Sorted bicycles mostly share a level of detail with their neighbors, so draw runs of instances
+      // Parts behind the eye get the fewest segments, so the levels are not strictly decreasing
+      for (int first = 0; first < count;)
+      {
+         Mesh *mesh = instanceLOD(&inst[first], node);
+         int last = first;
+         while (last + 1 < count && instanceLOD(&inst[last + 1], node) == mesh)
+            last++;
+         glBindBuffer(GL_ARRAY_BUFFER, buffer);
+         instanceAttributes(instanceLoc, first);
+         DrawMeshInstanced(mesh, last - first + 1);
+         first = last + 1;
+      }
+   }
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+   // Restore state
+   for (int i = 0; i < 4; i++)
+   {
+      glVertexAttribDivisor(instanceLoc + i, 0);
+      glDisableVertexAttribArray(instanceLoc + i);
+   }
+   if (light && shaderLight)
+      useLighting();
+   else
+      glUseProgram(0);
+}
+
+// Line up a fleet of bicycles in a square grid centered on the origin
+void buildFleet(int n)
+{
+   fleet = n;
+   fleetBikes = (Transform *)realloc(fleetBikes, (n > 0 ? n : 1) * sizeof(Transform));
+   if (!fleetBikes)
+      Fatal("Cannot allocate fleet of %d bicycles\n", n);
+   int side = ceil(sqrt(n));
+   for (int i = 0; i < n; i++)
+   {
+      fleetBikes[i].origin = (Point){1.5 * (i % side - 0.5 * (side - 1)), 0.0, 2.5 * (i / side - 0.5 * (side - 1))};
+      fleetBikes[i].direction = (Point){0.0, 0.0, 1.0};
+      fleetBikes[i].scale = (Point){1.0, 1.0, 1.0};
+   }
+
+   // Box around the bounding sphere of each bicycle in the hierarchy
+   fleetVisible = (int *)realloc(fleetVisible, (n > 0 ? n : 1) * sizeof(int));
+   fleetDrawn = (Transform *)realloc(fleetDrawn, (n > 0 ? n : 1) * sizeof(Transform));
+   float *box = (float *)malloc((n > 0 ? n : 1) * 6 * sizeof(float));
+   if (!fleetVisible || !fleetDrawn || !box)
+      Fatal("Cannot allocate fleet of %d bicycles\n", n);
+   updateBike();
+   for (int i = 0; i < n; i++)
+   {
+      float mat[16], center[3];
+      placement(mat, fleetBikes[i].origin, fleetBikes[i].direction, fleetBikes[i].scale);
+      double radius = bikeBounds(mat, center);
+      for (int j = 0; j < 3; j++)
+      {
+         box[6 * i + j] = center[j] - radius;
+         box[6 * i + j + 3] = center[j] + radius;
+      }
+   }
+   BuildBVH(&fleetTree, box, n);
+   free(box);
+}
+
+// Draw the bicycles of the fleet in the view volume
+// The hierarchy skips groups of bicycles outside the view without looking at each one
+void drawFleet()
+{
+   if (!cull)
+   {
+      drawBicycles(fleetBikes, fleet);
+      return;
+   }
+   int n = CullBVH(&fleetTree, frustum, fleetVisible);
+   for (int i = 0; i < n; i++)
+      fleetDrawn[i] = fleetBikes[fleetVisible[i]];
+   drawBicycles(fleetDrawn, n);
+}
+
+// Draw the shadow map of the moving light
+// The map is kept while neither the light nor the bicycles move
+void drawShadow(const float position[3])
+{
+   // Everything that moves the shadows
+   typedef struct ShadowKey
+   {
+      float light[3];
+      double steer, spin;
+      int fleet, size, pcf, lod, cull;
+   } ShadowKey;
+   static ShadowKey last;
+   ShadowKey key;
+   memset(&key, 0, sizeof(key));
+   memcpy(key.light, position, sizeof(key.light));
+   key.steer = steer;
+   key.spin = spin;
+   key.fleet = fleet;
+   key.size = shadowSize;
+   key.pcf = shadowPCF;
+   key.lod = lod;
+   key.cull = cull;
+   if (!memcmp(&key, &last, sizeof(key)))
+      return;
+   last = key;
+
+   // Look from the light at the bicycle at the origin and the ground around it
+   float eyeView[16], eyeFrustum[6][4], center[3], identity[16];
+   memcpy(eyeView, view, sizeof(view));
+   memcpy(eyeFrustum, frustum, sizeof(frustum));
+   MatIdentity(identity);
+   updateBike();
+   double radius = 1.5 * bikeBounds(identity, center);
+   ShadowMap(shadowSize, shadowPCF);
+   BeginShadow(position, center, radius, view);
+   // Cull and pick levels of detail from the light
+   Frustum(view, frustum);
+
+   // Depth only, so draw unlit
+   int lit = light;
+   light = 0;
+   glDisable(GL_LIGHTING);
+   if (fleet)
+      drawFleet();
+   else
+      drawBicycle((Point){0.0, 0.0, 0.0}, (Point){0.0, 0.0, 1.0}, (Point){1.0, 1.0, 1.0});
+   FlushQueue(&queue, setBikeMaterial);
+   light = lit;
+
+   // Back to the camera
+   EndShadow();
+   memcpy(view, eyeView, sizeof(view));
+   memcpy(frustum, eyeFrustum, sizeof(frustum));
+   Project(m ? fov : 0, asp, dim);
+   glLoadMatrixf(view);
+}
+
+// Ground under the bicycles to catch shadows
+void drawGround()
+{
+   const float grey[] = {0.5, 0.5, 0.5, 1.0};
+   const float black[] = {0.0, 0.0, 0.0, 1.0};
+   SetColor(grey);
+   SetMaterialfv(GL_SPECULAR, black);
+   SetMaterialf(GL_SHININESS, 0.0);
+   int side = ceil(sqrt(fleet));
+   double x = fleet ? 0.75 * side + 1.0 : 3.0;
+   double z = fleet ? 1.25 * side + 1.0 : 3.0;
+   glNormal3d(0.0, 1.0, 0.0);
+   glBegin(GL_QUADS);
+   glVertex3d(-x, groundHeight, -z);
+   glVertex3d(-x, groundHeight, +z);
+   glVertex3d(+x, groundHeight, +z);
+   glVertex3d(+x, groundHeight, -z);
+   glEnd();
+   Stats.draws++;
+   Stats.vertexes += 4;
 }
 
 void display()
@@ -506,6 +989,9 @@ void display()
    default:
       Fatal("Invalid mode %d\n", m);
    }
+   // Remember the view for picking levels of detail and culling
+   glGetFloatv(GL_MODELVIEW_MATRIX, view);
+   Frustum(view, frustum);
 
    //  Flat or smooth shading
    glShadeModel(smooth ? GL_SMOOTH : GL_FLAT);
@@ -519,10 +1005,14 @@ void display()
       float Specular[] = {0.01 * specular, 0.01 * specular, 0.01 * specular, 1.0};
       //  Light position
       float Position[] = {distance * Cos(zh), ylight, distance * Sin(zh), 1.0};
+      //  Shadows of the moving light
+      if (shaderLight && shadows)
+         drawShadow(Position);
       //  Draw light position as sphere (still no lighting here)
       glColor3f(1, 1, 1);
       EllipseStruct lightSphere = {(Point){Position[0], Position[1], Position[2]}, (Point){0.0, 1.0, 0.0}, 0.1, 0.1};
-      drawEllipse(lightSphere);
+      if (!cull || SphereVisible(frustum, Position, 0.1))
+         drawEllipse(lightSphere);
       //  OpenGL should normalize normal vectors
       glEnable(GL_NORMALIZE);
       //  Enable lighting
@@ -539,6 +1029,16 @@ void display()
       glLightfv(GL_LIGHT0, GL_DIFFUSE, Diffuse);
       glLightfv(GL_LIGHT0, GL_SPECULAR, Specular);
       glLightfv(GL_LIGHT0, GL_POSITION, Position);
+      //  Per pixel lighting with the moving light and the street lights
+      if (shaderLight)
+      {
+         if (!lights)
+            buildStreetLights(streetLights);
+         lights[0] = (Light){{Position[0], Position[1], Position[2], 1.0}, {1.0, 1.0, 1.0}, 0.0};
+         LightClusters(clusters);
+         SetLights(lights, streetLights + 1, view);
+         useLighting();
+      }
    }
    else
       glDisable(GL_LIGHTING);
@@ -546,11 +1046,35 @@ void display()
    // Set color to red for bike
    glColor3f(1.0, 0.0, 0.0);
 
-   drawBicycle((Point){0.0, 0.0, 0.0}, (Point){0.0, 0.0, 1.0}, (Point){1.0, 1.0, 1.0});
+   if (fleet)
+      drawFleet();
+   else
+      drawBicycle((Point){0.0, 0.0, 0.0}, (Point){0.0, 0.0, 1.0}, (Point){1.0, 1.0, 1.0});
+   // Draw everything queued so each material is only set once
+   FlushQueue(&queue, setBikeMaterial);
+   if (model >= 0)
+      drawModel();
+   if (light && shaderLight && (shadows || ground))
+      drawGround();
+   glUseProgram(0);
 
    glDisable(GL_LIGHTING); // No lighting for axes and text
+   //  Street lights as points
+   if (light && shaderLight && streetLights)
+   {
+      glPointSize(4);
+      glBegin(GL_POINTS);
+      for (int i = 1; i <= streetLights; i++)
+      {
+         glColor3fv(lights[i].color);
+         glVertex4fv(lights[i].position);
+      }
+      glEnd();
+   }
    glColor3f(1, 1, 1);     // white
-   if (axes)
+   const float axesMin[] = {0.0, 0.0, 0.0};
+   const float axesMax[] = {1.0, 1.0, 1.0};
+   if (axes && (!cull || BoxVisible(frustum, axesMin, axesMax)))
    {
       //  Draw axes in white
       glBegin(GL_LINES);
@@ -573,12 +1097,21 @@ void display()
    //  Display parameters
 
    glWindowPos2i(5, 5);
-   Print("Angle=%d,%d  Dim=%.1f FOV=%d Projection=%s Light=%s",
-         th, ph, dim, fov, m == 1 ? "Perspective" : "Orthogonal", light ? "On" : "Off");
+   Print("Angle=%d,%d  Dim=%.1f FOV=%d Projection=%s Light=%s Mesh=%s Fleet=%d LOD=%s Cull=%s",
+         th, ph, dim, fov, m == 1 ? "Perspective" : "Orthogonal", light ? (shaderLight ? "Shader" : "Fixed") : "Off",
+         meshMode == MESH_VBO ? "VBO" : meshMode == MESH_ARRAY ? "Array" : "Immediate", fleet, lod ? "On" : "Off", cull ? "On" : "Off");
    if (light)
    {
       glWindowPos2i(5, 45);
-      Print("Model=%s LocalViewer=%s Distance=%d Elevation=%.1f", smooth ? "Smooth" : "Flat", local ? "On" : "Off", distance, ylight);
+      Print("Model=%s LocalViewer=%s Distance=%d Elevation=%.1f StreetLights=%d Clusters=%s", smooth ? "Smooth" : "Flat", local ? "On" : "Off", distance, ylight,
+            shaderLight ? streetLights : 0, clusters ? "On" : "Off");
+      if (shaderLight && shadows)
+         Print(" Shadow=%dx%d PCF=%d", shadowSize, shadowSize, shadowPCF);
+      if (model >= 0)
+      {
+         int status = AssetStatus(model);
+         Print(" Model=%s", status == ASSET_READY ? "Ready" : status == ASSET_ERROR ? "Error" : "Loading");
+      }
       glWindowPos2i(5, 25);
       Print("Ambient=%d  Diffuse=%d Specular=%d Emission=%d", ambient, diffuse, specular, emission);
    }
@@ -630,6 +1163,51 @@ void key(unsigned char ch, int x, int y)
    {
       m = 1 - m;
    }
+   else if( ch == 'r' || ch == 'R')
+   {
+      ride = 1 - ride;
+   }
+   else if( ch == '[' && steer < 45)
+   {
+      steer += 5;
+   }
+   else if( ch == ']' && steer > -45)
+   {
+      steer -= 5;
+   }
+   else if( ch == 'o' || ch == 'O')
+   {
+      lod = 1 - lod;
+   }
+   else if( ch == 'c' || ch == 'C')
+   {
+      cull = 1 - cull;
+   }
+   else if( ch == 'g' || ch == 'G')
+   {
+      shaderLight = 1 - shaderLight;
+   }
+   else if( ch == 'h' || ch == 'H')
+   {
+      // Shadows need the lighting shader
+      shadows = 1 - shadows;
+      if (shadows)
+         shaderLight = 1;
+   }
+   else if( ch == 'j' || ch == 'J')
+   {
+      clusters = 1 - clusters;
+   }
+   else if( ch == 'k' || ch == 'K')
+   {
+      // Cycle through 0, 16, 256 and 1024 street lights
+      buildStreetLights(streetLights ? (streetLights < 1024 ? (streetLights < 256 ? 256 : 1024) : 0) : 16);
+   }
+   else if( ch == 'f' || ch == 'F')
+   {
+      // Cycle through fleets of 0, 100, 1000 and 10000 bicycles
+      buildFleet(fleet ? (fleet < 10000 ? 10 * fleet : 0) : 100);
+   }
    else if( !moveLight && (ch == 'W' || ch == 'w'))
    {
       ylight += 0.1;
@@ -709,13 +1287,65 @@ void idle()
 
    glutPostRedisplay();
    }
+
+   if( ride )
+   {
+   // Roll the wheels forward
+   spin = fmod(spin + 5, 360.0);
+
+   glutPostRedisplay();
+   }
+
+   // Copy some of the model to OpenGL each frame while it loads
+   static int loaded = 0;
+   if (model >= 0 && !loaded)
+   {
+      if (!UploadAssets(uploadMB << 20))
+      {
+         if (AssetStatus(model) == ASSET_ERROR)
+            fprintf(stderr, "%s", AssetError(model));
+         loaded = 1;
+      }
+      glutPostRedisplay();
+   }
 }
 
+#ifndef BENCH
 // Main
 int main(int argc, char *argv[])
 {
    //  Initialize GLUT
    glutInit(&argc, argv);
+   //  Select how geometry is sent to OpenGL
+   for (int i = 1; i < argc; i++)
+   {
+      if (!strcmp(argv[i], "-immediate"))
+         meshMode = MESH_IMMEDIATE;
+      else if (!strcmp(argv[i], "-array"))
+         meshMode = MESH_ARRAY;
+      else if (!strcmp(argv[i], "-vbo"))
+         meshMode = MESH_VBO;
+      else if (!strcmp(argv[i], "-float"))
+         meshFormat = MESH_FLOAT;
+      else if (!strcmp(argv[i], "-packed"))
+         meshFormat = MESH_PACKED;
+      else if (!strcmp(argv[i], "-shadow") && i + 1 < argc)
+         shadowSize = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-pcf") && i + 1 < argc)
+         shadowPCF = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-obj") && i + 1 < argc)
+         modelFile = argv[++i];
+      else if (!strcmp(argv[i], "-upload") && i + 1 < argc)
+         uploadMB = atoi(argv[++i]);
+      else
+         Fatal("Usage: %s [-immediate|-array|-vbo] [-float|-packed] [-shadow size] [-pcf width] [-obj file] [-upload MB]\n", argv[0]);
+   }
+   if (shadowSize < 1 || shadowPCF < 1)
+      Fatal("Invalid shadow map size or filter width\n");
+   if (uploadMB < 1)
+      Fatal("Invalid upload budget\n");
+   MeshMode(meshMode);
+   MeshFormat(meshFormat);
    //  Request double buffered true color window without Z-buffer
    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
    //  Create window
@@ -731,9 +1361,13 @@ int main(int argc, char *argv[])
    glutKeyboardFunc(key);
    glutSpecialFunc(special);
    glutIdleFunc(idle);
+   //  Start reading the model while the bicycle is drawn
+   if (modelFile)
+      model = LoadMeshAsync(modelFile);
    //  Enable Z-buffer depth test
    glEnable(GL_DEPTH_TEST);
    //  Pass control to GLUT for events
    glutMainLoop();
    return 0;
-}
\ No newline at end of file
+}
+#endif
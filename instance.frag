@@ -0,0 +1,7 @@
+//  Instanced bicycle parts
+#version 120
+
+void main()
+{
+   gl_FragColor = gl_Color;
+}
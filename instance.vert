@@ -0,0 +1,42 @@
+//  Instanced bicycle parts
+//  Fixed function lighting of light 0 per vertex
+#version 120
+
+attribute mat4 Instance;  //  Bicycle placement (one per instance)
+uniform   mat4 Part;      //  Part placement relative to the bicycle
+uniform   bool Lighting;  //  Lighting enabled
+
+void main()
+{
+   //  Model matrix of this part on this bicycle
+   mat4 model = Instance*Part;
+   //  Normals need the inverse transpose, which is the cofactor matrix up to scale
+   mat3 M = mat3(model);
+   mat3 C = mat3(cross(M[1],M[2]),cross(M[2],M[0]),cross(M[0],M[1]));
+   //  Vertex position and normal in eye coordinates
+   vec4 P = gl_ModelViewMatrix*model*gl_Vertex;
+   vec3 N = normalize(gl_NormalMatrix*C*gl_Normal);
+   gl_Position = gl_ProjectionMatrix*P;
+
+   //  Unlit color
+   if (!Lighting)
+   {
+      gl_FrontColor = gl_Color;
+      return;
+   }
+   //  Light direction (positional light) and half vector (infinite viewer)
+   vec3 L = normalize(gl_LightSource[0].position.xyz - P.xyz*gl_LightSource[0].position.w);
+   vec3 H = normalize(L + vec3(0,0,1));
+   //  glColor sets ambient and diffuse
+   vec4 color = gl_FrontMaterial.emission
+              + gl_LightModel.ambient*gl_Color
+              + gl_LightSource[0].ambient*gl_Color;
+   float Id = dot(N,L);
+   if (Id>0.0)
+   {
+      color += Id*gl_LightSource[0].diffuse*gl_Color;
+      float Is = gl_FrontMaterial.shininess>0.0 ? pow(max(dot(N,H),0.0),gl_FrontMaterial.shininess) : 1.0;
+      color += Is*gl_LightSource[0].specular*gl_FrontMaterial.specular;
+   }
+   gl_FrontColor = vec4(color.rgb,gl_Color.a);
+}
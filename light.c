@@ -0,0 +1,339 @@
+//  CSCIx229 library
+//  Lights for per pixel lighting shaders
+#include "CSCIx229.h"
+#ifndef _WIN32
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+//
+//  Lights are kept in a texture buffer in eye coordinates as two RGBA
+//  float texels each: the position (w=0 for a directional light), then
+//  the color and the radius where the light fades out.  Shaders read them
+//  with texelFetch, so hundreds of lights take no uniform space.
+//
+//  The view volume set by Project is split into clusters, CX by CY tiles
+//  on screen and CZ slices in depth (spaced by the logarithm of the depth
+//  for perspective), and each light is listed in the clusters its sphere
+//  touches.  A fragment then only shades the lights of its own cluster.
+//  Lights that never fade are in every cluster.  The slices are binned
+//  in parallel.
+//
+
+//  Texture units of the light, cluster and list buffers (unit 0 is left for BindTexture)
+#define UNIT 1
+//  Clusters across, up and in depth
+#define CX 16
+#define CY 9
+#define CZ 24
+//  Fewest lights per binning thread
+#define PERTHREAD 64
+
+static unsigned int buffer[3],texture[3];
+static int count=0,size=0;
+static Light* eye=NULL;
+//  Bin lights into clusters or shade every light everywhere
+static int clusters=1;
+//  Threads used to bin lights (0 for one per processor)
+static int lightthreads=0;
+//  Offset and count in the list of each cluster
+static int table[2*CX*CY*CZ];
+//  Lights of every cluster one after another
+static int* list=NULL;
+static int nlist=0;
+//  Projection and viewport the clusters were built for
+static double fov,asp,dim;
+static int viewport[4];
+
+//  Slices of clusters binned by one thread
+typedef struct
+{
+   int first,last;  //  Slices first to last-1
+   int* list;       //  Lights of these clusters
+   int n,size;      //  Used and allocated entries of list
+   int* tile;       //  Tile range of each light in the current slice
+} bin_t;
+static bin_t bin[CZ];
+
+//
+//  Bin lights into clusters or not
+//
+void LightClusters(int on)
+{
+   clusters = on;
+}
+
+//
+//  Set number of threads used to bin lights
+//    0 uses one thread per processor
+//
+void LightThreads(int n)
+{
+   lightthreads = n;
+}
+
+//
+//  Depth range of slice k
+//
+static void SliceDepth(int k,double* a,double* b)
+{
+   if (fov)
+   {
+      double near=dim/16,far=16*dim;
+      *a = near*pow(far/near,(double)k/CZ);
+      *b = near*pow(far/near,(double)(k+1)/CZ);
+   }
+   else
+   {
+      *a = dim*(2.0*k/CZ-1);
+      *b = dim*(2.0*(k+1)/CZ-1);
+   }
+}
+
+//
+//  Tiles from t0 to t1-1 covering the range lo to hi of n tiles over -1 to 1
+//
+static void TileRange(double lo,double hi,int n,int* t0,int* t1)
+{
+   *t0 = floor((lo+1)/2*n);
+   *t1 = floor((hi+1)/2*n)+1;
+   if (*t0<0) *t0 = 0;
+   if (*t1>n) *t1 = n;
+}
+
+//
+//  Tiles touched by light k in slice depth a to b
+//    Returns 0 if the light misses the slice
+//
+static int LightTiles(int k,double a,double b,int* tile)
+{
+   const Light* l = eye+k;
+   //  Everywhere
+   if (l->radius<=0 || l->position[3]==0)
+   {
+      tile[0] = tile[2] = 0;
+      tile[1] = CX;
+      tile[3] = CY;
+      return 1;
+   }
+   double x = l->position[0]/l->position[3];
+   double y = l->position[1]/l->position[3];
+   double d = -l->position[2]/l->position[3];
+   double r = l->radius;
+   //  Part of the sphere in the slice
+   if (d+r<a || d-r>b) return 0;
+   if (a<d-r) a = d-r;
+   if (b>d+r) b = d+r;
+   //  Widest cross section of the sphere in the slice
+   double e = (d<a) ? a-d : (d>b) ? d-b : 0;
+   double s = sqrt(r*r-e*e);
+   double x0,x1,y0,y1;
+   if (fov)
+   {
+      //  Box around the sphere in tangent of the angle from the view axis
+      if (a<1e-6) a = 1e-6;
+      double ty = tan(fov*3.14159265/360);
+      double tx = asp*ty;
+      x0 = fmin((x-s)/a,(x-s)/b)/tx;
+      x1 = fmax((x+s)/a,(x+s)/b)/tx;
+      y0 = fmin((y-s)/a,(y-s)/b)/ty;
+      y1 = fmax((y+s)/a,(y+s)/b)/ty;
+   }
+   else
+   {
+      x0 = (x-s)/(asp*dim);
+      x1 = (x+s)/(asp*dim);
+      y0 = (y-s)/dim;
+      y1 = (y+s)/dim;
+   }
+   TileRange(x0,x1,CX,tile,tile+1);
+   TileRange(y0,y1,CY,tile+2,tile+3);
+   return tile[0]<tile[1] && tile[2]<tile[3];
+}
+
+//
+//  Bin lights into the clusters of a range of slices
+//    Offsets in the table are relative to the list of the range
+//
+static void* BinSlices(void* arg)
+{
+   bin_t* B = (bin_t*)arg;
+   B->n = 0;
+   for (int z=B->first;z<B->last;z++)
+   {
+      double a,b;
+      SliceDepth(z,&a,&b);
+      int* T = table+2*CX*CY*z;
+      memset(T,0,2*CX*CY*sizeof(int));
+      //  Count the lights of each cluster
+      for (int k=0;k<count;k++)
+      {
+         int* tile = B->tile+4*k;
+         if (!LightTiles(k,a,b,tile))
+            memset(tile,0,4*sizeof(int));
+         for (int j=tile[2];j<tile[3];j++)
+            for (int i=tile[0];i<tile[1];i++)
+               T[2*(j*CX+i)+1]++;
+      }
+      //  Place the lists one after another
+      int n = B->n;
+      for (int c=0;c<CX*CY;c++)
+      {
+         T[2*c] = n;
+         n += T[2*c+1];
+         T[2*c+1] = 0;
+      }
+      if (n>B->size)
+      {
+         B->size = 2*n;
+         B->list = (int*)realloc(B->list,B->size*sizeof(int));
+         if (!B->list) Fatal("Cannot allocate cluster lists of %d lights\n",B->size);
+      }
+      B->n = n;
+      //  Fill the lists
+      for (int k=0;k<count;k++)
+      {
+         const int* tile = B->tile+4*k;
+         for (int j=tile[2];j<tile[3];j++)
+            for (int i=tile[0];i<tile[1];i++)
+            {
+               int* t = T+2*(j*CX+i);
+               B->list[t[0]+t[1]++] = k;
+            }
+      }
+   }
+   return NULL;
+}
+
+//
+//  Bin lights into clusters of the view volume set by Project
+//
+static void Cluster(void)
+{
+   GetProjection(&fov,&asp,&dim);
+   glGetIntegerv(GL_VIEWPORT,viewport);
+
+   //  Split the slices between threads
+   int n = lightthreads;
+#ifdef _WIN32
+   if (n<1) n = 1;
+#else
+   if (n<1) n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   if (n>count/PERTHREAD) n = count/PERTHREAD;
+   if (n>CZ) n = CZ;
+   if (n<1) n = 1;
+   for (int k=0;k<n;k++)
+   {
+      bin[k].first = CZ*k/n;
+      bin[k].last = CZ*(k+1)/n;
+      bin[k].tile = (int*)realloc(bin[k].tile,4*(count+1)*sizeof(int));
+      if (!bin[k].tile) Fatal("Cannot allocate tiles of %d lights\n",count);
+   }
+#ifdef _WIN32
+   for (int k=0;k<n;k++)
+      BinSlices(bin+k);
+#else
+   pthread_t thread[CZ];
+   //  The calling thread takes the first range
+   for (int k=1;k<n;k++)
+      if (pthread_create(thread+k,NULL,BinSlices,bin+k)) Fatal("Cannot create thread\n");
+   BinSlices(bin);
+   for (int k=1;k<n;k++)
+      pthread_join(thread[k],NULL);
+#endif
+
+   //  Join the lists of each range
+   nlist = 0;
+   for (int k=0;k<n;k++)
+      nlist += bin[k].n;
+   list = (int*)realloc(list,(nlist+1)*sizeof(int));
+   if (!list) Fatal("Cannot allocate cluster list of %d lights\n",nlist);
+   int base=0;
+   for (int k=0;k<n;k++)
+   {
+      memcpy(list+base,bin[k].list,bin[k].n*sizeof(int));
+      for (int c=CX*CY*bin[k].first;c<CX*CY*bin[k].last;c++)
+         table[2*c] += base;
+      base += bin[k].n;
+   }
+}
+
+//
+//  Copy n lights to the light buffer
+//    view is the modelview matrix of the camera
+//    Call after Project so the clusters match the projection
+//
+void SetLights(const Light* light,int n,const float view[16])
+{
+   if (n>size)
+   {
+      size = n;
+      eye = (Light*)realloc(eye,size*sizeof(Light));
+      if (!eye) Fatal("Cannot allocate %d lights\n",size);
+   }
+   //  Positions to eye coordinates like glLightfv
+   for (int k=0;k<n;k++)
+   {
+      const float* p = light[k].position;
+      for (int i=0;i<4;i++)
+         eye[k].position[i] = view[i]*p[0]+view[4+i]*p[1]+view[8+i]*p[2]+view[12+i]*p[3];
+      memcpy(eye[k].color,light[k].color,3*sizeof(float));
+      eye[k].radius = light[k].radius;
+   }
+   count = n;
+   if (clusters) Cluster();
+
+   if (!buffer[0])
+   {
+      glGenBuffers(3,buffer);
+      glGenTextures(3,texture);
+      //  Cluster buffers exist before the first clusters
+      for (int k=1;k<3;k++)
+      {
+         glBindBuffer(GL_TEXTURE_BUFFER,buffer[k]);
+         glBufferData(GL_TEXTURE_BUFFER,2*sizeof(int),NULL,GL_STREAM_DRAW);
+      }
+   }
+   glBindBuffer(GL_TEXTURE_BUFFER,buffer[0]);
+   glBufferData(GL_TEXTURE_BUFFER,(n>0 ? n : 1)*sizeof(Light),eye,GL_STREAM_DRAW);
+   if (clusters)
+   {
+      glBindBuffer(GL_TEXTURE_BUFFER,buffer[1]);
+      glBufferData(GL_TEXTURE_BUFFER,sizeof(table),table,GL_STREAM_DRAW);
+      glBindBuffer(GL_TEXTURE_BUFFER,buffer[2]);
+      glBufferData(GL_TEXTURE_BUFFER,(nlist+1)*sizeof(int),list,GL_STREAM_DRAW);
+   }
+   glBindBuffer(GL_TEXTURE_BUFFER,0);
+   ErrCheck("SetLights");
+}
+
+//
+//  Give a shader program the lights
+//    Sets the samplerBuffer Lights and int NumLights, and for clusters the
+//    isamplerBuffer Clusters and ClusterLights, bool Clustered, ivec3
+//    ClusterSize, vec4 Viewport and vec3 ClusterDepth (nearest depth,
+//    slices per unit of depth or log depth, and 1 for perspective)
+//
+void UseLights(int prog)
+{
+   const GLenum format[3] = {GL_RGBA32F,GL_RG32I,GL_R32I};
+   const char* name[3] = {"Lights","Clusters","ClusterLights"};
+   for (int k=0;k<3;k++)
+   {
+      glActiveTexture(GL_TEXTURE0+UNIT+k);
+      glBindTexture(GL_TEXTURE_BUFFER,texture[k]);
+      glTexBuffer(GL_TEXTURE_BUFFER,format[k],buffer[k]);
+      glUniform1i(glGetUniformLocation(prog,name[k]),UNIT+k);
+   }
+   glActiveTexture(GL_TEXTURE0);
+   glUniform1i(glGetUniformLocation(prog,"NumLights"),count);
+   glUniform1i(glGetUniformLocation(prog,"Clustered"),clusters);
+   if (!clusters) return;
+   glUniform3i(glGetUniformLocation(prog,"ClusterSize"),CX,CY,CZ);
+   glUniform4f(glGetUniformLocation(prog,"Viewport"),viewport[0],viewport[1],viewport[2],viewport[3]);
+   if (fov)
+      glUniform3f(glGetUniformLocation(prog,"ClusterDepth"),dim/16,CZ/log(256),1);
+   else
+      glUniform3f(glGetUniformLocation(prog,"ClusterDepth"),-dim,CZ/(2*dim),0);
+}
@@ -0,0 +1,78 @@
+//  Per pixel Blinn-Phong lighting with many lights
+//  Matches fixed function lighting with GL_COLOR_MATERIAL and an infinite viewer
+#version 150 compatibility
+
+uniform samplerBuffer  Lights;         //  Position, then color and fade radius of each light
+uniform int            NumLights;      //  Number of lights
+uniform bool           Clustered;      //  Only shade the lights of the cluster
+uniform isamplerBuffer Clusters;       //  First light in the list and number of lights of each cluster
+uniform isamplerBuffer ClusterLights;  //  Lights of every cluster one after another
+uniform ivec3          ClusterSize;    //  Clusters across, up and in depth
+uniform vec4           Viewport;       //  Viewport the clusters cover
+uniform vec3           ClusterDepth;   //  Nearest depth, slices per unit and perspective
+uniform vec3           Intensity;      //  Ambient, diffuse and specular fractions
+uniform bool            Shadows;       //  Light 0 casts shadows
+uniform sampler2DShadow ShadowMap;     //  Depths seen from light 0
+uniform mat4            ShadowMatrix;  //  Eye coordinates to shadow map coordinates
+uniform int             ShadowPCF;     //  Width of the filter in texels
+in      vec3           Position;       //  Position in eye coordinates
+in      vec3           Normal;         //  Normal in eye coordinates
+
+//  Fraction of light 0 reaching the fragment
+float Lit()
+{
+   vec4 S = ShadowMatrix*vec4(Position,1.0);
+   if (S.w<=0.0) return 1.0;
+   S.xyz /= S.w;
+   //  Average the comparisons around the fragment
+   vec2 texel = 1.0/vec2(textureSize(ShadowMap,0));
+   int h = ShadowPCF/2;
+   float sum = 0.0;
+   for (int i=-h;i<=h;i++)
+      for (int j=-h;j<=h;j++)
+         sum += texture(ShadowMap,vec3(S.xy+vec2(i,j)*texel,S.z));
+   return sum/float((2*h+1)*(2*h+1));
+}
+
+//  Diffuse and specular light from light k
+vec3 Shade(int k,vec3 N)
+{
+   vec4 P = texelFetch(Lights,2*k);
+   vec4 C = texelFetch(Lights,2*k+1);
+   //  Light direction and fading to nothing at the radius
+   vec3 L = P.xyz - Position*P.w;
+   float d = length(L);
+   float fade = C.a>0.0 ? max(1.0-d/C.a,0.0) : 1.0;
+   L /= d;
+   float Id = dot(N,L);
+   if (Id<=0.0 || fade<=0.0) return vec3(0);
+   //  Light 0 may be in shadow
+   float lit = (k==0 && Shadows) ? Lit() : 1.0;
+   vec3 H = normalize(L + vec3(0,0,1));
+   float Is = gl_FrontMaterial.shininess>0.0 ? pow(max(dot(N,H),0.0),gl_FrontMaterial.shininess) : 1.0;
+   return lit*fade*fade*C.rgb*(Intensity.y*Id*gl_Color.rgb + Intensity.z*Is*gl_FrontMaterial.specular.rgb);
+}
+
+void main()
+{
+   vec3 N = normalize(Normal);
+   //  Emission and ambient
+   vec3 color = gl_FrontMaterial.emission.rgb + (gl_LightModel.ambient.rgb+Intensity.x)*gl_Color.rgb;
+   if (Clustered)
+   {
+      //  Tile on screen and slice in depth
+      ivec2 tile = ivec2((gl_FragCoord.xy-Viewport.xy)/Viewport.zw*vec2(ClusterSize.xy));
+      float d = -Position.z;
+      float z = ClusterDepth.z>0.0 ? log(max(d,1e-6)/ClusterDepth.x) : d-ClusterDepth.x;
+      ivec3 c = clamp(ivec3(tile,int(floor(z*ClusterDepth.y))),ivec3(0),ClusterSize-1);
+      ivec2 range = texelFetch(Clusters,(c.z*ClusterSize.y+c.y)*ClusterSize.x+c.x).xy;
+      for (int i=0;i<range.y;i++)
+         color += Shade(texelFetch(ClusterLights,range.x+i).x,N);
+   }
+   else
+   {
+      for (int k=0;k<NumLights;k++)
+         color += Shade(k,N);
+   }
+   gl_FragColor = vec4(color,gl_Color.a);
+}
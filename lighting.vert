@@ -0,0 +1,23 @@
+//  Per pixel lighting of bicycle parts
+//  Instance is the bicycle placement when drawing instances and the identity otherwise
+#version 150 compatibility
+
+in      mat4 Instance;  //  Bicycle placement (one per instance)
+uniform mat4 Part;      //  Part placement relative to the bicycle
+out     vec3 Position;  //  Position in eye coordinates
+out     vec3 Normal;    //  Normal in eye coordinates
+
+void main()
+{
+   //  Model matrix of this part on this bicycle
+   mat4 model = Instance*Part;
+   //  Normals need the inverse transpose, which is the cofactor matrix up to scale
+   mat3 M = mat3(model);
+   mat3 C = mat3(cross(M[1],M[2]),cross(M[2],M[0]),cross(M[0],M[1]));
+   vec4 P = gl_ModelViewMatrix*model*gl_Vertex;
+   Position = P.xyz/P.w;
+   Normal = gl_NormalMatrix*C*gl_Normal;
+   //  glColor sets ambient and diffuse
+   gl_FrontColor = gl_Color;
+   gl_Position = gl_ProjectionMatrix*P;
+}
@@ -2,6 +2,11 @@
 //  Willem A. (Vlakkies) Schreuder
 #include "CSCIx229.h"
 #include <ctype.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <pthread.h>
+#endif
 
 //  Load an OBJ file
 //  Vertex, Normal and Texture coordinates are supported
@@ -9,6 +14,13 @@
 //  Textures must be BMP files
 //  Surfaces are not supported
 //
+//  Files are read with stdio one line at a time (OBJ_STDIO, the original
+//  reader) or memory mapped and scanned in place (OBJ_MMAP, the default).
+//  Both fill the same arrays, which are copied into a mesh that is
+//  optimized for the vertex cache and simplified into levels of detail, and
+//  that LoadOBJ compiles into a display list.  Meshes are saved in a binary
+//  cache next to the OBJ file so later loads skip the text entirely.
+//
 //  WARNING:  This is a minimalist implementation of the OBJ file loader.  It
 //  will only correctly load a small subset of possible OBJ files.  It is
 //  intended to be a starting point to allow you to load models, but in order
@@ -19,18 +31,63 @@
 //  files may have correct surfaces, but the normals are complete junk and so
 //  the lighting is totally broken.  So beware of which OBJ files you use.
 
+//
+//  Material library
+//    Materials are kept for the whole program and shared by every OBJ file,
+//    so an MTL file used by many models is read once (and again only when
+//    its size or modification time changes).  Material, texture and MTL file
+//    names are interned to numbers and materials are hashed by library and
+//    name, so usemtl lines become material numbers while the OBJ file is
+//    read without comparing strings.  A mesh gets a copy of the materials it
+//    uses, numbered in order of first use.  Threads share the library under a
+//    lock and keep the libraries and materials of the file they read.
+//
+
 //  Material structure
 typedef struct
 {
-   char* name;                 //  Material name
-   float Ka[4],Kd[4],Ks[4],Ns; //  Colors and shininess
-   float d;                    //  Transparency
-   int map;                    //  Texture
+   int lib;                    //  Library defining it
+   int name;                   //  Material name
+   int tex;                    //  Texture file name (-1 for none)
+   Material mat;               //  Colors, shininess and texture
 } mtl_t;
 
-//  Material count and array
-static int Nmtl=0;
+//  MTL file
+typedef struct
+{
+   int file;                   //  File name
+   long long size;             //  Size when read
+   long long mtime;            //  Modification time when read
+} lib_t;
+
+//  Interned names and open addressing hash of them (name+1, 0 for empty)
+static char** names=NULL;
+static int Nname=0,Mname=0,Hname=0;
+static int* namehash=NULL;
+//  Libraries read
+static lib_t* lib=NULL;
+static int Nlib=0,Mlib=0;
+//  Materials and open addressing hash by library and name (material+1)
 static mtl_t* mtl=NULL;
+static int Nmtl=0,Mmtl=0,Hmtl=0;
+static int* mtlhash=NULL;
+
+#ifdef _WIN32
+#define LOCK()
+#define UNLOCK()
+#else
+static pthread_mutex_t mtllock=PTHREAD_MUTEX_INITIALIZER;
+#define LOCK()   pthread_mutex_lock(&mtllock)
+#define UNLOCK() pthread_mutex_unlock(&mtllock)
+#endif
+
+//  Libraries and materials of the file being read (each thread reads its own)
+static THREAD_LOCAL int  Nuselib=0,Muselib=0;
+static THREAD_LOCAL int* uselib=NULL;  //  Libraries from mtllib lines in order
+static THREAD_LOCAL int  Nused=0,Mused=0;
+static THREAD_LOCAL int* used=NULL;    //  Material of each mesh material
+static THREAD_LOCAL int  Nlocal=0;
+static THREAD_LOCAL int* local=NULL;   //  Mesh material+1 of each material (0 for unused)
 
 //
 //  Return true if CR or LF
@@ -44,8 +101,8 @@ static int CRLF(char ch)
 //  Read line from file
 //    Returns pointer to line or NULL on EOF
 //
-static int linelen=0;    //  Length of line
-static char* line=NULL;  //  Internal storage for line
+static THREAD_LOCAL int linelen=0;    //  Length of line
+static THREAD_LOCAL char* line=NULL;  //  Internal storage for line
 static char* readline(FILE* f)
 {
    char ch;  //  Character read
@@ -160,20 +217,201 @@ static char* readstr(char* line,const char* skip)
 }
 
 //
-//  Load materials from file
+//  FNV-1a hash of n characters
 //
-static void LoadMaterial(const char* file)
+static unsigned int hashname(const char* str,int n)
+{
+   unsigned int h = 2166136261u;
+   for (int i=0;i<n;i++)
+      h = (h^(unsigned char)str[i])*16777619u;
+   return h;
+}
+
+//
+//  Hash of library and material name
+//
+static unsigned int hashmtl(int l,int name)
+{
+   return (unsigned int)l*73856093u ^ (unsigned int)name*19349663u;
+}
+
+//
+//  Intern n characters (call locked)
+//    Returns the number of the name or -1 if out of memory
+//    Nothing changes on failure and the caller unlocks before Fatal
+//
+static int intern(const char* str,int n)
+{
+   //  Keep the hash at most half full
+   if (2*(Nname+1)>Hname)
+   {
+      int H = Hname ? 2*Hname : 1024;
+      int* hash = (int*)calloc(H,sizeof(int));
+      if (!hash) return -1;
+      for (int k=0;k<Nname;k++)
+      {
+         unsigned int h = hashname(names[k],strlen(names[k]))&(H-1);
+         while (hash[h]) h = (h+1)&(H-1);
+         hash[h] = k+1;
+      }
+      free(namehash);
+      namehash = hash;
+      Hname = H;
+   }
+   unsigned int h = hashname(str,n)&(Hname-1);
+   while (namehash[h])
+   {
+      const char* name = names[namehash[h]-1];
+      if (!strncmp(name,str,n) && !name[n]) return namehash[h]-1;
+      h = (h+1)&(Hname-1);
+   }
+   //  New name
+   if (Nname==Mname)
+   {
+      int M = Mname ? 2*Mname : 1024;
+      char** list = (char**)realloc(names,M*sizeof(char*));
+      if (!list) return -1;
+      names = list;
+      Mname = M;
+   }
+   char* name = (char*)malloc(n+1);
+   if (!name) return -1;
+   memcpy(name,str,n);
+   name[n] = 0;
+   names[Nname] = name;
+   namehash[h] = ++Nname;
+   return Nname-1;
+}
+
+//
+//  Intern n characters
+//
+static int internname(const char* str,int n)
+{
+   LOCK();
+   int k = intern(str,n);
+   UNLOCK();
+   if (k<0) Fatal("Cannot allocate memory\n");
+   return k;
+}
+
+//
+//  Interned name (names are never freed)
+//
+static const char* getname(int k)
+{
+   LOCK();
+   const char* str = names[k];
+   UNLOCK();
+   return str;
+}
+
+//
+//  Find material of a library (call locked)
+//    Returns material or -1 if not found
+//
+static int findmtl(int l,int name)
+{
+   if (!Hmtl) return -1;
+   unsigned int h = hashmtl(l,name)&(Hmtl-1);
+   while (mtlhash[h])
+   {
+      const mtl_t* m = mtl+mtlhash[h]-1;
+      if (m->lib==l && m->name==name) return mtlhash[h]-1;
+      h = (h+1)&(Hmtl-1);
+   }
+   return -1;
+}
+
+//
+//  Make room for n more materials and libraries (call locked)
+//    Returns 0 if out of memory (nothing changes and the caller unlocks
+//    before Fatal), so adding them cannot fail halfway
+//
+static int reservemtl(int n)
+{
+   //  Keep the hash at most half full
+   if (2*(Nmtl+n)>Hmtl)
+   {
+      int H = Hmtl ? Hmtl : 1024;
+      while (2*(Nmtl+n)>H) H *= 2;
+      int* hash = (int*)calloc(H,sizeof(int));
+      if (!hash) return 0;
+      for (int k=0;k<Nmtl;k++)
+      {
+         unsigned int h = hashmtl(mtl[k].lib,mtl[k].name)&(H-1);
+         while (hash[h]) h = (h+1)&(H-1);
+         hash[h] = k+1;
+      }
+      free(mtlhash);
+      mtlhash = hash;
+      Hmtl = H;
+   }
+   if (Nmtl+n>Mmtl)
+   {
+      int M = Mmtl ? Mmtl : 1024;
+      while (Nmtl+n>M) M *= 2;
+      mtl_t* list = (mtl_t*)realloc(mtl,M*sizeof(mtl_t));
+      if (!list) return 0;
+      mtl = list;
+      Mmtl = M;
+   }
+   if (Nlib==Mlib)
+   {
+      int M = Mlib ? 2*Mlib : 16;
+      lib_t* list = (lib_t*)realloc(lib,M*sizeof(lib_t));
+      if (!list) return 0;
+      lib = list;
+      Mlib = M;
+   }
+   return 1;
+}
+
+//
+//  Add material to the library (call locked after reservemtl)
+//    The first material of a library with a name wins
+//
+static void addmtl(const mtl_t* m)
+{
+   if (findmtl(m->lib,m->name)>=0) return;
+   unsigned int h = hashmtl(m->lib,m->name)&(Hmtl-1);
+   while (mtlhash[h]) h = (h+1)&(Hmtl-1);
+   mtl[Nmtl] = *m;
+   mtlhash[h] = ++Nmtl;
+}
+
+//
+//  Library read from file with this size and modification time (call locked)
+//    Returns library or -1 if it must be read
+//
+static int findlib(int file,const struct stat* st)
+{
+   //  Newest first
+   for (int k=Nlib-1;k>=0;k--)
+      if (lib[k].file==file)
+         return (lib[k].size==st->st_size && lib[k].mtime==st->st_mtime) ? k : -1;
+   return -1;
+}
+
+//
+//  Read materials from file into the library
+//    Returns library or -1 if the file cannot be read
+//
+static int ReadMaterials(const char* file,int filename,const struct stat* st)
 {
    int k=-1;
    char* line;
    char* str;
+   //  Read outside the lock since Fatal may be caught
+   int n=0;
+   mtl_t* m=NULL;
 
    //  Open file or return with warning on error
    FILE* f = fopen(file,"r");
    if (!f)
    {
       fprintf(stderr,"Cannot open material file %s\n",file);
-      return;
+      return -1;
    }
 
    //  Read lines
@@ -182,87 +420,251 @@ static void LoadMaterial(const char* file)
       //  New material
       if ((str = readstr(line,"newmtl")))
       {
-         int l = strlen(str);
          //  Allocate memory for structure
-         k = Nmtl++;
-         mtl = (mtl_t*)realloc(mtl,Nmtl*sizeof(mtl_t));
+         k = n++;
+         m = (mtl_t*)realloc(m,n*sizeof(mtl_t));
+         if (!m) Fatal("Cannot allocate memory\n");
          //  Store name
-         mtl[k].name = (char*)malloc(l+1);
-         if (!mtl[k].name) Fatal("Cannot allocate %d for name\n",l+1);
-         strcpy(mtl[k].name,str);
+         m[k].name = internname(str,strlen(str));
          //  Initialize materials
-         mtl[k].Ka[0] = mtl[k].Ka[1] = mtl[k].Ka[2] = 0;   mtl[k].Ka[3] = 1;
-         mtl[k].Kd[0] = mtl[k].Kd[1] = mtl[k].Kd[2] = 0;   mtl[k].Kd[3] = 1;
-         mtl[k].Ks[0] = mtl[k].Ks[1] = mtl[k].Ks[2] = 0;   mtl[k].Ks[3] = 1;
-         mtl[k].Ns  = 0;
-         mtl[k].d   = 0;
-         mtl[k].map = 0;
+         m[k].mat.Ka[0] = m[k].mat.Ka[1] = m[k].mat.Ka[2] = 0;   m[k].mat.Ka[3] = 1;
+         m[k].mat.Kd[0] = m[k].mat.Kd[1] = m[k].mat.Kd[2] = 0;   m[k].mat.Kd[3] = 1;
+         m[k].mat.Ks[0] = m[k].mat.Ks[1] = m[k].mat.Ks[2] = 0;   m[k].mat.Ks[3] = 1;
+         m[k].mat.Ns  = 0;
+         m[k].mat.d   = 0;
+         m[k].mat.map = 0;
+         m[k].tex = -1;
       }
       //  If no material short circuit here
       else if (k<0)
       {}
       //  Ambient color
       else if (line[0]=='K' && line[1]=='a')
-         readfloat(line+2,3,mtl[k].Ka);
+         readfloat(line+2,3,m[k].mat.Ka);
       //  Diffuse color
       else if (line[0]=='K' && line[1] == 'd')
-         readfloat(line+2,3,mtl[k].Kd);
+         readfloat(line+2,3,m[k].mat.Kd);
       //  Specular color
       else if (line[0]=='K' && line[1] == 's')
-         readfloat(line+2,3,mtl[k].Ks);
+         readfloat(line+2,3,m[k].mat.Ks);
       //  Material Shininess
       else if (line[0]=='N' && line[1]=='s')
       {
-         readfloat(line+2,1,&mtl[k].Ns);
+         readfloat(line+2,1,&m[k].mat.Ns);
          //  Limit to 128 for OpenGL
-         if (mtl[k].Ns>128) mtl[k].Ns = 128;
+         if (m[k].mat.Ns>128) m[k].mat.Ns = 128;
       }
       //  Textures (must be BMP - will fail if not)
+      //  Loaded by LoadMeshTextures so reading needs no OpenGL
       else if ((str = readstr(line,"map_Kd")))
-         mtl[k].map = LoadTexBMP(str);
+         m[k].tex = internname(str,strlen(str));
       //  Ignore line if we get here
    }
    fclose(f);
+
+   //  Add to the library unless another thread just did
+   LOCK();
+   int l = findlib(filename,st);
+   if (l<0 && !reservemtl(n))
+   {
+      UNLOCK();
+      free(m);
+      Fatal("Cannot allocate %d materials\n",n);
+   }
+   if (l<0)
+   {
+      l = Nlib++;
+      lib[l].file = filename;
+      lib[l].size = st->st_size;
+      lib[l].mtime = st->st_mtime;
+      for (int i=0;i<n;i++)
+      {
+         m[i].lib = l;
+         addmtl(m+i);
+      }
+   }
+   UNLOCK();
+   free(m);
+   return l;
 }
 
 //
-//  Set material
+//  Load materials from file
+//    Files already in the library are not read again
 //
-static void SetMaterial(const char* name)
+static void LoadMaterial(const char* file)
 {
-   //  Search materials for a matching name
-   for (int k=0;k<Nmtl;k++)
-      if (!strcmp(mtl[k].name,name))
+   struct stat st;
+   if (stat(file,&st))
+   {
+      fprintf(stderr,"Cannot open material file %s\n",file);
+      return;
+   }
+   LOCK();
+   int filename = intern(file,strlen(file));
+   int l = filename<0 ? -1 : findlib(filename,&st);
+   UNLOCK();
+   if (filename<0) Fatal("Cannot allocate memory\n");
+   if (l<0) l = ReadMaterials(file,filename,&st);
+   if (l<0) return;
+   //  Use the library for this file
+   for (int k=0;k<Nuselib;k++)
+      if (uselib[k]==l) return;
+   if (Nuselib==Muselib)
+   {
+      Muselib = Muselib ? 2*Muselib : 16;
+      uselib = (int*)realloc(uselib,Muselib*sizeof(int));
+      if (!uselib) Fatal("Cannot allocate memory\n");
+   }
+   uselib[Nuselib++] = l;
+}
+
+//
+//  Find material by interned name in the libraries of this file
+//    Returns the mesh material or -1 if not found
+//
+static int FindMaterial(int nm)
+{
+   int k=-1;
+   LOCK();
+   for (int i=0;i<Nuselib && k<0;i++)
+      k = findmtl(uselib[i],nm);
+   int n = Nmtl;
+   UNLOCK();
+   //  No matches
+   if (k<0)
+   {
+      fprintf(stderr,"Unknown material %s\n",getname(nm));
+      return -1;
+   }
+   //  Number mesh materials in order of first use
+   if (k>=Nlocal)
+   {
+      local = (int*)realloc(local,n*sizeof(int));
+      if (!local) Fatal("Cannot allocate memory\n");
+      memset(local+Nlocal,0,(n-Nlocal)*sizeof(int));
+      Nlocal = n;
+   }
+   if (!local[k])
+   {
+      if (Nused==Mused)
       {
-         //  Set material colors
-         glMaterialfv(GL_FRONT_AND_BACK,GL_AMBIENT  ,mtl[k].Ka);
-         glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE  ,mtl[k].Kd);
-         glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR ,mtl[k].Ks);
-         glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,&mtl[k].Ns);
-         //  Bind texture if specified
-         if (mtl[k].map)
-         {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D,mtl[k].map);
-         }
-         else
-            glDisable(GL_TEXTURE_2D);
-         return;
+         Mused = Mused ? 2*Mused : 64;
+         used = (int*)realloc(used,Mused*sizeof(int));
+         if (!used) Fatal("Cannot allocate memory\n");
       }
-   //  No matches
-   fprintf(stderr,"Unknown material %s\n",name);
+      used[Nused++] = k;
+      local[k] = Nused;
+   }
+   return local[k]-1;
 }
 
 //
-//  Load OBJ file
+//  Read Vertex/Texture/Normal triplet of a facet
+//    Missing texture and normal indexes are set to zero
 //
-int LoadOBJ(const char* file)
+static void readface(const char* str,int Nv,int Nt,int Nn,int* Kv,int* Kt,int* Kn)
+{
+   //  Try Vertex/Texture/Normal triplet
+   if (sscanf(str,"%d/%d/%d",Kv,Kt,Kn)==3)
+   {
+      if (*Kv<0 || *Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",*Kv,Nv/3);
+      if (*Kn<0 || *Kn>Nn/3) Fatal("Normal %d out of range 1-%d\n",*Kn,Nn/3);
+      if (*Kt<0 || *Kt>Nt/2) Fatal("Texture %d out of range 1-%d\n",*Kt,Nt/2);
+   }
+   //  Try Vertex//Normal pairs
+   else if (sscanf(str,"%d//%d",Kv,Kn)==2)
+   {
+      if (*Kv<0 || *Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",*Kv,Nv/3);
+      if (*Kn<0 || *Kn>Nn/3) Fatal("Normal %d out of range 1-%d\n",*Kn,Nn/3);
+      *Kt = 0;
+   }
+   //  Try Vertex index
+   else if (sscanf(str,"%d",Kv)==1)
+   {
+      if (*Kv<0 || *Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",*Kv,Nv/3);
+      *Kn = 0;
+      *Kt = 0;
+   }
+   //  This is an error
+   else
+      Fatal("Invalid facet %s\n",str);
+}
+
+//
+//  Contents of an OBJ file
+//    F holds faces and material switches in file order.  A face is its
+//    corner count followed by a Vertex/Texture/Normal triplet per corner
+//    (1 based, 0 if missing).  A negative entry -1-k switches to material k.
+//
+typedef struct
+{
+   int  Nv,Nn,Nt,Nf;  //  Number of vertex, normal, texture and face values
+   int  Mv,Mn,Mt,Mf;  //  Maximum vertex, normal, texture and face values
+   float* V;          //  Array of vertexes
+   float* N;          //  Array of normals
+   float* T;          //  Array of textures coordinates
+   int*   F;          //  Array of faces and material switches
+   int  nc;           //  Number of face corners
+   int  ntri;         //  Number of triangles after splitting faces
+   int  nsw;          //  Number of material switches
+} obj_t;
+
+//  How OBJ files are read
+static int objmode=OBJ_MMAP;
+
+//
+//  Select the line reader or the memory mapped scanner
+//
+void OBJMode(int m)
+{
+   objmode = m;
+}
+
+//
+//  Make room for n more face values
+//
+static void morefaces(obj_t* obj,int n)
+{
+   if (obj->Nf+n <= obj->Mf) return;
+   //  Double so huge models are not copied over and over
+   obj->Mf = 2*obj->Mf+n+8192;
+   obj->F = (int*)realloc(obj->F,obj->Mf*sizeof(int));
+   if (!obj->F) Fatal("Cannot allocate memory\n");
+}
+
+//
+//  Add a material switch
+//
+static void addswitch(obj_t* obj,const char* name)
+{
+   int k = FindMaterial(internname(name,strlen(name)));
+   if (k<0) return;
+   morefaces(obj,1);
+   obj->F[obj->Nf++] = -1-k;
+   obj->nsw++;
+}
+
+//
+//  Finish a face with n corners that starts at F[first]
+//
+static void endface(obj_t* obj,int first,int n)
+{
+   if (n<1)
+   {
+      obj->Nf = first;
+      return;
+   }
+   obj->F[first] = n;
+   obj->nc += n;
+   if (n>2) obj->ntri += n-2;
+}
+
+//
+//  Read OBJ file one line at a time with stdio and sscanf
+//
+static void ReadLines(const char* file,obj_t* obj)
 {
-   int  Nv,Nn,Nt;  //  Number of vertex, normal and textures
-   int  Mv,Mn,Mt;  //  Maximum vertex, normal and textures
-   float* V;       //  Array of vertexes
-   float* N;       //  Array of normals
-   float* T;       //  Array if textures coordinates
    char*  line;    //  Line pointer
    char*  str;     //  String pointer
 
@@ -270,93 +672,1038 @@ int LoadOBJ(const char* file)
    FILE* f = fopen(file,"r");
    if (!f) Fatal("Cannot open file %s\n",file);
 
-   // Reset materials
-   mtl = NULL;
-   Nmtl = 0;
-
-   //  Start new displaylist
-   int list = glGenLists(1);
-   glNewList(list,GL_COMPILE);
-   //  Push attributes for textures
-   glPushAttrib(GL_ENABLE_BIT|GL_TEXTURE_BIT);
-
    //  Read vertexes and facets
-   V  = N  = T  = NULL;
-   Nv = Nn = Nt = 0;
-   Mv = Mn = Mt = 0;
    while ((line = readline(f)))
    {
       //  Vertex coordinates (always 3)
       if (line[0]=='v' && line[1]==' ')
-         readcoord(line+2,3,&V,&Nv,&Mv);
+         readcoord(line+2,3,&obj->V,&obj->Nv,&obj->Mv);
       //  Normal coordinates (always 3)
       else if (line[0]=='v' && line[1] == 'n')
-         readcoord(line+2,3,&N,&Nn,&Mn);
+         readcoord(line+2,3,&obj->N,&obj->Nn,&obj->Mn);
       //  Texture coordinates (always 2)
       else if (line[0]=='v' && line[1] == 't')
-         readcoord(line+2,2,&T,&Nt,&Mt);
-      //  Read and draw facets
+         readcoord(line+2,2,&obj->T,&obj->Nt,&obj->Mt);
+      //  Read facets
       else if (line[0]=='f')
       {
          line++;
          //  Read Vertex/Texture/Normal triplets
-         glBegin(GL_POLYGON);
+         int n=0;
+         morefaces(obj,1);
+         int first = obj->Nf++;
          while ((str = getword(&line)))
          {
-            int Kv,Kt,Kn;
-            //  Try Vertex/Texture/Normal triplet
-            if (sscanf(str,"%d/%d/%d",&Kv,&Kt,&Kn)==3)
-            {
-               if (Kv<0 || Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",Kv,Nv/3);
-               if (Kn<0 || Kn>Nn/3) Fatal("Normal %d out of range 1-%d\n",Kn,Nn/3);
-               if (Kt<0 || Kt>Nt/2) Fatal("Texture %d out of range 1-%d\n",Kt,Nt/2);
-            }
-            //  Try Vertex//Normal pairs
-            else if (sscanf(str,"%d//%d",&Kv,&Kn)==2)
-            {
-               if (Kv<0 || Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",Kv,Nv/3);
-               if (Kn<0 || Kn>Nn/3) Fatal("Normal %d out of range 1-%d\n",Kn,Nn/3);
-               Kt = 0;
-            }
-            //  Try Vertex index
-            else if (sscanf(str,"%d",&Kv)==1)
-            {
-               if (Kv<0 || Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",Kv,Nv/3);
-               Kn = 0;
-               Kt = 0;
-            }
-            //  This is an error
-            else
-               Fatal("Invalid facet %s\n",str);
-            //  Draw vectors
-            if (Kt) glTexCoord2fv(T+2*(Kt-1));
-            if (Kn) glNormal3fv(N+3*(Kn-1));
-            if (Kv) glVertex3fv(V+3*(Kv-1));
+            morefaces(obj,3);
+            int* K = obj->F+obj->Nf;
+            readface(str,obj->Nv,obj->Nt,obj->Nn,K,K+1,K+2);
+            obj->Nf += 3;
+            n++;
          }
-         glEnd();
+         endface(obj,first,n);
       }
       //  Use material
       else if ((str = readstr(line,"usemtl")))
-         SetMaterial(str);
+         addswitch(obj,str);
       //  Load materials
       else if ((str = readstr(line,"mtllib")))
          LoadMaterial(str);
       //  Skip this line
    }
    fclose(f);
-   //  Pop attributes (textures)
-   glPopAttrib();
-   glEndList();
+}
+
+//
+//  Scanner for OBJ text in place
+//    Every function takes the current position and the end of the buffer
+//    which need not be NUL terminated.  Locale and stdio are not used.
+//
+#define DIGIT(ch) ((unsigned char)((ch)-'0')<10)
+#define BLANK(ch) ((ch)==' ' || (ch)=='\t')
+#define EOL(ch)   ((ch)=='\n' || (ch)=='\r')
+
+//
+//  Skip spaces and tabs
+//
+static const char* skipblank(const char* p,const char* end)
+{
+   while (p<end && BLANK(*p)) p++;
+   return p;
+}
+
+//
+//  Skip to the start of the next line
+//
+static const char* skipline(const char* p,const char* end)
+{
+   const char* q = memchr(p,'\n',end-p);
+   return q ? q+1 : end;
+}
+
+//
+//  Scan integer
+//    Returns pointer past the number or NULL if there is none
+//
+static const char* scanint(const char* p,const char* end,int* k)
+{
+   int neg=0;
+   if (p<end && (*p=='-' || *p=='+')) neg = (*p++=='-');
+   if (p>=end || !DIGIT(*p)) return NULL;
+   int n=0;
+   while (p<end && DIGIT(*p))
+      n = 10*n + (*p++ - '0');
+   *k = neg ? -n : n;
+   return p;
+}
+
+//
+//  Scan float in decimal or exponential notation
+//    Returns pointer past the number or NULL if there is none
+//    Up to 18 significant digits are used, which is plenty for a float
+//
+static const char* scanfloat(const char* p,const char* end,float* x)
+{
+   //  Exact powers of ten in a double
+   static const double pow10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,
+                                  1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+   int neg=0;
+   if (p<end && (*p=='-' || *p=='+')) neg = (*p++=='-');
+   //  Digits before and after the decimal point
+   unsigned long long m=0;
+   int e=0,nd=0;
+   for (;p<end && DIGIT(*p);p++,nd++)
+   {
+      if (m<100000000000000000ULL)
+         m = 10*m + (*p-'0');
+      else
+         e++;
+   }
+   if (p<end && *p=='.')
+   {
+      for (p++;p<end && DIGIT(*p);p++,nd++)
+      {
+         if (m<100000000000000000ULL)
+         {
+            m = 10*m + (*p-'0');
+            e--;
+         }
+      }
+   }
+   if (!nd) return NULL;
+   //  Exponent
+   if (p<end && (*p=='e' || *p=='E'))
+   {
+      int k;
+      p = scanint(p+1,end,&k);
+      if (!p) return NULL;
+      e += k;
+   }
+   //  Scale by a power of ten
+   double v = m;
+   if (e<-22)
+      v *= pow(10,e);
+   else if (e<0)
+      v /= pow10[-e];
+   else if (e>22)
+      v *= pow(10,e);
+   else
+      v *= pow10[e];
+   *x = neg ? -v : v;
+   return p;
+}
+
+//
+//  Report error with the line number
+//
+static void ScanError(const char* what,const char* file,const char* buf,const char* p)
+{
+   int line=1;
+   for (const char* q=buf;q<p;q++)
+      if (*q=='\n') line++;
+   Fatal("%s in %s line %d\n",what,file,line);
+}
+
+//
+//  Scan n floats and append to array x
+//
+static const char* scancoord(const char* p,const char* end,int n,float* x[],int* N,int* M)
+{
+   //  Double so huge models are not copied over and over
+   if (*N+n > *M)
+   {
+      *M = 2*(*M)+8192;
+      *x = (float*)realloc(*x,(*M)*sizeof(float));
+      if (!*x) Fatal("Cannot allocate memory\n");
+   }
+   float* v = (*x)+*N;
+   for (int i=0;i<n;i++)
+   {
+      p = skipblank(p,end);
+      if (!(p = scanfloat(p,end,v+i))) return NULL;
+   }
+   (*N) += n;
+   return p;
+}
+
+//
+//  Find word following a keyword
+//    Returns the start and sets the length
+//
+static const char* scanword(const char* p,const char* end,int* n)
+{
+   p = skipblank(p,end);
+   const char* q = p;
+   while (q<end && !BLANK(*q) && !EOL(*q)) q++;
+   *n = q-p;
+   return p;
+}
+
+//
+//  Match keyword followed by a blank at the start of a line
+//
+static int keyword(const char* p,const char* end,const char* key)
+{
+   int n = strlen(key);
+   return end-p>n && !memcmp(p,key,n) && BLANK(p[n]);
+}
+
+//
+//  Part of a memory mapped OBJ file scanned by one thread
+//    Chunks are scanned in parallel, then merged in parallel once the
+//    offsets of every chunk in the merged arrays are known.
+//
+typedef struct
+{
+   const char* file;  //  File name for errors
+   const char* buf;   //  Start of file for errors
+   const char* p;     //  Start of chunk
+   const char* end;   //  End of chunk
+   obj_t obj;         //  Values read from the chunk
+   int   Nr,Mr;       //  Number and maximum of relative indexes
+   int*  R;           //  Positions in F of relative indexes
+   int   Nw,Mw;       //  Number and maximum of names
+   int*  W;           //  Interned names from mtllib (-1-name) and usemtl lines in file order
+   int*  K;           //  Material for each name (-1 to drop), set before merge
+   int   Ov,Ot,On,Of; //  Offsets in merged arrays
+   obj_t* out;        //  Merged arrays
+   void* (*func)(void*); //  Function run on the chunk
+   char* error;       //  Message of Fatal in the chunk thread
+} chunk_t;
+
+//
+//  Add mtllib (lib=1) or usemtl name to a chunk
+//    F refers to name k as -1-k until the chunks are merged
+//
+static void addword(chunk_t* chunk,const char* p,const char* end,int lib)
+{
+   if (chunk->Nw>=chunk->Mw)
+   {
+      chunk->Mw += 64;
+      chunk->W = (int*)realloc(chunk->W,chunk->Mw*sizeof(int));
+      if (!chunk->W) Fatal("Cannot allocate memory\n");
+   }
+   int n;
+   const char* str = scanword(p,end,&n);
+   int k = internname(str,n);
+   morefaces(&chunk->obj,1);
+   chunk->obj.F[chunk->obj.Nf++] = -1-chunk->Nw;
+   chunk->W[chunk->Nw++] = lib ? -1-k : k;
+}
+
+//
+//  Convert negative index to an index relative to the start of the chunk
+//    The offset of the chunk is added when the chunks are merged
+//
+static void relindex(chunk_t* chunk,int* K,int n)
+{
+   if (*K>=0) return;
+   *K += n+1;
+   if (chunk->Nr>=chunk->Mr)
+   {
+      chunk->Mr = 2*chunk->Mr+1024;
+      chunk->R = (int*)realloc(chunk->R,chunk->Mr*sizeof(int));
+      if (!chunk->R) Fatal("Cannot allocate memory\n");
+   }
+   chunk->R[chunk->Nr++] = K-chunk->obj.F;
+}
+
+//
+//  Scan chunk of OBJ file in place
+//
+static void* ScanChunk(void* arg)
+{
+   chunk_t* chunk = (chunk_t*)arg;
+   obj_t* obj = &chunk->obj;
+   const char* end = chunk->end;
+   const char* p = chunk->p;
+   while (p<end)
+   {
+      const char* line = p = skipblank(p,end);
+      if (p>=end) break;
+      //  Vertex coordinates (always 3)
+      if (p[0]=='v' && end-p>1 && BLANK(p[1]))
+         p = scancoord(p+2,end,3,&obj->V,&obj->Nv,&obj->Mv);
+      //  Normal coordinates (always 3)
+      else if (p[0]=='v' && end-p>1 && p[1]=='n')
+         p = scancoord(p+2,end,3,&obj->N,&obj->Nn,&obj->Mn);
+      //  Texture coordinates (always 2)
+      else if (p[0]=='v' && end-p>1 && p[1]=='t')
+         p = scancoord(p+2,end,2,&obj->T,&obj->Nt,&obj->Mt);
+      //  Read facets
+      else if (p[0]=='f' && end-p>1 && BLANK(p[1]))
+      {
+         int n=0;
+         morefaces(obj,1);
+         int first = obj->Nf++;
+         p++;
+         //  Read Vertex/Texture/Normal triplets to end of line
+         while ((p = skipblank(p,end))<end && !EOL(*p) && *p!='#')
+         {
+            int Kv,Kt=0,Kn=0;
+            p = scanint(p,end,&Kv);
+            if (p && p<end && *p=='/')
+            {
+               //  Texture is missing in Vertex//Normal
+               if (++p<end && *p!='/')
+                  p = scanint(p,end,&Kt);
+               if (p && p<end && *p=='/')
+                  p = scanint(p+1,end,&Kn);
+            }
+            if (!p || (p<end && !BLANK(*p) && !EOL(*p))) ScanError("Invalid facet",chunk->file,chunk->buf,line);
+            //  Indexes are checked when the chunks are merged
+            morefaces(obj,3);
+            int* K = obj->F+obj->Nf;
+            K[0] = Kv;
+            K[1] = Kt;
+            K[2] = Kn;
+            relindex(chunk,K  ,obj->Nv/3);
+            relindex(chunk,K+1,obj->Nt/2);
+            relindex(chunk,K+2,obj->Nn/3);
+            obj->Nf += 3;
+            n++;
+         }
+         endface(obj,first,n);
+      }
+      //  Use material
+      else if (keyword(p,end,"usemtl"))
+         addword(chunk,p+6,end,0);
+      //  Load materials
+      else if (keyword(p,end,"mtllib"))
+         addword(chunk,p+6,end,1);
+      if (!p) ScanError("Error reading float",chunk->file,chunk->buf,line);
+      //  Skip the rest of this line
+      p = skipline(p,end);
+   }
+   return NULL;
+}
+
+//
+//  Copy chunk to the merged arrays
+//    Adds the chunk offsets to relative indexes, checks every index and
+//    replaces names with materials.  A single chunk is merged in place.
+//
+static void* MergeChunk(void* arg)
+{
+   chunk_t* chunk = (chunk_t*)arg;
+   obj_t* in  = &chunk->obj;
+   obj_t* out = chunk->out;
+   //  Coordinates
+   if (out->V!=in->V) memcpy(out->V+chunk->Ov,in->V,in->Nv*sizeof(float));
+   if (out->T!=in->T) memcpy(out->T+chunk->Ot,in->T,in->Nt*sizeof(float));
+   if (out->N!=in->N) memcpy(out->N+chunk->On,in->N,in->Nn*sizeof(float));
+   //  Faces and material switches
+   const int off[] = {chunk->Ov/3,chunk->Ot/2,chunk->On/3};
+   const int max[] = {out->Nv/3,out->Nt/2,out->Nn/3};
+   const char* what[] = {"Vertex","Texture","Normal"};
+   int* F = out->F+chunk->Of;
+   int r=0;
+   for (int i=0;i<in->Nf;)
+   {
+      int n = in->F[i++];
+      if (n<0)
+      {
+         int k = chunk->K[-1-n];
+         if (k>=0) *F++ = -1-k;
+         continue;
+      }
+      *F++ = n;
+      for (int l=0;l<3*n;l++,i++)
+      {
+         int K = in->F[i];
+         if (r<chunk->Nr && chunk->R[r]==i)
+         {
+            K += off[l%3];
+            r++;
+         }
+         //  Vertex is required, texture and normal may be 0
+         if (K<(l%3==0) || K>max[l%3]) Fatal("%s %d out of range 1-%d in %s\n",what[l%3],K,max[l%3],chunk->file);
+         *F++ = K;
+      }
+   }
+   return NULL;
+}
+
+//  Threads used to scan OBJ files (0 for one per processor)
+static int objthreads=0;
+
+//
+//  Set number of threads used to scan OBJ files
+//    0 uses one thread per processor
+//
+void OBJThreads(int n)
+{
+   objthreads = n;
+}
 
-   //  Free materials
-   for (int k=0;k<Nmtl;k++)
-      free(mtl[k].name);
-   free(mtl);
+#ifndef _WIN32
+//
+//  Run the function of a chunk keeping the message of Fatal
+//    The catcher of the calling thread is restored afterwards
+//
+static void* CatchChunk(void* arg)
+{
+   chunk_t* chunk = (chunk_t*)arg;
+   jmp_buf env;
+   jmp_buf* outer = FatalJump(NULL);
+   if (setjmp(env))
+   {
+      chunk->error = (char*)malloc(strlen(FatalMessage())+1);
+      if (chunk->error) strcpy(chunk->error,FatalMessage());
+   }
+   else
+   {
+      FatalJump(&env);
+      chunk->func(chunk);
+   }
+   FatalJump(outer);
+   return NULL;
+}
+#endif
 
+//
+//  Run function on every chunk in its own thread
+//    Fatal in any chunk is raised again in the calling thread once every
+//    thread is done with the file
+//
+static void RunChunks(void* (*func)(void*),chunk_t* chunk,int n)
+{
+#ifdef _WIN32
+   for (int k=0;k<n;k++)
+      func(chunk+k);
+#else
+   pthread_t* thread = (pthread_t*)malloc(n*sizeof(pthread_t));
+   int* started = (int*)calloc(n,sizeof(int));
+   if (!thread || !started)
+   {
+      free(thread);
+      free(started);
+      Fatal("Cannot allocate memory\n");
+   }
+   //  The calling thread takes the first chunk and any a thread cannot
+   for (int k=0;k<n;k++)
+   {
+      chunk[k].func = func;
+      chunk[k].error = NULL;
+   }
+   for (int k=1;k<n;k++)
+      started[k] = !pthread_create(thread+k,NULL,CatchChunk,chunk+k);
+   CatchChunk(chunk);
+   for (int k=1;k<n;k++)
+      if (started[k])
+         pthread_join(thread[k],NULL);
+      else
+         CatchChunk(chunk+k);
+   free(thread);
+   free(started);
+   //  Raise the first error
+   char msg[1024]="";
+   for (int k=n-1;k>=0;k--)
+      if (chunk[k].error)
+      {
+         snprintf(msg,sizeof(msg),"%s",chunk[k].error);
+         free(chunk[k].error);
+         chunk[k].error = NULL;
+      }
+   if (*msg) Fatal("%s",msg);
+#endif
+}
+
+//
+//  Scan OBJ file in place from a memory mapped buffer
+//    Large files are split into line aligned chunks scanned in parallel
+//
+static void ScanOBJ(const char* file,obj_t* obj)
+{
+   size_t len;
+   const char* buf = MapFile(file,&len);
+
+   //  Use at most one thread per MB
+   int n = objthreads;
+#ifdef _WIN32
+   if (n<1) n = 1;
+#else
+   if (n<1) n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   if (n>len/(1<<20)) n = len/(1<<20);
+   if (n<1) n = 1;
+
+   //  Split into chunks ending after a newline
+   chunk_t* chunk = (chunk_t*)calloc(n,sizeof(chunk_t));
+   if (!chunk) Fatal("Cannot allocate memory\n");
+   const char* p = buf;
+   for (int k=0;k<n;k++)
+   {
+      chunk[k].file = file;
+      chunk[k].buf = buf;
+      chunk[k].p = p;
+      chunk[k].end = p = (k<n-1) ? skipline(buf+len*(k+1)/n,buf+len) : buf+len;
+      if (p<chunk[k].p) chunk[k].end = p = chunk[k].p;
+      chunk[k].out = obj;
+   }
+   RunChunks(ScanChunk,chunk,n);
+
+   //  Load material files and find materials in file order
+   for (int k=0;k<n;k++)
+   {
+      chunk_t* c = chunk+k;
+      c->K = (int*)malloc(c->Nw*sizeof(int));
+      if (c->Nw && !c->K) Fatal("Cannot allocate memory\n");
+      int drop=0;
+      for (int j=0;j<c->Nw;j++)
+      {
+         if (c->W[j]<0)
+         {
+            LoadMaterial(getname(-1-c->W[j]));
+            c->K[j] = -1;
+         }
+         else
+            c->K[j] = FindMaterial(c->W[j]);
+         if (c->K[j]<0)
+            drop++;
+         else
+            obj->nsw++;
+      }
+      //  Offsets in merged arrays
+      c->Ov = obj->Nv;  obj->Nv += c->obj.Nv;
+      c->Ot = obj->Nt;  obj->Nt += c->obj.Nt;
+      c->On = obj->Nn;  obj->Nn += c->obj.Nn;
+      c->Of = obj->Nf;  obj->Nf += c->obj.Nf-drop;
+      obj->nc   += c->obj.nc;
+      obj->ntri += c->obj.ntri;
+   }
+
+   //  A single chunk is merged in place
+   if (n==1)
+   {
+      obj->V = chunk[0].obj.V;
+      obj->T = chunk[0].obj.T;
+      obj->N = chunk[0].obj.N;
+      obj->F = chunk[0].obj.F;
+   }
+   else
+   {
+      obj->V = (float*)malloc(obj->Nv*sizeof(float)+1);
+      obj->T = (float*)malloc(obj->Nt*sizeof(float)+1);
+      obj->N = (float*)malloc(obj->Nn*sizeof(float)+1);
+      obj->F = (int*)malloc(obj->Nf*sizeof(int)+1);
+      if (!obj->V || !obj->T || !obj->N || !obj->F) Fatal("Cannot allocate memory\n");
+   }
+   RunChunks(MergeChunk,chunk,n);
+
+   //  Free chunks
+   for (int k=0;k<n;k++)
+   {
+      if (n>1)
+      {
+         free(chunk[k].obj.V);
+         free(chunk[k].obj.T);
+         free(chunk[k].obj.N);
+         free(chunk[k].obj.F);
+      }
+      free(chunk[k].R);
+      free(chunk[k].W);
+      free(chunk[k].K);
+   }
+   free(chunk);
+   UnmapFile(buf,len);
+}
+
+//
+//  Read OBJ file and its materials
+//
+static void ReadOBJ(const char* file,obj_t* obj)
+{
+   //  Forget the materials of the last file (even if reading it failed)
+   for (int k=0;k<Nused;k++)
+      local[used[k]] = 0;
+   Nused = 0;
+   Nuselib = 0;
+   memset(obj,0,sizeof(obj_t));
+   if (objmode==OBJ_MMAP)
+      ScanOBJ(file,obj);
+   else
+      ReadLines(file,obj);
+}
+
+//
+//  Free OBJ file contents
+//    Materials stay in the library
+//
+static void FreeOBJ(obj_t* obj)
+{
    //  Free arrays
-   free(V);
-   free(T);
-   free(N);
+   free(obj->V);
+   free(obj->T);
+   free(obj->N);
+   free(obj->F);
+}
+
+//
+//  Start a new material group in a mesh being loaded
+//
+static void addgroup(Mesh* mesh,int k)
+{
+   //  Reuse the last group if it is still empty
+   if (mesh->ng && mesh->group[mesh->ng-1].count==0)
+      mesh->ng--;
+   mesh->group[mesh->ng].first = mesh->ni;
+   mesh->group[mesh->ng].count = 0;
+   mesh->group[mesh->ng].mtl   = k;
+   mesh->ng++;
+}
+
+//
+//  Hash Vertex/Texture/Normal triplet
+//
+static unsigned int hashface(const int K[3])
+{
+   return (unsigned int)K[0]*73856093u ^ (unsigned int)K[1]*19349663u ^ (unsigned int)K[2]*83492791u;
+}
+
+//
+//  Copy OBJ file contents into a mesh
+//    Each unique Vertex/Texture/Normal triplet becomes one vertex
+//    Polygons are split into triangle fans
+//    Each material switch starts a new group
+//
+static Mesh* BuildMesh(obj_t* obj)
+{
+   //  At most every face corner is a vertex
+   Mesh* mesh = NewMesh(obj->nc,3*obj->ntri);
+   mesh->nv = mesh->ni = 0;
+   //  Start with no material
+   mesh->group = (MeshGroup*)malloc((obj->nsw+1)*sizeof(MeshGroup));
+   if (!mesh->group) Fatal("Cannot allocate memory\n");
+   addgroup(mesh,-1);
+
+   //  Open addressing hash table of vertexes at most half full
+   //  Entries are the vertex number plus one (0 for empty)
+   unsigned int size=1024;
+   while (size<2*(unsigned int)obj->nc) size *= 2;
+   unsigned int* hash = (unsigned int*)calloc(size,sizeof(unsigned int));
+   //  Triplet of each vertex
+   int* key = (int*)malloc(3*obj->nc*sizeof(int)+1);
+   if (!hash || !key) Fatal("Cannot allocate memory\n");
+
+   for (int i=0;i<obj->Nf;)
+   {
+      int n = obj->F[i++];
+      //  Use material
+      if (n<0)
+      {
+         addgroup(mesh,-1-n);
+         continue;
+      }
+      //  Add Vertex/Texture/Normal triplets as a triangle fan
+      unsigned int first=0,last=0;
+      for (int k=0;k<n;k++,i+=3)
+      {
+         const int* K = obj->F+i;
+         //  Find triplet or add a new vertex
+         unsigned int h = hashface(K)&(size-1);
+         while (hash[h] && memcmp(key+3*(hash[h]-1),K,3*sizeof(int)))
+            h = (h+1)&(size-1);
+         if (!hash[h])
+         {
+            float* v = mesh->vert+MESH_STRIDE*mesh->nv;
+            const float Z[] = {0,0,1};
+            memcpy(v  ,K[0] ? obj->V+3*(K[0]-1) : Z,3*sizeof(float));
+            memcpy(v+3,K[2] ? obj->N+3*(K[2]-1) : Z,3*sizeof(float));
+            memcpy(v+6,K[1] ? obj->T+2*(K[1]-1) : Z,2*sizeof(float));
+            memcpy(key+3*mesh->nv,K,3*sizeof(int));
+            hash[h] = ++mesh->nv;
+         }
+         unsigned int vert = hash[h]-1;
+         if (k==0)
+            first = vert;
+         else if (k>=2)
+         {
+            mesh->index[mesh->ni++] = first;
+            mesh->index[mesh->ni++] = last;
+            mesh->index[mesh->ni++] = vert;
+         }
+         last = vert;
+      }
+      mesh->group[mesh->ng-1].count = mesh->ni - mesh->group[mesh->ng-1].first;
+   }
+   //  Drop trailing empty group
+   if (mesh->group[mesh->ng-1].count==0) mesh->ng--;
+   free(hash);
+   free(key);
+   //  Release unused vertexes
+   if (mesh->nv<obj->nc)
+   {
+      mesh->vert = (float*)realloc(mesh->vert,MESH_STRIDE*mesh->nv*sizeof(float)+1);
+      if (!mesh->vert) Fatal("Cannot allocate memory\n");
+   }
+
+   //  Copy the materials used and their texture names to mesh
+   mesh->nm = Nused;
+   mesh->mtl = (Material*)malloc(Nused*sizeof(Material)+1);
+   mesh->tex = (char**)calloc(Nused+1,sizeof(char*));
+   if (!mesh->tex || !mesh->mtl) Fatal("Cannot allocate memory\n");
+   for (int k=0;k<Nused;k++)
+   {
+      LOCK();
+      mtl_t m = mtl[used[k]];
+      const char* tex = m.tex<0 ? NULL : names[m.tex];
+      UNLOCK();
+      mesh->mtl[k] = m.mat;
+      if (tex)
+      {
+         mesh->tex[k] = (char*)malloc(strlen(tex)+1);
+         if (!mesh->tex[k]) Fatal("Cannot allocate memory\n");
+         strcpy(mesh->tex[k],tex);
+      }
+   }
+   return mesh;
+}
+
+//
+//  Binary mesh cache
+//    LoadOBJMesh saves every mesh it builds to file.obj.cache and maps that
+//    file instead of reading the OBJ file while the OBJ file keeps the same
+//    path, size and modification time.  Changes to material files or
+//    textures are not detected, so delete the cache after editing them.
+//
+//    The header is followed by the OBJ path, the vertexes, indexes, groups
+//    and materials.  The map of each material is replaced by the length of
+//    the texture file name that follows it (0 for none).  Strings are NUL
+//    terminated and padded to 8 bytes so every array is aligned.  Each level
+//    of detail follows as a level_t, its groups and its indexes.
+//
+typedef struct
+{
+   char magic[8];       //  CSCIx229
+   int version;         //  CACHE_VERSION
+   int stride;          //  MESH_STRIDE
+   long long size;      //  Size of OBJ file
+   long long mtime;     //  Modification time of OBJ file
+   int nv,ni,ng,nm;     //  Number of vertexes, indexes, groups and materials
+   int nl,levels;       //  Number of levels of detail saved and requested
+   int path;            //  Length of OBJ path
+} cache_t;
+typedef struct
+{
+   int ni;              //  Number of indexes
+   float error;         //  Distance from the full mesh
+} level_t;
+#define CACHE_VERSION 4
+#define PAD(n) (((n)+8)&~7)
+
+//  Use the mesh cache
+static int objcache=1;
+//  Number of levels of detail built for loaded meshes
+static int objlevels=3;
+
+//
+//  Enable or disable the binary mesh cache
+//
+void OBJCache(int on)
+{
+   objcache = on;
+}
+
+//
+//  Set the number of levels of detail built for loaded meshes
+//
+void OBJLevels(int n)
+{
+   objlevels = n;
+}
+
+//
+//  Write padded string
+//
+static void WriteString(const char* str,FILE* f)
+{
+   const char zero[8] = {0};
+   int n = str ? strlen(str) : 0;
+   fwrite(str,1,n,f);
+   fwrite(zero,1,PAD(n)-n,f);
+}
+
+//
+//  Save mesh and its materials to the cache
+//    levels is the number of levels of detail that were requested
+//    Failure only costs the next load a parse, so it is not an error
+//
+static void WriteCache(const char* file,const struct stat* st,const Mesh* mesh,int levels)
+{
+   //  Write to a temporary file so a partial cache is never read
+   char* temp = CacheName(file,".cache.tmp");
+   FILE* f = fopen(temp,"wb");
+   if (!f)
+   {
+      free(temp);
+      return;
+   }
+   cache_t head;
+   memset(&head,0,sizeof(head));
+   memcpy(head.magic,"CSCIx229",8);
+   head.version = CACHE_VERSION;
+   head.stride  = MESH_STRIDE;
+   head.size    = st->st_size;
+   head.mtime   = st->st_mtime;
+   head.nv      = mesh->nv;
+   head.ni      = mesh->ni;
+   head.ng      = mesh->ng;
+   head.nm      = mesh->nm;
+   head.nl      = mesh->nl;
+   head.levels  = levels;
+   head.path    = PAD(strlen(file));
+   fwrite(&head,sizeof(head),1,f);
+   WriteString(file,f);
+   fwrite(mesh->vert,sizeof(float),MESH_STRIDE*mesh->nv,f);
+   fwrite(mesh->index,sizeof(unsigned int),mesh->ni,f);
+   fwrite(mesh->group,sizeof(MeshGroup),mesh->ng,f);
+   for (int k=0;k<mesh->nm;k++)
+   {
+      Material mat = mesh->mtl[k];
+      mat.map = mesh->tex[k] ? PAD(strlen(mesh->tex[k])) : 0;
+      fwrite(&mat,sizeof(mat),1,f);
+      if (mesh->tex[k]) WriteString(mesh->tex[k],f);
+   }
+   for (int l=0;l<mesh->nl;l++)
+   {
+      level_t level = {mesh->lod[l].ni,mesh->lod[l].error};
+      fwrite(&level,sizeof(level),1,f);
+      fwrite(mesh->lod[l].group,sizeof(MeshGroup),mesh->ng,f);
+      fwrite(mesh->lod[l].index,sizeof(unsigned int),mesh->lod[l].ni,f);
+   }
+   //  Replace the old cache
+   char* name = CacheName(file,".cache");
+   int err = ferror(f);
+   if (fclose(f) || err || rename(temp,name))
+   {
+      fprintf(stderr,"Cannot write mesh cache %s\n",name);
+      remove(temp);
+   }
+   free(temp);
+   free(name);
+}
+
+//
+//  Map mesh from the cache
+//    Returns NULL if there is no cache, it does not match the OBJ file or it is corrupt
+//
+static Mesh* ReadCache(const char* file,const struct stat* st,int levels)
+{
+   //  Check the cache exists
+   char* name = CacheName(file,".cache");
+   struct stat cst;
+   int ok = !stat(name,&cst) && cst.st_size>=sizeof(cache_t);
+   size_t len=0;
+   const char* buf = ok ? MapFile(name,&len) : NULL;
+   free(name);
+   if (!buf) return NULL;
+
+   //  Check header
+   const cache_t* head = (const cache_t*)buf;
+   const char* p = buf+sizeof(cache_t);
+   size_t need = sizeof(cache_t) + head->path + MESH_STRIDE*sizeof(float)*(size_t)head->nv + sizeof(unsigned int)*(size_t)head->ni
+               + sizeof(MeshGroup)*(size_t)head->ng + sizeof(Material)*(size_t)head->nm;
+   if (memcmp(head->magic,"CSCIx229",8) || head->version!=CACHE_VERSION || head->stride!=MESH_STRIDE || (levels && head->levels!=levels) ||
+       head->size!=st->st_size || head->mtime!=st->st_mtime || need>len ||
+       head->path!=PAD(strlen(file)) || strcmp(p,file))
+   {
+      UnmapFile(buf,len);
+      return NULL;
+   }
+   p += head->path;
+
+   //  Vertexes and indexes stay in the mapped file
+   Mesh* mesh = (Mesh*)calloc(1,sizeof(Mesh));
+   if (!mesh) Fatal("Cannot allocate mesh\n");
+   mesh->map  = (void*)buf;
+   mesh->size = len;
+   mesh->nv = head->nv;
+   mesh->ni = head->ni;
+   mesh->vert = (float*)p;
+   p += MESH_STRIDE*sizeof(float)*mesh->nv;
+   mesh->index = (unsigned int*)p;
+   p += sizeof(unsigned int)*mesh->ni;
+   //  Copy groups
+   mesh->ng = head->ng;
+   mesh->group = (MeshGroup*)malloc(mesh->ng*sizeof(MeshGroup));
+   if (mesh->ng && !mesh->group) Fatal("Cannot allocate memory\n");
+   memcpy(mesh->group,p,mesh->ng*sizeof(MeshGroup));
+   p += mesh->ng*sizeof(MeshGroup);
+   //  Copy materials and texture names
+   mesh->nm = head->nm;
+   mesh->mtl = (Material*)malloc(mesh->nm*sizeof(Material));
+   mesh->tex = (char**)calloc(mesh->nm+1,sizeof(char*));
+   if (!mesh->tex || (mesh->nm && !mesh->mtl)) Fatal("Cannot allocate memory\n");
+   for (int k=0;k<mesh->nm;k++)
+   {
+      memcpy(mesh->mtl+k,p,sizeof(Material));
+      p += sizeof(Material);
+      int n = mesh->mtl[k].map;
+      mesh->mtl[k].map = 0;
+      //  A corrupt cache is parsed again like a stale one
+      if (n<0 || p+n>buf+len || (n && p[n-1]))
+      {
+         mesh->nm = k+1;
+         FreeMesh(mesh);
+         return NULL;
+      }
+      if (n)
+      {
+         mesh->tex[k] = (char*)malloc(n);
+         if (!mesh->tex[k]) Fatal("Cannot allocate memory\n");
+         memcpy(mesh->tex[k],p,n);
+      }
+      p += n;
+   }
+   //  Indexes of levels of detail stay in the mapped file
+   mesh->lod = (MeshLOD*)calloc(head->nl+1,sizeof(MeshLOD));
+   if (!mesh->lod) Fatal("Cannot allocate memory\n");
+   for (int l=0;l<head->nl;l++)
+   {
+      MeshLOD* lod = mesh->lod+mesh->nl++;
+      const level_t* level = (const level_t*)p;
+      p += sizeof(level_t);
+      if (p>buf+len || level->ni<0 || p+mesh->ng*sizeof(MeshGroup)+level->ni*sizeof(unsigned int)>buf+len)
+      {
+         FreeMesh(mesh);
+         return NULL;
+      }
+      lod->ni = level->ni;
+      lod->error = level->error;
+      lod->group = (MeshGroup*)malloc(mesh->ng*sizeof(MeshGroup)+1);
+      if (!lod->group) Fatal("Cannot allocate memory\n");
+      memcpy(lod->group,p,mesh->ng*sizeof(MeshGroup));
+      p += mesh->ng*sizeof(MeshGroup);
+      lod->index = (unsigned int*)p;
+      p += lod->ni*sizeof(unsigned int);
+   }
+   return mesh;
+}
+
+//
+//  Read OBJ file into a mesh with levels of detail
+//    Uses the binary cache when it matches the OBJ file
+//    A cache with any levels of detail will do if none are wanted
+//    Vertexes stay float for the display list of LoadOBJ
+//
+static Mesh* ReadMesh(const char* file,int levels)
+{
+   struct stat st;
+   if (stat(file,&st)) Fatal("Cannot open file %s\n",file);
+   //  Map the cache if it is current
+   Mesh* mesh = objcache ? ReadCache(file,&st,levels) : NULL;
+   if (mesh) return mesh;
+
+   //  Read OBJ file and save the mesh for next time
+   obj_t obj;
+   ReadOBJ(file,&obj);
+   mesh = BuildMesh(&obj);
+   OptimizeMesh(mesh);
+   SimplifyMesh(mesh,levels);
+   if (objcache) WriteCache(file,&st,mesh,levels);
+   FreeOBJ(&obj);
+   return mesh;
+}
+
+//
+//  Read OBJ file into a mesh without OpenGL
+//    Builds the levels of detail set by OBJLevels
+//    Textures are not loaded (see LoadMeshTextures), so worker threads
+//    can read meshes while the main thread draws
+//
+Mesh* ReadOBJMesh(const char* file)
+{
+   Mesh* mesh = ReadMesh(file,objlevels);
+   if (MeshFormat(-1)==MESH_PACKED) PackMesh(mesh);
+   return mesh;
+}
+
+//
+//  Load the texture of every material of a mesh
+//    Textures are shared with every other mesh using the file
+//
+void LoadMeshTextures(Mesh* mesh)
+{
+   for (int k=0;k<mesh->nm;k++)
+      if (mesh->tex && mesh->tex[k] && !mesh->mtl[k].map)
+         mesh->mtl[k].map = GetTexture(mesh->tex[k]);
+}
+
+//
+//  Load OBJ file into a mesh with its textures
+//
+Mesh* LoadOBJMesh(const char* file)
+{
+   Mesh* mesh = ReadOBJMesh(file);
+   LoadMeshTextures(mesh);
+   return mesh;
+}
+
+//
+//  Load OBJ file
+//    Returns a display list drawing the mesh at full detail
+//    A display list cannot switch levels of detail, so none are built
+//    (draw LoadOBJMesh meshes with DrawMesh to switch levels of detail)
+//
+int LoadOBJ(const char* file)
+{
+   Mesh* mesh = ReadMesh(file,0);
+   LoadMeshTextures(mesh);
+
+   //  Start new displaylist
+   int list = glGenLists(1);
+   glNewList(list,GL_COMPILE);
+   //  Push attributes for textures
+   glPushAttrib(GL_ENABLE_BIT|GL_TEXTURE_BIT);
+   //  Nothing is known about the state when the list is called
+   ResetState();
+
+   //  Draw triangles of each material group
+   for (int k=0;k<mesh->ng;k++)
+   {
+      const MeshGroup* g = mesh->group+k;
+      //  Set material colors and bind texture if specified
+      //  Values already set earlier in the display list are skipped
+      if (g->mtl>=0) UseMaterial(mesh->mtl+g->mtl);
+      glBegin(GL_TRIANGLES);
+      for (int i=g->first;i<g->first+g->count;i++)
+      {
+         const float* v = mesh->vert+MESH_STRIDE*mesh->index[i];
+         glTexCoord2fv(v+6);
+         glNormal3fv(v+3);
+         glVertex3fv(v);
+      }
+      glEnd();
+   }
+   //  Pop attributes (textures)
+   glPopAttrib();
+   glEndList();
+   //  Compiling did not change the current state
+   ResetState();
 
+   //  The display list keeps the textures
+   for (int k=0;k<mesh->nm;k++)
+      mesh->mtl[k].map = 0;
+   FreeMesh(mesh);
    return list;
 }
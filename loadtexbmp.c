@@ -1,100 +1,625 @@
 //  CSCIx229 library
 //  Willem A. (Vlakkies) Schreuder
 #include "CSCIx229.h"
+#include <sys/stat.h>
 
 //
 //  Load texture from BMP file
 //
+//  The file is memory mapped and the pixels are given to OpenGL in place
+//  as GL_BGR (or GL_BGRA), so there is no copy and no byte swapping.
+//  BMP rows are padded to a multiple of 4 bytes, which is what the default
+//  unpack alignment of 4 expects.  24 and 32 bit uncompressed images are
+//  supported, stored bottom up or top down.
+//
+
+//  Mapped BMP image
+typedef struct
+{
+   const unsigned char* map;     //  Whole file
+   size_t len;                   //  File length
+   int dx,dy;                    //  Width and height
+   int bpp;                      //  Bytes per pixel (3 or 4)
+   int stride;                   //  Bytes per row including padding
+   const unsigned char* pixels;  //  Bottom row first
+   unsigned char* flip;          //  Rows of top down images in OpenGL order
+} bmp_t;
 
 //
-//  Reverse n bytes
+//  Little endian numbers at p on any hardware
 //
-static void Reverse(void* x,const int n)
+static unsigned int Get16(const unsigned char* p)
 {
-   char* ch = (char*)x;
-   for (int k=0;k<n/2;k++)
-   {
-      char tmp = ch[k];
-      ch[k] = ch[n-1-k];
-      ch[n-1-k] = tmp;
-   }
+   return p[0] | p[1]<<8;
+}
+static unsigned int Get32(const unsigned char* p)
+{
+   return p[0] | p[1]<<8 | p[2]<<16 | (unsigned int)p[3]<<24;
 }
 
 //
-//  Load texture from BMP file
+//  Map BMP file and check its header
 //
-unsigned int LoadTexBMP(const char* file)
+static void OpenBMP(const char* file,bmp_t* bmp)
 {
-   //  Open file
-   FILE* f = fopen(file,"rb");
-   if (!f) Fatal("Cannot open file %s\n",file);
+   memset(bmp,0,sizeof(bmp_t));
+   const unsigned char* p = bmp->map = MapFile(file,&bmp->len);
    //  Check image magic
-   unsigned short magic;
-   if (fread(&magic,2,1,f)!=1) Fatal("Cannot read magic from %s\n",file);
-   if (magic!=0x4D42 && magic!=0x424D) Fatal("Image magic not BMP in %s\n",file);
+   if (bmp->len<54 || p[0]!='B' || p[1]!='M') Fatal("Image magic not BMP in %s\n",file);
    //  Read header
-   unsigned int dx,dy,off,k; // Image dimensions, offset and compression
-   unsigned short nbp,bpp;   // Planes and bits per pixel
-   if (fseek(f,8,SEEK_CUR) || fread(&off,4,1,f)!=1 ||
-       fseek(f,4,SEEK_CUR) || fread(&dx,4,1,f)!=1 || fread(&dy,4,1,f)!=1 ||
-       fread(&nbp,2,1,f)!=1 || fread(&bpp,2,1,f)!=1 || fread(&k,4,1,f)!=1)
-     Fatal("Cannot read header from %s\n",file);
-   //  Reverse bytes on big endian hardware (detected by backwards magic)
-   if (magic==0x424D)
-   {
-      Reverse(&off,4);
-      Reverse(&dx,4);
-      Reverse(&dy,4);
-      Reverse(&nbp,2);
-      Reverse(&bpp,2);
-      Reverse(&k,4);
-   }
-   //  Check image parameters
-   unsigned int max;
-   glGetIntegerv(GL_MAX_TEXTURE_SIZE,(int*)&max);
+   unsigned int off = Get32(p+10);
+   int dx = (int)Get32(p+18);
+   int dy = (int)Get32(p+22);
+   unsigned int nbp = Get16(p+26);
+   unsigned int bpp = Get16(p+28);
+   unsigned int k = Get32(p+30);
+   //  Check image parameters (OpenGL checks its own limit on upload)
+   const int max = 32768;
    if (dx<1 || dx>max) Fatal("%s image width %d out of range 1-%d\n",file,dx,max);
-   if (dy<1 || dy>max) Fatal("%s image height %d out of range 1-%d\n",file,dy,max);
+   if (dy==0 || abs(dy)>max) Fatal("%s image height %d out of range 1-%d\n",file,abs(dy),max);
    if (nbp!=1)  Fatal("%s bit planes is not 1: %d\n",file,nbp);
-   if (bpp!=24) Fatal("%s bits per pixel is not 24: %d\n",file,bpp);
+   if (bpp!=24 && bpp!=32) Fatal("%s bits per pixel is not 24 or 32: %d\n",file,bpp);
+   //  32 bit images may give the usual masks as bit fields
+   if (k==3 && bpp==32 && Get32(p+54)==0xFF0000 && Get32(p+58)==0xFF00 && Get32(p+62)==0xFF) k = 0;
    if (k!=0)    Fatal("%s compressed files not supported\n",file);
 #ifndef GL_VERSION_2_0
    //  OpenGL 2.0 lifts the restriction that texture size must be a power of two
    for (k=1;k<dx;k*=2);
    if (k!=dx) Fatal("%s image width not a power of two: %d\n",file,dx);
-   for (k=1;k<dy;k*=2);
-   if (k!=dy) Fatal("%s image height not a power of two: %d\n",file,dy);
+   for (k=1;k<abs(dy);k*=2);
+   if (k!=abs(dy)) Fatal("%s image height not a power of two: %d\n",file,abs(dy));
 #endif
+   bmp->dx = dx;
+   bmp->dy = abs(dy);
+   bmp->bpp = bpp/8;
+   //  Rows are padded to 4 bytes
+   bmp->stride = (bmp->bpp*dx+3)&~3;
+   if (off>bmp->len || (size_t)bmp->stride*bmp->dy>bmp->len-off) Fatal("Error reading data from image %s\n",file);
+   bmp->pixels = p+off;
+   //  Negative height is stored top down
+   if (dy<0)
+   {
+      bmp->flip = (unsigned char*)malloc((size_t)bmp->stride*bmp->dy);
+      if (!bmp->flip) Fatal("Cannot allocate %d bytes of memory for image %s\n",bmp->stride*bmp->dy,file);
+      for (int j=0;j<bmp->dy;j++)
+         memcpy(bmp->flip+(size_t)j*bmp->stride,p+off+(size_t)(bmp->dy-1-j)*bmp->stride,bmp->stride);
+      bmp->pixels = bmp->flip;
+   }
+}
+
+//
+//  Release BMP file
+//
+static void CloseBMP(bmp_t* bmp)
+{
+   free(bmp->flip);
+   UnmapFile(bmp->map,bmp->len);
+}
+
 
-   //  Allocate image memory
-   unsigned int size = 3*dx*dy;
-   unsigned char* image = (unsigned char*) malloc(size);
-   if (!image) Fatal("Cannot allocate %d bytes of memory for image %s\n",size,file);
-   //  Seek to and read image
-   if (fseek(f,off,SEEK_SET) || fread(image,size,1,f)!=1) Fatal("Error reading data from image %s\n",file);
-   fclose(f);
-   //  Reverse colors (BGR -> RGB)
-   for (k=0;k<size;k+=3)
+//
+//  Mipmaps and compression
+//    Textures get a full mip chain down to 1x1.  With TEX_RGB level 0 is
+//    uploaded from the mapped BMP file and OpenGL builds the rest with
+//    glGenerateMipmap.  With TEX_BC1 each level averages 2x2 texels of the
+//    one above and is compressed in software to S3TC, BC1 (DXT1) for RGB
+//    images and BC3 (DXT5) for images with alpha, a sixth and a quarter of
+//    the size of RGB and RGBA texels.
+//
+//  Texture cache
+//    Compressed levels are saved to file.bmp.cache and later loads upload
+//    them straight from the mapped cache while the BMP file keeps the same
+//    path, size and modification time and the mode is the same.  The header
+//    is followed by the BMP path (NUL terminated and padded to 8 bytes) and
+//    the levels from the largest down, each padded to 8 bytes.  TEX_RGB
+//    textures are not cached since the BMP file is as fast to upload.
+//
+typedef struct
+{
+   char magic[8];       //  CSCIxTEX
+   int version;         //  TEX_VERSION
+   int mode;            //  TEX_RGB or TEX_BC1
+   long long size;      //  Size of BMP file
+   long long mtime;     //  Modification time of BMP file
+   int bpp;             //  Bytes per pixel of the image
+   int dx,dy;           //  Size of the largest level
+   int levels;          //  Number of levels
+   int path;            //  Length of BMP path
+   int pad;
+} texcache_t;
+#define TEX_VERSION 1
+#define PAD(n) (((n)+8)&~7)
+#define ALIGN(n) (((n)+7)&~7)
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+//  Compress textures
+static int texmode=TEX_RGB;
+//  Use the texture cache
+static int texcache=1;
+
+//
+//  Check for S3TC
+//
+static int S3TC(void)
+{
+   static int s3tc=-1;
+   if (s3tc<0)
    {
-      unsigned char temp = image[k];
-      image[k]   = image[k+2];
-      image[k+2] = temp;
+      const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+      if (ext) s3tc = strstr(ext,"GL_EXT_texture_compression_s3tc")!=NULL;
    }
+   return s3tc>0;
+}
 
-   //  Sanity check
-   ErrCheck("LoadTexBMP");
-   //  Generate 2D texture
+//
+//  Set texture compression
+//    TEX_RGB keeps texels as they are, TEX_BC1 compresses to S3TC
+//    Returns the mode (-1 only queries the mode used, which is TEX_RGB
+//    without S3TC, so query from the OpenGL thread)
+//
+int TexMode(int mode)
+{
+   if (mode>=0)
+      texmode = mode;
+   else if (texmode==TEX_BC1 && !S3TC())
+      return TEX_RGB;
+   return texmode;
+}
+
+//
+//  Enable or disable the texture cache
+//
+void TexCache(int on)
+{
+   texcache = on;
+}
+
+//
+//  Bytes in a level
+//
+static int LevelSize(int bpp,int compressed,int w,int h)
+{
+   if (compressed)
+      return ((w+3)/4)*((h+3)/4)*(bpp==4 ? 16 : 8);
+   else
+      return ((bpp*w+3)&~3)*h;
+}
+
+//
+//  Next smaller level
+//    Averages 2x2 texels (the last row or column of odd sizes is dropped)
+//
+static unsigned char* HalfLevel(const unsigned char* src,int bpp,int* w,int* h)
+{
+   int W = *w>1 ? *w/2 : 1;
+   int H = *h>1 ? *h/2 : 1;
+   int ss = (bpp**w+3)&~3;
+   int ds = (bpp*W+3)&~3;
+   unsigned char* dst = (unsigned char*)malloc((size_t)ds*H);
+   if (!dst) Fatal("Cannot allocate %dx%d mipmap\n",W,H);
+   for (int j=0;j<H;j++)
+   {
+      const unsigned char* r0 = src+(size_t)(2*j<*h ? 2*j : *h-1)*ss;
+      const unsigned char* r1 = src+(size_t)(2*j+1<*h ? 2*j+1 : *h-1)*ss;
+      unsigned char* d = dst+(size_t)j*ds;
+      for (int i=0;i<W;i++)
+      {
+         int x0 = bpp*(2*i<*w ? 2*i : *w-1);
+         int x1 = bpp*(2*i+1<*w ? 2*i+1 : *w-1);
+         for (int c=0;c<bpp;c++)
+            d[bpp*i+c] = (r0[x0+c]+r0[x1+c]+r1[x0+c]+r1[x1+c]+2)/4;
+      }
+   }
+   *w = W;
+   *h = H;
+   return dst;
+}
+
+//
+//  Color to and from 5:6:5 bits
+//
+static unsigned short RGB565(const unsigned char* c)
+{
+   return ((c[0]*31+127)/255)<<11 | ((c[1]*63+127)/255)<<5 | (c[2]*31+127)/255;
+}
+static void Expand565(unsigned short v,int* c)
+{
+   int r=v>>11,g=(v>>5)&63,b=v&31;
+   c[0] = (r<<3)|(r>>2);
+   c[1] = (g<<2)|(g>>4);
+   c[2] = (b<<3)|(b>>2);
+}
+
+//
+//  Compress colors of 4x4 RGBA texels to a BC1 block
+//    The end points are the texels furthest apart along the principal axis
+//    of the colors, with two colors between them
+//
+static void EncodeColor(const unsigned char* block,unsigned char* out)
+{
+   //  Mean and covariance of the colors
+   float m[3]={0,0,0},c[6]={0,0,0,0,0,0};
+   for (int k=0;k<16;k++)
+      for (int i=0;i<3;i++)
+         m[i] += block[4*k+i]/16.0;
+   for (int k=0;k<16;k++)
+   {
+      float r=block[4*k]-m[0],g=block[4*k+1]-m[1],b=block[4*k+2]-m[2];
+      c[0] += r*r; c[1] += r*g; c[2] += r*b;
+      c[3] += g*g; c[4] += g*b; c[5] += b*b;
+   }
+   //  Principal axis by power iteration
+   float v[3]={1,1,1};
+   for (int it=0;it<4;it++)
+   {
+      float x = c[0]*v[0]+c[1]*v[1]+c[2]*v[2];
+      float y = c[1]*v[0]+c[3]*v[1]+c[4]*v[2];
+      float z = c[2]*v[0]+c[4]*v[1]+c[5]*v[2];
+      float l = fmax(fabs(x),fmax(fabs(y),fabs(z)));
+      if (l<1e-6) break;
+      v[0] = x/l; v[1] = y/l; v[2] = z/l;
+   }
+   //  Texels at either end of the axis
+   int lo=0,hi=0;
+   float dlo=1e30,dhi=-1e30;
+   for (int k=0;k<16;k++)
+   {
+      float d = block[4*k]*v[0]+block[4*k+1]*v[1]+block[4*k+2]*v[2];
+      if (d<dlo) {dlo = d; lo = k;}
+      if (d>dhi) {dhi = d; hi = k;}
+   }
+   //  The larger end point first selects four colors
+   unsigned short c0=RGB565(block+4*hi),c1=RGB565(block+4*lo);
+   if (c0<c1)
+   {
+      unsigned short t = c0;
+      c0 = c1;
+      c1 = t;
+   }
+   int pal[4][3];
+   Expand565(c0,pal[0]);
+   Expand565(c1,pal[1]);
+   for (int i=0;i<3;i++)
+   {
+      pal[2][i] = (2*pal[0][i]+pal[1][i])/3;
+      pal[3][i] = (pal[0][i]+2*pal[1][i])/3;
+   }
+   //  Nearest color of each texel
+   unsigned int bits=0;
+   if (c0!=c1)
+      for (int k=0;k<16;k++)
+      {
+         int best=0,dmin=1<<30;
+         for (int j=0;j<4;j++)
+         {
+            int dr=block[4*k]-pal[j][0],dg=block[4*k+1]-pal[j][1],db=block[4*k+2]-pal[j][2];
+            int d = dr*dr+dg*dg+db*db;
+            if (d<dmin) {dmin = d; best = j;}
+         }
+         bits |= best<<(2*k);
+      }
+   out[0] = c0; out[1] = c0>>8;
+   out[2] = c1; out[3] = c1>>8;
+   for (int i=0;i<4;i++)
+      out[4+i] = bits>>(8*i);
+}
+
+//
+//  Compress alpha of 4x4 RGBA texels to a BC3 alpha block
+//    The end points are the largest and smallest alpha with six between
+//
+static void EncodeAlpha(const unsigned char* block,unsigned char* out)
+{
+   int a0=0,a1=255;
+   for (int k=0;k<16;k++)
+   {
+      if (block[4*k+3]>a0) a0 = block[4*k+3];
+      if (block[4*k+3]<a1) a1 = block[4*k+3];
+   }
+   unsigned long long bits=0;
+   if (a0>a1)
+   {
+      int pal[8] = {a0,a1};
+      for (int i=1;i<7;i++)
+         pal[i+1] = ((7-i)*a0+i*a1)/7;
+      for (int k=0;k<16;k++)
+      {
+         int best=0,dmin=256;
+         for (int j=0;j<8;j++)
+         {
+            int d = abs(block[4*k+3]-pal[j]);
+            if (d<dmin) {dmin = d; best = j;}
+         }
+         bits |= (unsigned long long)best<<(3*k);
+      }
+   }
+   out[0] = a0;
+   out[1] = a1;
+   for (int i=0;i<6;i++)
+      out[2+i] = bits>>(8*i);
+}
+
+//
+//  Compress a level of BGR(A) rows to S3TC blocks
+//    Blocks past the edge repeat the last row and column
+//
+static void CompressLevel(const unsigned char* src,int bpp,int w,int h,unsigned char* out)
+{
+   int stride = (bpp*w+3)&~3;
+   unsigned char block[64];
+   for (int y=0;y<h;y+=4)
+      for (int x=0;x<w;x+=4)
+      {
+         //  RGBA texels of the block
+         for (int j=0;j<4;j++)
+            for (int i=0;i<4;i++)
+            {
+               const unsigned char* p = src+(size_t)(y+j<h ? y+j : h-1)*stride+bpp*(x+i<w ? x+i : w-1);
+               unsigned char* q = block+4*(4*j+i);
+               q[0] = p[2];
+               q[1] = p[1];
+               q[2] = p[0];
+               q[3] = bpp==4 ? p[3] : 255;
+            }
+         if (bpp==4)
+         {
+            EncodeAlpha(block,out);
+            out += 8;
+         }
+         EncodeColor(block,out);
+         out += 8;
+      }
+}
+
+//
+//  Set the OpenGL formats of the levels
+//
+static void SetFormat(TexImage* tex)
+{
+   if (tex->compressed)
+   {
+      tex->format = tex->bpp==4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+      tex->pixels = 0;
+   }
+   else
+   {
+      tex->format = tex->bpp==4 ? GL_RGBA8 : GL_RGB8;
+      tex->pixels = tex->bpp==4 ? GL_BGRA : GL_BGR;
+   }
+}
+
+//
+//  Build the levels of an image
+//    Uncompressed images keep the BMP file as level 0 and OpenGL builds
+//    the other levels
+//
+static TexImage* BuildLevels(bmp_t* bmp,int compressed)
+{
+   TexImage* tex = (TexImage*)calloc(1,sizeof(TexImage));
+   if (!tex) Fatal("Cannot allocate memory\n");
+   tex->bpp = bmp->bpp;
+   tex->compressed = compressed;
+   SetFormat(tex);
+   if (!compressed)
+   {
+      tex->n = 1;
+      tex->w[0] = bmp->dx;
+      tex->h[0] = bmp->dy;
+      tex->size[0] = LevelSize(tex->bpp,0,bmp->dx,bmp->dy);
+      tex->data[0] = bmp->pixels;
+      tex->generate = 1;
+      tex->map = bmp->map;
+      tex->len = bmp->len;
+      tex->flip = bmp->flip;
+      return tex;
+   }
+   int w=bmp->dx,h=bmp->dy;
+   //  Current level when it is not the BMP file
+   const unsigned char* src = bmp->pixels;
+   unsigned char* img = NULL;
+   for (;;)
+   {
+      int k = tex->n++;
+      tex->w[k] = w;
+      tex->h[k] = h;
+      tex->size[k] = LevelSize(tex->bpp,1,w,h);
+      tex->buf[k] = (unsigned char*)malloc(tex->size[k]);
+      if (!tex->buf[k]) Fatal("Cannot allocate %d bytes of compressed texture\n",tex->size[k]);
+      CompressLevel(src,tex->bpp,w,h,tex->buf[k]);
+      tex->data[k] = tex->buf[k];
+      if ((w==1 && h==1) || tex->n==TEX_LEVELS) break;
+      unsigned char* next = HalfLevel(src,tex->bpp,&w,&h);
+      free(img);
+      src = img = next;
+   }
+   free(img);
+   CloseBMP(bmp);
+   return tex;
+}
+
+//
+//  Free levels and the file they are in
+//
+void FreeTexImage(TexImage* tex)
+{
+   if (!tex) return;
+   for (int k=0;k<tex->n;k++)
+      free(tex->buf[k]);
+   free(tex->flip);
+   if (tex->map) UnmapFile(tex->map,tex->len);
+   free(tex);
+}
+
+//
+//  Make a texture of the levels
+//
+unsigned int UploadTexImage(const TexImage* tex)
+{
+   int max;
+   glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max);
+   if (tex->w[0]>max || tex->h[0]>max) Fatal("%dx%d texture is larger than %d\n",tex->w[0],tex->h[0],max);
    unsigned int texture;
    glGenTextures(1,&texture);
    glBindTexture(GL_TEXTURE_2D,texture);
-   //  Copy image
-   glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,dx,dy,0,GL_RGB,GL_UNSIGNED_BYTE,image);
-   if (glGetError()) Fatal("Error in glTexImage2D %s %dx%d\n",file,dx,dy);
-   //  Scale linearly when image size doesn't match
+   //  Rows are padded to 4 bytes
+   glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+   glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+   glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+   for (int k=0;k<tex->n;k++)
+   {
+      if (tex->compressed)
+         glCompressedTexImage2D(GL_TEXTURE_2D,k,tex->format,tex->w[k],tex->h[k],0,tex->size[k],tex->data[k]);
+      else
+         glTexImage2D(GL_TEXTURE_2D,k,tex->format,tex->w[k],tex->h[k],0,tex->pixels,GL_UNSIGNED_BYTE,tex->data[k]);
+   }
+   glPopClientAttrib();
+   if (tex->generate) glGenerateMipmap(GL_TEXTURE_2D);
+   if (glGetError()) Fatal("Error in glTexImage2D %dx%d\n",tex->w[0],tex->h[0]);
+   //  Blend the two nearest levels when minified
    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,(tex->n>1 || tex->generate) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+   return texture;
+}
+
+//
+//  Save levels to the cache
+//    Failure only costs the next load the mipmaps, so it is not an error
+//
+static void WriteCache(const char* file,const struct stat* st,int mode,const TexImage* tex)
+{
+   //  Write to a temporary file so a partial cache is never read
+   char* temp = CacheName(file,".cache.tmp");
+   FILE* f = fopen(temp,"wb");
+   if (!f)
+   {
+      free(temp);
+      return;
+   }
+   texcache_t head;
+   memset(&head,0,sizeof(head));
+   memcpy(head.magic,"CSCIxTEX",8);
+   head.version = TEX_VERSION;
+   head.mode    = mode;
+   head.size    = st->st_size;
+   head.mtime   = st->st_mtime;
+   head.bpp     = tex->bpp;
+   head.dx      = tex->w[0];
+   head.dy      = tex->h[0];
+   head.levels  = tex->n;
+   head.path    = PAD(strlen(file));
+   fwrite(&head,sizeof(head),1,f);
+   const char zero[8] = {0};
+   fwrite(file,1,strlen(file),f);
+   fwrite(zero,1,head.path-strlen(file),f);
+   for (int k=0;k<tex->n;k++)
+   {
+      fwrite(tex->data[k],1,tex->size[k],f);
+      fwrite(zero,1,ALIGN(tex->size[k])-tex->size[k],f);
+   }
+   //  Replace the old cache
+   char* name = CacheName(file,".cache");
+   int err = ferror(f);
+   if (fclose(f) || err || rename(temp,name))
+   {
+      fprintf(stderr,"Cannot write texture cache %s\n",name);
+      remove(temp);
+   }
+   free(temp);
+   free(name);
+}
+
+//
+//  Map levels from the cache
+//    Returns NULL if there is no cache or it does not match the BMP file
+//
+static TexImage* ReadCache(const char* file,const struct stat* st,int mode)
+{
+   //  Check the cache exists
+   char* name = CacheName(file,".cache");
+   struct stat cst;
+   int ok = !stat(name,&cst) && cst.st_size>=sizeof(texcache_t);
+   size_t len;
+   const unsigned char* buf = ok ? MapFile(name,&len) : NULL;
+   free(name);
+   if (!buf) return NULL;
 
-   //  Free image memory
-   free(image);
+   //  Check header
+   const texcache_t* head = (const texcache_t*)buf;
+   if (memcmp(head->magic,"CSCIxTEX",8) || head->version!=TEX_VERSION || head->mode!=mode ||
+       head->size!=st->st_size || head->mtime!=st->st_mtime || (head->bpp!=3 && head->bpp!=4) ||
+       head->dx<1 || head->dy<1 || head->levels<1 || head->levels>TEX_LEVELS ||
+       head->path!=PAD(strlen(file)) || sizeof(texcache_t)+head->path>len || strcmp((const char*)(head+1),file))
+   {
+      UnmapFile(buf,len);
+      return NULL;
+   }
+   //  Levels stay in the mapped file
+   TexImage* tex = (TexImage*)calloc(1,sizeof(TexImage));
+   if (!tex) Fatal("Cannot allocate memory\n");
+   tex->map = buf;
+   tex->len = len;
+   tex->bpp = head->bpp;
+   tex->compressed = mode==TEX_BC1;
+   SetFormat(tex);
+   tex->n = head->levels;
+   size_t off = sizeof(texcache_t)+head->path;
+   int w=head->dx,h=head->dy;
+   for (int k=0;k<tex->n;k++)
+   {
+      tex->w[k] = w;
+      tex->h[k] = h;
+      tex->size[k] = LevelSize(tex->bpp,tex->compressed,w,h);
+      //  Rebuild the levels of a truncated cache
+      if (off+tex->size[k]>len)
+      {
+         FreeTexImage(tex);
+         return NULL;
+      }
+      tex->data[k] = buf+off;
+      off += ALIGN(tex->size[k]);
+      if (w>1) w /= 2;
+      if (h>1) h /= 2;
+   }
+   return tex;
+}
+
+//
+//  Read the levels of a BMP file without OpenGL
+//    mode is TEX_RGB or TEX_BC1 (from TexMode(-1) on the OpenGL thread)
+//    Compressed levels come from the texture cache when it matches the BMP file
+//
+TexImage* ReadTexBMP(const char* file,int mode)
+{
+   struct stat st;
+   if (stat(file,&st)) Fatal("Cannot open file %s\n",file);
+   int cache = texcache && mode==TEX_BC1;
+   //  Map the cache if it is current
+   TexImage* tex = cache ? ReadCache(file,&st,mode) : NULL;
+   if (tex) return tex;
+
+   //  Build the levels and save them for next time
+   bmp_t bmp;
+   OpenBMP(file,&bmp);
+   tex = BuildLevels(&bmp,mode==TEX_BC1);
+   if (cache) WriteCache(file,&st,mode,tex);
+   return tex;
+}
+
+//
+//  Load texture from BMP file
+//
+unsigned int LoadTexBMP(const char* file)
+{
+   //  Sanity check
+   ErrCheck("LoadTexBMP");
+   //  Compress if the driver can
+   TexImage* tex = ReadTexBMP(file,TexMode(-1));
+   unsigned int texture = UploadTexImage(tex);
+   //  Release file
+   FreeTexImage(tex);
    //  Return texture name
    return texture;
 }
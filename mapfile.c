@@ -0,0 +1,87 @@
+//  CSCIx239 library
+//  Willem A. (Vlakkies) Schreuder
+#include "CSCIx229.h"
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+//
+//  Map whole file into memory
+//    Returns pointer to the contents and sets the length
+//    The mapping is private and writable so caches can be changed in memory
+//
+const void* MapFile(const char* file,size_t* len)
+{
+#ifdef _WIN32
+   //  No mmap, so read the whole file
+   FILE* f = fopen(file,"rb");
+   if (!f) Fatal("Cannot open file %s\n",file);
+   fseek(f,0,SEEK_END);
+   *len = ftell(f);
+   rewind(f);
+   char* buf = (char*)malloc(*len+1);
+   if (!buf)
+   {
+      fclose(f);
+      Fatal("Cannot allocate %lu bytes for %s\n",(unsigned long)*len,file);
+   }
+   if (*len && fread(buf,*len,1,f)!=1)
+   {
+      fclose(f);
+      free(buf);
+      Fatal("Cannot read %s\n",file);
+   }
+   fclose(f);
+   return buf;
+#else
+   int fd = open(file,O_RDONLY);
+   if (fd<0) Fatal("Cannot open file %s\n",file);
+   //  Close the file before Fatal since it may be caught
+   struct stat st;
+   if (fstat(fd,&st))
+   {
+      close(fd);
+      Fatal("Cannot stat file %s\n",file);
+   }
+   *len = st.st_size;
+   //  Zero length mappings are not allowed
+   if (*len==0)
+   {
+      close(fd);
+      return "";
+   }
+   void* buf = mmap(NULL,*len,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+   //  The mapping keeps the file open
+   close(fd);
+   if (buf==MAP_FAILED) Fatal("Cannot map file %s\n",file);
+   madvise(buf,*len,MADV_SEQUENTIAL);
+   return buf;
+#endif
+}
+
+//
+//  Release file mapped by MapFile
+//
+void UnmapFile(const void* buf,size_t len)
+{
+#ifdef _WIN32
+   free((void*)buf);
+#else
+   if (len) munmap((void*)buf,len);
+#endif
+}
+
+//
+//  Name of cache file next to a file
+//
+char* CacheName(const char* file,const char* ext)
+{
+   char* name = (char*)malloc(strlen(file)+strlen(ext)+1);
+   if (!name) Fatal("Cannot allocate memory\n");
+   strcpy(name,file);
+   strcat(name,ext);
+   return name;
+}
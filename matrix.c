@@ -0,0 +1,109 @@
+//  CSCIx229 library
+//  4x4 matrix operations
+#include "CSCIx229.h"
+
+//
+//  Matrixes are stored column major like OpenGL and transformations are
+//  post-multiplied, so the sequence
+//     MatIdentity(m); MatTranslate(m,...); MatRotate(m,...);
+//  builds the same matrix as glLoadIdentity(); glTranslate(); glRotate();
+//
+
+//
+//  Set identity matrix
+//
+void MatIdentity(float m[16])
+{
+   for (int k=0;k<16;k++)
+      m[k] = (k%5==0);
+}
+
+//
+//  Multiply matrixes m = a*b
+//    m may be the same as a or b
+//
+void MatMultiply(float m[16],const float a[16],const float b[16])
+{
+   float r[16];
+   for (int i=0;i<4;i++)
+      for (int j=0;j<4;j++)
+         r[4*j+i] = a[i]*b[4*j] + a[4+i]*b[4*j+1] + a[8+i]*b[4*j+2] + a[12+i]*b[4*j+3];
+   memcpy(m,r,sizeof(r));
+}
+
+//
+//  Translate matrix (like glTranslate)
+//
+void MatTranslate(float m[16],float x,float y,float z)
+{
+   for (int i=0;i<4;i++)
+      m[12+i] += m[i]*x + m[4+i]*y + m[8+i]*z;
+}
+
+//
+//  Rotate matrix th degrees about (x,y,z) (like glRotate)
+//
+void MatRotate(float m[16],float th,float x,float y,float z)
+{
+   //  Normalize axis
+   float l = sqrt(x*x+y*y+z*z);
+   if (l==0) return;
+   x /= l; y /= l; z /= l;
+   //  Rotation matrix
+   float c = Cos(th);
+   float s = Sin(th);
+   float C = 1-c;
+   float R[16] =
+   {
+      x*x*C+c   , y*x*C+z*s , z*x*C-y*s , 0,
+      x*y*C-z*s , y*y*C+c   , z*y*C+x*s , 0,
+      x*z*C+y*s , y*z*C-x*s , z*z*C+c   , 0,
+      0         , 0         , 0         , 1,
+   };
+   MatMultiply(m,m,R);
+}
+
+//
+//  Scale matrix (like glScale)
+//
+void MatScale(float m[16],float x,float y,float z)
+{
+   for (int i=0;i<4;i++)
+   {
+      m[i]   *= x;
+      m[4+i] *= y;
+      m[8+i] *= z;
+   }
+}
+
+//
+//  Invert matrix m = a^-1
+//    m may be the same as a
+//    Returns 0 if a is singular (m is then unchanged)
+//
+int MatInverse(float m[16],const float a[16])
+{
+   //  Cofactors of the first row give the determinant
+   float r[16];
+   r[0]  =  a[5]*a[10]*a[15] - a[5]*a[11]*a[14] - a[9]*a[6]*a[15] + a[9]*a[7]*a[14] + a[13]*a[6]*a[11] - a[13]*a[7]*a[10];
+   r[4]  = -a[4]*a[10]*a[15] + a[4]*a[11]*a[14] + a[8]*a[6]*a[15] - a[8]*a[7]*a[14] - a[12]*a[6]*a[11] + a[12]*a[7]*a[10];
+   r[8]  =  a[4]*a[9]*a[15]  - a[4]*a[11]*a[13] - a[8]*a[5]*a[15] + a[8]*a[7]*a[13] + a[12]*a[5]*a[11] - a[12]*a[7]*a[9];
+   r[12] = -a[4]*a[9]*a[14]  + a[4]*a[10]*a[13] + a[8]*a[5]*a[14] - a[8]*a[6]*a[13] - a[12]*a[5]*a[10] + a[12]*a[6]*a[9];
+   r[1]  = -a[1]*a[10]*a[15] + a[1]*a[11]*a[14] + a[9]*a[2]*a[15] - a[9]*a[3]*a[14] - a[13]*a[2]*a[11] + a[13]*a[3]*a[10];
+   r[5]  =  a[0]*a[10]*a[15] - a[0]*a[11]*a[14] - a[8]*a[2]*a[15] + a[8]*a[3]*a[14] + a[12]*a[2]*a[11] - a[12]*a[3]*a[10];
+   r[9]  = -a[0]*a[9]*a[15]  + a[0]*a[11]*a[13] + a[8]*a[1]*a[15] - a[8]*a[3]*a[13] - a[12]*a[1]*a[11] + a[12]*a[3]*a[9];
+   r[13] =  a[0]*a[9]*a[14]  - a[0]*a[10]*a[13] - a[8]*a[1]*a[14] + a[8]*a[2]*a[13] + a[12]*a[1]*a[10] - a[12]*a[2]*a[9];
+   r[2]  =  a[1]*a[6]*a[15]  - a[1]*a[7]*a[14]  - a[5]*a[2]*a[15] + a[5]*a[3]*a[14] + a[13]*a[2]*a[7]  - a[13]*a[3]*a[6];
+   r[6]  = -a[0]*a[6]*a[15]  + a[0]*a[7]*a[14]  + a[4]*a[2]*a[15] - a[4]*a[3]*a[14] - a[12]*a[2]*a[7]  + a[12]*a[3]*a[6];
+   r[10] =  a[0]*a[5]*a[15]  - a[0]*a[7]*a[13]  - a[4]*a[1]*a[15] + a[4]*a[3]*a[13] + a[12]*a[1]*a[7]  - a[12]*a[3]*a[5];
+   r[14] = -a[0]*a[5]*a[14]  + a[0]*a[6]*a[13]  + a[4]*a[1]*a[14] - a[4]*a[2]*a[13] - a[12]*a[1]*a[6]  + a[12]*a[2]*a[5];
+   r[3]  = -a[1]*a[6]*a[11]  + a[1]*a[7]*a[10]  + a[5]*a[2]*a[11] - a[5]*a[3]*a[10] - a[9]*a[2]*a[7]   + a[9]*a[3]*a[6];
+   r[7]  =  a[0]*a[6]*a[11]  - a[0]*a[7]*a[10]  - a[4]*a[2]*a[11] + a[4]*a[3]*a[10] + a[8]*a[2]*a[7]   - a[8]*a[3]*a[6];
+   r[11] = -a[0]*a[5]*a[11]  + a[0]*a[7]*a[9]   + a[4]*a[1]*a[11] - a[4]*a[3]*a[9]  - a[8]*a[1]*a[7]   + a[8]*a[3]*a[5];
+   r[15] =  a[0]*a[5]*a[10]  - a[0]*a[6]*a[9]   - a[4]*a[1]*a[10] + a[4]*a[2]*a[9]  + a[8]*a[1]*a[6]   - a[8]*a[2]*a[5];
+   float det = a[0]*r[0] + a[1]*r[4] + a[2]*r[8] + a[3]*r[12];
+   if (det==0) return 0;
+   for (int k=0;k<16;k++)
+      m[k] = r[k]/det;
+   return 1;
+}
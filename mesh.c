@@ -0,0 +1,329 @@
+//  CSCIx229 library
+//  Triangle meshes with interleaved vertex data
+#include "CSCIx229.h"
+#include <stddef.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+//  How meshes are sent to OpenGL
+static int mode=MESH_VBO;
+//  Vertex format of new meshes
+static int format=MESH_FLOAT;
+
+//
+//  Select immediate mode, vertex arrays or buffer objects
+//
+void MeshMode(int m)
+{
+   mode = m;
+}
+
+//
+//  Select float or packed vertexes for meshes built from now on
+//    Returns the format in use (pass -1 to only query it)
+//
+int MeshFormat(int f)
+{
+   if (f>=0) format = f;
+   return format;
+}
+
+//
+//  Float to half float rounded to nearest even
+//
+static unsigned short Half(float f)
+{
+   union {float f;unsigned int u;} v = {f};
+   unsigned int sign = (v.u>>16)&0x8000;
+   int e = (int)((v.u>>23)&0xFF)-127+15;
+   unsigned int m = (v.u&0x7FFFFF)|0x800000;
+   //  Too large, infinity or NaN
+   if (e>=31) return sign | 0x7C00 | ((v.u&0x7FFFFF) && ((v.u>>23)&0xFF)==0xFF ? 0x200 : 0);
+   //  Too small for a denormal
+   if (e<-10) return sign;
+   //  Drop mantissa bits, the carry may round up into the exponent
+   int shift = e>0 ? 13 : 14-e;
+   unsigned int h = (e>0 ? (unsigned int)e<<10 : 0) | ((m&(e>0 ? 0x7FFFFF : 0xFFFFFF))>>shift);
+   unsigned int rem = m&((1u<<shift)-1);
+   unsigned int half = 1u<<(shift-1);
+   if (rem>half || (rem==half && (h&1))) h++;
+   return sign|h;
+}
+
+//
+//  Unit normal to signed bytes
+//    OpenGL maps -127 to 127 back to -1 to 1
+//
+static void PackNormal(signed char p[4],const float* n)
+{
+   for (int i=0;i<3;i++)
+   {
+      float x = n[i]<-1 ? -1 : n[i]>1 ? 1 : n[i];
+      p[i] = lrintf(127*x);
+   }
+   p[3] = 0;
+}
+
+//
+//  Make the packed copy of the vertexes drawn instead of the floats
+//    Positions stay float, normals are bytes and texture coordinates
+//    are half floats, so a vertex is 20 bytes rather than 32.  Vertex
+//    arrays and buffer objects only draw the packed copy, so the floats
+//    are freed and the mesh takes 20 bytes a vertex in memory too.
+//    Immediate mode keeps the floats (choose MeshMode before packing) and
+//    floats in a mapped cache file stay with the mapping.  Simplify meshes
+//    before packing them, since that needs the float vertexes.
+//    Call again after changing the float vertexes.
+//
+void PackMesh(Mesh* mesh)
+{
+   //  Floats already dropped
+   if (!mesh->vert) return;
+   mesh->packed = (PackedVertex*)realloc(mesh->packed,(mesh->nv+1)*sizeof(PackedVertex));
+   if (!mesh->packed) Fatal("Cannot allocate %d packed vertexes\n",mesh->nv);
+   for (int k=0;k<mesh->nv;k++)
+   {
+      const float* v = mesh->vert+MESH_STRIDE*k;
+      PackedVertex* p = mesh->packed+k;
+      p->x = v[0];
+      p->y = v[1];
+      p->z = v[2];
+      PackNormal(p->n,v+3);
+      p->s = Half(v[6]);
+      p->t = Half(v[7]);
+   }
+   if (mode!=MESH_IMMEDIATE && !mesh->map)
+   {
+      free(mesh->vert);
+      mesh->vert = NULL;
+   }
+   //  Upload again on the next draw
+   if (mesh->vbo) glDeleteBuffers(1,&mesh->vbo);
+   mesh->vbo = 0;
+}
+
+//
+//  Allocate a mesh with room for nv vertexes and ni indexes
+//
+Mesh* NewMesh(int nv,int ni)
+{
+   Mesh* mesh = (Mesh*)calloc(1,sizeof(Mesh));
+   if (!mesh) Fatal("Cannot allocate mesh\n");
+   mesh->nv = nv;
+   mesh->ni = ni;
+   mesh->vert  = (float*)malloc(MESH_STRIDE*nv*sizeof(float));
+   mesh->index = (unsigned int*)malloc(ni*sizeof(unsigned int));
+   if (!mesh->vert || !mesh->index) Fatal("Cannot allocate mesh with %d vertexes and %d indexes\n",nv,ni);
+   return mesh;
+}
+
+//
+//  Free mesh memory and buffer objects
+//
+void FreeMesh(Mesh* mesh)
+{
+   if (!mesh) return;
+   if (mesh->vbo) glDeleteBuffers(1,&mesh->vbo);
+   if (mesh->ibo) glDeleteBuffers(1,&mesh->ibo);
+   FreeMeshLOD(mesh);
+   //  Arrays in a mapped cache file go with the mapping
+   if (mesh->map)
+#ifdef _WIN32
+      free(mesh->map);
+#else
+      munmap(mesh->map,mesh->size);
+#endif
+   else
+   {
+      free(mesh->vert);
+      free(mesh->index);
+   }
+   free(mesh->packed);
+   free(mesh->group);
+   //  Textures are shared with other meshes
+   //  Meshes freed on loader threads have none, and the cache is not locked
+   for (int k=0;k<mesh->nm;k++)
+   {
+      if (mesh->mtl[k].map) ReleaseTexture(mesh->mtl[k].map);
+      if (mesh->tex) free(mesh->tex[k]);
+   }
+   free(mesh->tex);
+   free(mesh->mtl);
+   free(mesh);
+}
+
+//
+//  Copy indexes to an index buffer object
+//
+static void UploadIndexes(unsigned int* ibo,const unsigned int* index,int ni)
+{
+   if (!*ibo) glGenBuffers(1,ibo);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,*ibo);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER,ni*sizeof(unsigned int),index,GL_STATIC_DRAW);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+}
+
+//
+//  Copy vertexes and indexes of every level of detail to buffer objects
+//
+void UploadMesh(Mesh* mesh)
+{
+   if (!mesh->vbo) glGenBuffers(1,&mesh->vbo);
+   glBindBuffer(GL_ARRAY_BUFFER,mesh->vbo);
+   if (mesh->packed)
+      glBufferData(GL_ARRAY_BUFFER,mesh->nv*sizeof(PackedVertex),mesh->packed,GL_STATIC_DRAW);
+   else
+      glBufferData(GL_ARRAY_BUFFER,MESH_STRIDE*mesh->nv*sizeof(float),mesh->vert,GL_STATIC_DRAW);
+   glBindBuffer(GL_ARRAY_BUFFER,0);
+   UploadIndexes(&mesh->ibo,mesh->index,mesh->ni);
+   for (int l=0;l<mesh->nl;l++)
+      UploadIndexes(&mesh->lod[l].ibo,mesh->lod[l].index,mesh->lod[l].ni);
+   ErrCheck("UploadMesh");
+}
+
+//
+//  Draw count indexes starting at first
+//    Draw n instances if n>0 (buffer objects only)
+//
+static void DrawRange(const Mesh* mesh,const unsigned int* index,int mode,int first,int count,int n)
+{
+   Stats.draws++;
+   Stats.vertexes += n ? (long)n*count : count;
+   //  Instances from buffer object
+   if (n)
+      glDrawElementsInstanced(GL_TRIANGLES,count,GL_UNSIGNED_INT,(void*)(first*sizeof(unsigned int)),n);
+   //  One call per vertex
+   else if (mode==MESH_IMMEDIATE)
+   {
+      glBegin(GL_TRIANGLES);
+      for (int k=first;k<first+count;k++)
+      {
+         const float* v = mesh->vert+MESH_STRIDE*index[k];
+         glTexCoord2fv(v+6);
+         glNormal3fv(v+3);
+         glVertex3fv(v);
+      }
+      glEnd();
+   }
+   //  Indexes in buffer object
+   else if (mode==MESH_VBO)
+      glDrawElements(GL_TRIANGLES,count,GL_UNSIGNED_INT,(void*)(first*sizeof(unsigned int)));
+   //  Indexes in client memory
+   else
+      glDrawElements(GL_TRIANGLES,count,GL_UNSIGNED_INT,index+first);
+}
+
+//
+//  Draw mesh as indexed triangles
+//    Vertex arrays and buffer objects replace one glVertex/glNormal/glTexCoord
+//    call per vertex with a single draw call per material group
+//    level 0 is full detail, level l uses the indexes of mesh->lod[l-1]
+//
+static void Draw(Mesh* mesh,int mode,int n,int level)
+{
+   //  Indexes and groups of the level of detail
+   const unsigned int* index = mesh->index;
+   const MeshGroup* group = mesh->group;
+   int ni = mesh->ni;
+   unsigned int* ibo = &mesh->ibo;
+   if (level>0 && level<=mesh->nl)
+   {
+      MeshLOD* lod = mesh->lod+level-1;
+      index = lod->index;
+      group = lod->group;
+      ni = lod->ni;
+      ibo = &lod->ibo;
+   }
+   //  Point arrays at client memory or buffer object
+   if (mode!=MESH_IMMEDIATE)
+   {
+      const char* base = mesh->packed ? (const char*)mesh->packed : (const char*)mesh->vert;
+      if (mode==MESH_VBO)
+      {
+         if (!mesh->vbo || !*ibo) UploadMesh(mesh);
+         glBindBuffer(GL_ARRAY_BUFFER,mesh->vbo);
+         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,*ibo);
+         base = NULL;
+      }
+      glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+      glEnableClientState(GL_VERTEX_ARRAY);
+      glEnableClientState(GL_NORMAL_ARRAY);
+      glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+      if (mesh->packed)
+      {
+         const int stride = sizeof(PackedVertex);
+         glVertexPointer(3,GL_FLOAT,stride,base);
+         glNormalPointer(GL_BYTE,stride,base+offsetof(PackedVertex,n));
+         glTexCoordPointer(2,GL_HALF_FLOAT,stride,base+offsetof(PackedVertex,s));
+      }
+      else
+      {
+         const int stride = MESH_STRIDE*sizeof(float);
+         glVertexPointer(3,GL_FLOAT,stride,base);
+         glNormalPointer(GL_FLOAT,stride,base+3*sizeof(float));
+         glTexCoordPointer(2,GL_FLOAT,stride,base+6*sizeof(float));
+      }
+   }
+
+   //  Draw whole mesh
+   if (!mesh->ng)
+      DrawRange(mesh,index,mode,0,ni,n);
+   //  Draw each material group
+   else
+   {
+      for (int k=0;k<mesh->ng;k++)
+      {
+         const MeshGroup* g = group+k;
+         if (!g->count) continue;
+         if (g->mtl>=0) UseMaterial(mesh->mtl+g->mtl);
+         DrawRange(mesh,index,mode,g->first,g->count,n);
+      }
+      //  Leave texturing off like the OBJ display lists do
+      BindTexture(0);
+   }
+
+   //  Restore array state
+   if (mode!=MESH_IMMEDIATE)
+   {
+      glPopClientAttrib();
+      if (mode==MESH_VBO)
+      {
+         glBindBuffer(GL_ARRAY_BUFFER,0);
+         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+      }
+   }
+}
+
+//
+//  Draw mesh using the selected mode
+//    Meshes with levels of detail pick one by size on screen
+//
+void DrawMesh(Mesh* mesh)
+{
+   int level=0;
+   if (mesh->nl)
+   {
+      float mat[16];
+      glGetFloatv(GL_MODELVIEW_MATRIX,mat);
+      level = MeshLevel(mesh,mat);
+   }
+   Draw(mesh,mode,0,level);
+}
+
+//
+//  Draw mesh at the given level of detail (0 is full detail)
+//
+void DrawMeshLOD(Mesh* mesh,int level)
+{
+   Draw(mesh,mode,0,level);
+}
+
+//
+//  Draw n instances of a mesh from buffer objects
+//    The caller sets up the per-instance attributes and the shader
+//
+void DrawMeshInstanced(Mesh* mesh,int n)
+{
+   if (n>0) Draw(mesh,MESH_VBO,n,0);
+}
@@ -0,0 +1,37 @@
+//  CSCIx229 library
+//  Generate trig.h, the sine and cosine table of whole degrees
+//
+//  Run by make before the library is compiled:  mktrig > trig.h
+//  Values are reduced to the first quadrant in long double and rounded
+//  once, so sin(180)=0, sin(30)=0.5 and cos(90)=0 exactly and the table
+//  is symmetric like the circle it describes.
+//
+#include <stdio.h>
+#include <math.h>
+
+//  Sine of whole degrees
+static double SinDegree(int d)
+{
+   d = ((d%360)+360)%360;
+   //  Quadrant and angle within it
+   int q = d/90;
+   int r = d%90;
+   if (q&1) r = 90-r;
+   long double s = (r==0) ? 0 : (r==30) ? 0.5L : (r==90) ? 1 : sinl(r*3.14159265358979323846264338327950288L/180);
+   return (q>=2 && s) ? -s : s;
+}
+
+int main(void)
+{
+   printf("//  Generated by mktrig, do not edit\n");
+   printf("//  Sine and cosine of whole degrees (any sign) without calling libm\n");
+   printf("#ifndef TRIG_H\n#define TRIG_H\n\n");
+   printf("#define ISin(th) SinTable[((th)%%360+360)%%360]\n");
+   printf("#define ICos(th) SinTable[((th)%%360+360)%%360+90]\n\n");
+   //  Cosine is the sine 90 degrees on, so the table runs to 449 degrees
+   printf("static const double SinTable[450] =\n{\n");
+   for (int d=0;d<450;d++)
+      printf("%s%.17g,%s",(d%4==0) ? "   " : " ",SinDegree(d),(d%4==3 || d==449) ? "\n" : "");
+   printf("};\n\n#endif\n");
+   return 0;
+}
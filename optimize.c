@@ -0,0 +1,197 @@
+//  CSCIx229 library
+//  Vertex cache and vertex fetch optimization of meshes
+#include "CSCIx229.h"
+
+//
+//  Triangles are reordered with Tipsify (Sander, Nehab and Barczak, "Fast
+//  Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007)
+//  so vertexes are reused while they are still in the post-transform cache,
+//  then vertexes are renumbered in the order they are first used so they
+//  are fetched from memory in sequence.
+//
+
+//  Cache size assumed by the optimizer
+#define CACHE 16
+
+//
+//  Average cache miss ratio (vertexes transformed per triangle)
+//    Simulates a FIFO post-transform cache of the given size
+//    1 or more is poor, 0.5 is the ideal for a large regular grid
+//
+float MeshACMR(const Mesh* mesh,int size)
+{
+   if (mesh->ni<3) return 0;
+   //  Number of misses when each vertex was last loaded (-1 if never)
+   int* at = (int*)malloc(mesh->nv*sizeof(int)+1);
+   if (!at) Fatal("Cannot allocate memory\n");
+   for (int k=0;k<mesh->nv;k++)
+      at[k] = -1;
+   //  A vertex is still cached if fewer than size misses happened since
+   int miss=0;
+   for (int k=0;k<mesh->ni;k++)
+   {
+      unsigned int v = mesh->index[k];
+      if (at[v]<0 || miss-at[v]>=size)
+         at[v] = miss++;
+   }
+   free(at);
+   return miss/(mesh->ni/3.0);
+}
+
+//
+//  Candidate list for the next fanning vertex
+//
+typedef struct
+{
+   int n,max;  //  Number and maximum of vertexes
+   int* v;     //  Vertexes
+} list_t;
+
+//
+//  Append vertex to list
+//
+static void Push(list_t* list,int v)
+{
+   if (list->n>=list->max)
+   {
+      list->max = 2*list->max+64;
+      list->v = (int*)realloc(list->v,list->max*sizeof(int));
+      if (!list->v) Fatal("Cannot allocate memory\n");
+   }
+   list->v[list->n++] = v;
+}
+
+//
+//  Reorder n triangles in index with Tipsify
+//    nv is the number of vertexes in the whole mesh
+//    Work arrays have room for nv vertexes and 3n triangle references
+//
+static void Tipsify(unsigned int* index,int n,int nv,int* live,int* time,int* first,int* adj,char* done,unsigned int* out)
+{
+   list_t dead={0,0,NULL};  //  Dead end stack
+   list_t next={0,0,NULL};  //  Candidates for the next fanning vertex
+   //  Triangles using each vertex (live counts are used as cursors first)
+   memset(live,0,nv*sizeof(int));
+   for (int k=0;k<3*n;k++)
+      live[index[k]]++;
+   first[0] = 0;
+   for (int v=0;v<nv;v++)
+      first[v+1] = first[v]+live[v];
+   for (int t=0;t<n;t++)
+      for (int j=0;j<3;j++)
+         adj[--live[index[3*t+j]]+first[index[3*t+j]]] = t;
+   for (int v=0;v<nv;v++)
+      live[v] = first[v+1]-first[v];
+   memset(done,0,n);
+   memset(time,0,nv*sizeof(int));
+
+   int o=0;           //  Output position
+   int s=CACHE+1;     //  Time stamp
+   int cursor=0;      //  Next vertex to try when stuck
+   int f=0;           //  Fanning vertex
+   while (f>=0)
+   {
+      //  Emit every triangle around the fanning vertex
+      next.n = 0;
+      for (int a=first[f];a<first[f+1];a++)
+      {
+         int t = adj[a];
+         if (done[t]) continue;
+         done[t] = 1;
+         for (int j=0;j<3;j++)
+         {
+            int v = index[3*t+j];
+            out[o++] = v;
+            Push(&dead,v);
+            Push(&next,v);
+            live[v]--;
+            //  Vertex is loaded into the cache
+            if (s-time[v]>CACHE) time[v] = s++;
+         }
+      }
+      //  Pick the candidate that will still be cached and is used most
+      f = -1;
+      int best=-1;
+      for (int k=0;k<next.n;k++)
+      {
+         int v = next.v[k];
+         if (live[v]<=0) continue;
+         int p = (s-time[v]+2*live[v]<=CACHE) ? s-time[v] : 0;
+         if (p>best)
+         {
+            best = p;
+            f = v;
+         }
+      }
+      //  Dead end: use a recent vertex or the next one in order
+      while (f<0 && dead.n>0)
+      {
+         int v = dead.v[--dead.n];
+         if (live[v]>0) f = v;
+      }
+      while (f<0 && cursor<nv)
+      {
+         if (live[cursor]>0) f = cursor;
+         cursor++;
+      }
+   }
+   memcpy(index,out,3*n*sizeof(unsigned int));
+   free(dead.v);
+   free(next.v);
+}
+
+//
+//  Reorder triangles for the vertex cache and vertexes for fetching
+//    Triangles stay in their material group
+//
+void OptimizeMesh(Mesh* mesh)
+{
+   int nv = mesh->nv;
+   int nt = mesh->ni/3;
+   if (nt<1) return;
+   //  Work arrays
+   int* live  = (int*)malloc(nv*sizeof(int));
+   int* time  = (int*)malloc(nv*sizeof(int));
+   int* first = (int*)malloc((nv+1)*sizeof(int));
+   int* adj   = (int*)malloc(3*nt*sizeof(int));
+   char* done = (char*)malloc(nt);
+   unsigned int* out = (unsigned int*)malloc(3*nt*sizeof(unsigned int));
+   if (!live || !time || !first || !adj || !done || !out) Fatal("Cannot allocate memory\n");
+
+   //  Reorder triangles of each group
+   if (!mesh->ng)
+      Tipsify(mesh->index,nt,nv,live,time,first,adj,done,out);
+   for (int k=0;k<mesh->ng;k++)
+      Tipsify(mesh->index+mesh->group[k].first,mesh->group[k].count/3,nv,live,time,first,adj,done,out);
+
+   //  Number vertexes in order of first use, unused vertexes last
+   int* map = live;
+   for (int v=0;v<nv;v++)
+      map[v] = -1;
+   int n=0;
+   for (int k=0;k<mesh->ni;k++)
+   {
+      unsigned int v = mesh->index[k];
+      if (map[v]<0) map[v] = n++;
+      mesh->index[k] = map[v];
+   }
+   for (int v=0;v<nv;v++)
+      if (map[v]<0) map[v] = n++;
+   //  Move vertexes (the packed copy if the floats were dropped)
+   size_t size = mesh->vert ? MESH_STRIDE*sizeof(float) : sizeof(PackedVertex);
+   char* src = mesh->vert ? (char*)mesh->vert : (char*)mesh->packed;
+   char* vert = (char*)malloc(size*nv);
+   if (!vert) Fatal("Cannot allocate memory\n");
+   for (int v=0;v<nv;v++)
+      memcpy(vert+size*map[v],src+size*v,size);
+   memcpy(src,vert,size*nv);
+   if (mesh->vert && mesh->packed) PackMesh(mesh);
+
+   free(vert);
+   free(live);
+   free(time);
+   free(first);
+   free(adj);
+   free(done);
+   free(out);
+}
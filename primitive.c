@@ -0,0 +1,275 @@
+//  CSCIx229 library
+//  Cached unit primitives
+#include "CSCIx229.h"
+//  Sine table generated by mktrig
+#include "trig.h"
+
+//
+//  Unit primitives are tessellated once per segment count (and shape
+//  parameter) and then reused for every instance.  Size, position and
+//  orientation are applied with the modelview matrix when drawing.
+//
+#define CYLINDER 0
+#define TORUS    1
+#define SPHERE   2
+
+typedef struct
+{
+   int   type;   //  Primitive type
+   int   n;      //  Number of segments
+   float param;  //  Shape parameter
+   Mesh* mesh;   //  Tessellated mesh
+} prim_t;
+
+static int Nprim=0;
+static prim_t* prim=NULL;
+
+//
+//  Find primitive in cache
+//
+static Mesh* FindPrimitive(int type,int n,float param)
+{
+   for (int k=0;k<Nprim;k++)
+      if (prim[k].type==type && prim[k].n==n && prim[k].param==param)
+         return prim[k].mesh;
+   return NULL;
+}
+
+//
+//  Add primitive to cache
+//
+static Mesh* AddPrimitive(int type,int n,float param,Mesh* mesh)
+{
+   prim = (prim_t*)realloc(prim,(Nprim+1)*sizeof(prim_t));
+   if (!prim) Fatal("Cannot allocate primitive cache\n");
+   prim[Nprim].type  = type;
+   prim[Nprim].n     = n;
+   prim[Nprim].param = param;
+   prim[Nprim].mesh  = mesh;
+   Nprim++;
+   if (MeshFormat(-1)==MESH_PACKED) PackMesh(mesh);
+   return mesh;
+}
+
+//
+//  Segment counts for each level of detail from coarse to fine
+//    All divide 360 so every angle is a whole number of degrees
+//    The finest is the 24 segments the bicycle is built with, so level of
+//    detail only ever draws fewer vertexes
+//
+static const int Nlod[] = {6,12,24};
+#define NLOD (int)(sizeof(Nlod)/sizeof(int))
+//  Largest gap in pixels between the segments and the true circle
+#define LOD_ERROR 0.5
+
+//
+//  Cosine and sine at n+1 equal steps from start to start+span degrees
+//    Whole degree steps come from the table, others from libm
+//
+static void Ring(int n,int start,int span,float* c,float* s)
+{
+   for (int k=0;k<=n;k++)
+      if (span%n==0)
+      {
+         int th = start+span/n*k;
+         c[k] = ICos(th);
+         s[k] = ISin(th);
+      }
+      else
+      {
+         double th = start+(double)span*k/n;
+         c[k] = Cos(th);
+         s[k] = Sin(th);
+      }
+}
+
+//
+//  Same primitive with the number of segments suited to its size on screen
+//    mat is the modelview matrix of the primitive
+//    Meshes that are not primitives are returned unchanged
+//
+Mesh* PrimitiveLOD(Mesh* mesh,const float mat[16])
+{
+   //  Gap between a circle and its chords relative to the radius
+   static double gap[NLOD]={0};
+   if (!gap[0])
+      for (int l=0;l<NLOD;l++)
+         gap[l] = 1-Cos(180.0/Nlod[l]);
+   for (int k=0;k<Nprim;k++)
+      if (prim[k].mesh==mesh)
+      {
+         //  Scale of the segmented circles (X and Y have the same scale
+         //  for cylinders and tori, spheres may be stretched in any direction)
+         float r=0;
+         for (int i=0;i<(prim[k].type==SPHERE ? 3 : 1);i++)
+            r = fmax(r,sqrt(mat[4*i]*mat[4*i]+mat[4*i+1]*mat[4*i+1]+mat[4*i+2]*mat[4*i+2]));
+         //  A torus ring is bigger than its tube
+         if (prim[k].type==TORUS) r *= 1+prim[k].param;
+         float pix = ProjectedSize(mat,r);
+         //  Fewest segments that keep the gap small enough
+         int l=0;
+         while (l<NLOD-1 && pix*gap[l]>LOD_ERROR) l++;
+         int n = Nlod[l];
+         if (n==prim[k].n) return mesh;
+         if (prim[k].type==CYLINDER) return CylinderMesh(n);
+         if (prim[k].type==TORUS)    return TorusMesh(n,prim[k].param);
+         return SphereMesh(n);
+      }
+   return mesh;
+}
+
+//
+//  Set vertex k of a mesh
+//
+static void SetVertex(Mesh* mesh,int k,double x,double y,double z,double nx,double ny,double nz,double s,double t)
+{
+   float* v = mesh->vert+MESH_STRIDE*k;
+   v[0] = x;  v[1] = y;  v[2] = z;
+   v[3] = nx; v[4] = ny; v[5] = nz;
+   v[6] = s;  v[7] = t;
+}
+
+//
+//  Copy positions and normals of a ring of n vertexes to the mesh from vertex k
+//    R holds n values each of x, y, z, nx, ny and nz (structure of arrays)
+//
+static void PutRing(Mesh* mesh,int k,int n,const float* R)
+{
+   float* v = mesh->vert+MESH_STRIDE*k;
+   for (int j=0;j<n;j++,v+=MESH_STRIDE)
+      for (int i=0;i<6;i++)
+         v[i] = R[i*n+j];
+}
+
+//
+//  Set texture coordinates of vertex k of a mesh
+//
+static void SetTexCoord(Mesh* mesh,int k,double s,double t)
+{
+   float* v = mesh->vert+MESH_STRIDE*k;
+   v[6] = s;  v[7] = t;
+}
+
+//
+//  Triangulate a grid of (rows+1)x(cols+1) vertexes starting at vertex v0
+//    Indexes are written starting at i0
+//    Returns the number of indexes written
+//
+static int Grid(Mesh* mesh,int v0,int i0,int rows,int cols)
+{
+   unsigned int* idx = mesh->index+i0;
+   for (int i=0;i<rows;i++)
+      for (int j=0;j<cols;j++)
+      {
+         unsigned int a = v0 + i*(cols+1) + j;
+         unsigned int b = a + cols+1;
+         *idx++ = a; *idx++ = b;   *idx++ = a+1;
+         *idx++ = b; *idx++ = b+1; *idx++ = a+1;
+      }
+   return 6*rows*cols;
+}
+
+//
+//  Unit cylinder with n segments
+//    Radius 1 around the Z axis from z=0 to z=1
+//
+Mesh* CylinderMesh(int n)
+{
+   Mesh* mesh = FindPrimitive(CYLINDER,n,0);
+   if (mesh) return mesh;
+
+   //  Side is a 2 x (n+1) grid, each cap is a center plus a ring of n+1
+   mesh = NewMesh(2*(n+1)+2*(n+2),12*n);
+   int N = n+1;
+   float C[N],S[N],R[6*N];
+   Ring(n,0,360,C,S);
+   //  Side normals point outwards
+   RingSoA(N,C,S,1,0,1,0,R,R+N,R+2*N,R+3*N,R+4*N,R+5*N);
+   PutRing(mesh,0,N,R);
+   RingSoA(N,C,S,1,1,1,0,R,R+N,R+2*N,R+3*N,R+4*N,R+5*N);
+   PutRing(mesh,N,N,R);
+   //  Cap normals point along the axis
+   RingSoA(N,C,S,1,1,0,+1,R,R+N,R+2*N,R+3*N,R+4*N,R+5*N);
+   PutRing(mesh,2*N+1,N,R);
+   RingSoA(N,C,S,1,0,0,-1,R,R+N,R+2*N,R+3*N,R+4*N,R+5*N);
+   PutRing(mesh,3*N+2,N,R);
+   for (int k=0;k<=n;k++)
+   {
+      SetTexCoord(mesh,k,(double)k/n,0);
+      SetTexCoord(mesh,N+k,(double)k/n,1);
+      SetTexCoord(mesh,2*N+1+k,0.5+0.5*C[k],0.5+0.5*S[k]);
+      SetTexCoord(mesh,3*N+2+k,0.5+0.5*C[k],0.5+0.5*S[k]);
+   }
+   SetVertex(mesh,2*(n+1),0,0,1,0,0,+1,0.5,0.5);
+   SetVertex(mesh,3*(n+1)+1,0,0,0,0,0,-1,0.5,0.5);
+
+   //  Side
+   int ni = Grid(mesh,0,0,1,n);
+   //  Caps as triangle fans
+   unsigned int top = 2*(n+1);
+   unsigned int bot = 3*(n+1)+1;
+   for (int k=0;k<n;k++)
+   {
+      mesh->index[ni++] = top;
+      mesh->index[ni++] = top+1+k;
+      mesh->index[ni++] = top+2+k;
+      mesh->index[ni++] = bot;
+      mesh->index[ni++] = bot+2+k;
+      mesh->index[ni++] = bot+1+k;
+   }
+   return AddPrimitive(CYLINDER,n,0,mesh);
+}
+
+//
+//  Unit torus with n segments in each direction
+//    Major radius 1 around the Z axis, minor radius ratio
+//
+Mesh* TorusMesh(int n,float ratio)
+{
+   Mesh* mesh = FindPrimitive(TORUS,n,ratio);
+   if (mesh) return mesh;
+
+   mesh = NewMesh((n+1)*(n+1),6*n*n);
+   //  Both circles have n segments
+   int N = n+1;
+   float C[N],S[N],R[6*N];
+   Ring(n,0,360,C,S);
+   //  Each ring goes around the Z axis at one angle of the tube
+   for (int i=0;i<=n;i++)
+   {
+      RingSoA(N,C,S,1+ratio*C[i],ratio*S[i],C[i],S[i],R,R+N,R+2*N,R+3*N,R+4*N,R+5*N);
+      PutRing(mesh,i*N,N,R);
+      for (int j=0;j<=n;j++)
+         SetTexCoord(mesh,i*N+j,(double)j/n,(double)i/n);
+   }
+   Grid(mesh,0,0,n,n);
+   return AddPrimitive(TORUS,n,ratio,mesh);
+}
+
+//
+//  Unit sphere with n segments around and n/2 bands from pole to pole
+//    The poles are on the Y axis
+//
+Mesh* SphereMesh(int n)
+{
+   Mesh* mesh = FindPrimitive(SPHERE,n,0);
+   if (mesh) return mesh;
+
+   int m = n/2;
+   mesh = NewMesh((m+1)*(n+1),6*m*n);
+   //  Longitude around and latitude from pole to pole
+   int N = n+1;
+   float Cth[N],Sth[N],Cph[m+1],Sph[m+1],R[6*N];
+   Ring(n,0,360,Cth,Sth);
+   Ring(m,-90,180,Cph,Sph);
+   //  Each ring goes around the Y axis with x=sin(th) and z=cos(th)
+   for (int i=0;i<=m;i++)
+   {
+      RingSoA(N,Sth,Cth,Cph[i],Sph[i],Cph[i],Sph[i],R,R+2*N,R+N,R+3*N,R+5*N,R+4*N);
+      PutRing(mesh,i*N,N,R);
+      for (int j=0;j<=n;j++)
+         SetTexCoord(mesh,i*N+j,(double)j/n,(double)i/m);
+   }
+   Grid(mesh,0,0,m,n);
+   return AddPrimitive(SPHERE,n,0,mesh);
+}
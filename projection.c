@@ -2,6 +2,9 @@
 //  Willem A. (Vlakkies) Schreuder
 #include "CSCIx229.h"
 
+//  Projection and viewport height set by the last call to Project
+static double Pfov=0,Pasp=1,Pdim=1,Pheight=1;
+
 //
 //  Set projection
 //
@@ -21,5 +24,74 @@ void Project(double fov,double asp,double dim)
    glMatrixMode(GL_MODELVIEW);
    //  Undo previous transformations
    glLoadIdentity();
+   //  Remember the projection for ProjectedSize
+   int viewport[4];
+   glGetIntegerv(GL_VIEWPORT,viewport);
+   Pfov = fov;
+   Pasp = asp;
+   Pdim = dim;
+   Pheight = viewport[3]>0 ? viewport[3] : 1;
+}
+
+//
+//  Field of view, aspect ratio and size set by the last call to Project
+//
+void GetProjection(double* fov,double* asp,double* dim)
+{
+   *fov = Pfov;
+   *asp = Pasp;
+   *dim = Pdim;
+}
+
+//
+//  Radius in pixels on screen of a sphere
+//    mat is the modelview matrix with the center of the sphere at its origin
+//    r is the radius in eye coordinates
+//    Spheres reaching the eye plane are as large as the screen and
+//    spheres behind the eye are not seen at all
+//
+float ProjectedSize(const float mat[16],float r)
+{
+   //  Orthogonal projection shows 2*dim units over the height
+   if (!Pfov) return r*Pheight/(2*Pdim);
+   //  Perspective projection shrinks with the distance in front of the eye
+   float z = -mat[14];
+   if (z<-r) return 0;
+   if (z<=r) return Pheight;
+   return r*Pheight/(2*z*tan(Pfov*3.14159265/360));
 }
 
+//
+//  Planes of the view volume set by the last call to Project
+//    view is the modelview matrix of the camera
+//    Each plane is a,b,c,d with ax+by+cz+d>=0 inside and (a,b,c) of unit
+//    length, so planes are in world coordinates when view has no scaling
+//
+void Frustum(const float view[16],float plane[6][4])
+{
+   //  Planes in eye coordinates (left, right, bottom, top, near, far)
+   double eye[6][4];
+   if (Pfov)
+   {
+      double ty = tan(Pfov*3.14159265/360);
+      double tx = Pasp*ty;
+      double lx = sqrt(1+tx*tx);
+      double ly = sqrt(1+ty*ty);
+      double P[6][4] = {{+1/lx,0,-tx/lx,0},{-1/lx,0,-tx/lx,0},
+                        {0,+1/ly,-ty/ly,0},{0,-1/ly,-ty/ly,0},
+                        {0,0,-1,-Pdim/16},{0,0,+1,16*Pdim}};
+      memcpy(eye,P,sizeof(eye));
+   }
+   else
+   {
+      double P[6][4] = {{+1,0,0,Pasp*Pdim},{-1,0,0,Pasp*Pdim},
+                        {0,+1,0,Pdim},{0,-1,0,Pdim},
+                        {0,0,-1,Pdim},{0,0,+1,Pdim}};
+      memcpy(eye,P,sizeof(eye));
+   }
+   //  A point p is at view*p in eye coordinates,
+   //  so the plane in world coordinates is the plane times view
+   for (int k=0;k<6;k++)
+      for (int j=0;j<4;j++)
+         plane[k][j] = eye[k][0]*view[4*j]+eye[k][1]*view[4*j+1]+eye[k][2]*view[4*j+2]+eye[k][3]*view[4*j+3];
+}
@@ -0,0 +1,223 @@
+//  CSCIx229 library
+//  Render queue and material state tracking
+#include "CSCIx229.h"
+
+//
+//  Material state last sent to OpenGL for GL_FRONT_AND_BACK
+//  Calls that would set the same values again are skipped.  State set
+//  directly with OpenGL is not tracked, so call ResetState after that.
+//
+static struct
+{
+   int valid;             //  Bit mask of valid values
+   float color[4];        //  Current color
+   float ambient[4];      //  Ambient material
+   float diffuse[4];      //  Diffuse material
+   float specular[4];     //  Specular material
+   float emission[4];     //  Emission material
+   float shininess;       //  Specular exponent
+   unsigned int texture;  //  Bound texture (0 for disabled)
+} state;
+#define COLOR     0x01
+#define AMBIENT   0x02
+#define DIFFUSE   0x04
+#define SPECULAR  0x08
+#define EMISSION  0x10
+#define SHININESS 0x20
+#define TEXTURE   0x40
+
+//  Rendering counters
+RenderStats Stats;
+
+//
+//  Forget everything known about OpenGL state
+//
+void ResetState(void)
+{
+   state.valid = 0;
+}
+
+//
+//  Copy 4 floats if different or unknown
+//    Returns true if the value changed
+//
+static int Update(float dst[4],const float src[4],int bit)
+{
+   if ((state.valid&bit) && !memcmp(dst,src,4*sizeof(float)))
+   {
+      Stats.skipped++;
+      return 0;
+   }
+   memcpy(dst,src,4*sizeof(float));
+   state.valid |= bit;
+   return 1;
+}
+
+//
+//  Set current color
+//
+void SetColor(const float color[4])
+{
+   if (!Update(state.color,color,COLOR)) return;
+   glColor4fv(color);
+   Stats.states++;
+   //  With GL_COLOR_MATERIAL the color may change the material too
+   state.valid &= ~(AMBIENT|DIFFUSE|SPECULAR|EMISSION);
+}
+
+//
+//  Set material color for front and back faces
+//
+void SetMaterialfv(GLenum pname,const float* v)
+{
+   int change=0;
+   if (pname==GL_AMBIENT || pname==GL_AMBIENT_AND_DIFFUSE)
+      change |= Update(state.ambient,v,AMBIENT);
+   if (pname==GL_DIFFUSE || pname==GL_AMBIENT_AND_DIFFUSE)
+      change |= Update(state.diffuse,v,DIFFUSE);
+   if (pname==GL_SPECULAR)
+      change |= Update(state.specular,v,SPECULAR);
+   if (pname==GL_EMISSION)
+      change |= Update(state.emission,v,EMISSION);
+   if (pname==GL_SHININESS)
+   {
+      SetMaterialf(pname,*v);
+      return;
+   }
+   if (!change) return;
+   glMaterialfv(GL_FRONT_AND_BACK,pname,v);
+   Stats.states++;
+}
+
+//
+//  Set material shininess for front and back faces
+//
+void SetMaterialf(GLenum pname,float v)
+{
+   if ((state.valid&SHININESS) && state.shininess==v)
+   {
+      Stats.skipped++;
+      return;
+   }
+   state.shininess = v;
+   state.valid |= SHININESS;
+   glMaterialf(GL_FRONT_AND_BACK,pname,v);
+   Stats.states++;
+}
+
+//
+//  Bind 2D texture and enable texturing (0 disables texturing)
+//
+void BindTexture(unsigned int texture)
+{
+   if ((state.valid&TEXTURE) && state.texture==texture)
+   {
+      Stats.skipped++;
+      return;
+   }
+   //  Enable or disable when switching to or from no texture
+   if (!(state.valid&TEXTURE) || !state.texture!=!texture)
+   {
+      if (texture)
+         glEnable(GL_TEXTURE_2D);
+      else
+         glDisable(GL_TEXTURE_2D);
+      Stats.states++;
+   }
+   if (texture)
+   {
+      glBindTexture(GL_TEXTURE_2D,texture);
+      Stats.states++;
+   }
+   state.texture = texture;
+   state.valid |= TEXTURE;
+}
+
+//
+//  Set material colors and texture
+//
+void UseMaterial(const Material* mtl)
+{
+   SetMaterialfv(GL_AMBIENT  ,mtl->Ka);
+   SetMaterialfv(GL_DIFFUSE  ,mtl->Kd);
+   SetMaterialfv(GL_SPECULAR ,mtl->Ks);
+   SetMaterialf(GL_SHININESS,mtl->Ns);
+   BindTexture(mtl->map);
+}
+
+//
+//  Add mesh to the render queue
+//    mat is the model matrix
+//    material is defined by the application and set by the FlushQueue callback
+//
+void QueueMesh(RenderQueue* queue,Mesh* mesh,const float mat[16],int material,unsigned int texture)
+{
+   //  Allocate more memory in 1024 item chunks
+   if (queue->n>=queue->max)
+   {
+      queue->max += 1024;
+      queue->item = (RenderItem*)realloc(queue->item,queue->max*sizeof(RenderItem));
+      if (!queue->item) Fatal("Cannot allocate %d render queue items\n",queue->max);
+   }
+   RenderItem* item = queue->item+queue->n++;
+   item->mesh = mesh;
+   item->material = material;
+   item->texture = texture;
+   memcpy(item->mat,mat,sizeof(item->mat));
+}
+
+//
+//  Add every mesh in a scene to the render queue
+//    base is the model matrix of the scene root
+//
+void QueueScene(RenderQueue* queue,Scene* scene,const float base[16])
+{
+   for (int k=0;k<scene->n;k++)
+   {
+      SceneNode* node = scene->node+k;
+      if (!node->mesh) continue;
+      float mat[16];
+      MatMultiply(mat,base,node->world);
+      QueueMesh(queue,node->mesh,mat,node->material,0);
+   }
+}
+
+//
+//  Order items by material, then texture, then mesh
+//
+static int CompareItems(const void* a,const void* b)
+{
+   const RenderItem* A = (const RenderItem*)a;
+   const RenderItem* B = (const RenderItem*)b;
+   if (A->material!=B->material) return A->material<B->material ? -1 : +1;
+   if (A->texture !=B->texture)  return A->texture <B->texture  ? -1 : +1;
+   if (A->mesh    !=B->mesh)     return A->mesh    <B->mesh     ? -1 : +1;
+   return 0;
+}
+
+//
+//  Draw and empty the render queue
+//    Items are sorted so each material and texture is set once
+//    material is called whenever the material changes (may be NULL)
+//
+void FlushQueue(RenderQueue* queue,void (*material)(int))
+{
+   //  Sort by state
+   qsort(queue->item,queue->n,sizeof(RenderItem),CompareItems);
+   //  State may have been changed directly since the last flush
+   ResetState();
+   int current = -1;
+   for (int k=0;k<queue->n;k++)
+   {
+      RenderItem* item = queue->item+k;
+      if (material && item->material!=current)
+         material(current = item->material);
+      BindTexture(item->texture);
+      glPushMatrix();
+      glMultMatrixf(item->mat);
+      DrawMesh(item->mesh);
+      glPopMatrix();
+   }
+   BindTexture(0);
+   queue->n = 0;
+}
@@ -0,0 +1,103 @@
+//  CSCIx229 library
+//  Scene graph with cached transformations
+#include "CSCIx229.h"
+
+//
+//  Nodes are stored with every parent before its children, so a single
+//  pass in order updates the whole graph.  The world matrix of a node is
+//  only recomputed when its local matrix or one of its ancestors changed.
+//
+
+//
+//  Add node to scene
+//    local is the transformation relative to the parent (NULL for identity)
+//    Returns the node index
+//
+int AddNode(Scene* scene,int parent,const float local[16],Mesh* mesh,int material)
+{
+   if (parent>=scene->n) Fatal("Parent node %d not in scene\n",parent);
+   //  Allocate more memory in 64 node chunks
+   if (scene->n>=scene->max)
+   {
+      scene->max += 64;
+      scene->node = (SceneNode*)realloc(scene->node,scene->max*sizeof(SceneNode));
+      if (!scene->node) Fatal("Cannot allocate %d scene nodes\n",scene->max);
+   }
+   //  Initialize node
+   SceneNode* node = scene->node+scene->n;
+   node->parent = parent;
+   if (local)
+      memcpy(node->local,local,sizeof(node->local));
+   else
+      MatIdentity(node->local);
+   node->dirty = 1;
+   node->mesh = mesh;
+   node->material = material;
+   return scene->n++;
+}
+
+//
+//  Change the transformation of a node relative to its parent
+//
+void SetNodeMatrix(Scene* scene,int k,const float local[16])
+{
+   memcpy(scene->node[k].local,local,sizeof(scene->node[k].local));
+   scene->node[k].dirty = 1;
+}
+
+//
+//  Recompute world matrixes of changed nodes and their descendants
+//    Returns the number of nodes recomputed
+//
+int UpdateScene(Scene* scene)
+{
+   int count=0;
+   //  Parents come first so a dirty parent marks its children dirty
+   for (int k=0;k<scene->n;k++)
+   {
+      SceneNode* node = scene->node+k;
+      int p = node->parent;
+      if (p>=0 && scene->node[p].dirty) node->dirty = 1;
+      if (!node->dirty) continue;
+      if (p>=0)
+         MatMultiply(node->world,scene->node[p].world,node->local);
+      else
+         memcpy(node->world,node->local,sizeof(node->world));
+      count++;
+   }
+   //  Clear flags once all descendants have seen them
+   for (int k=0;k<scene->n;k++)
+      scene->node[k].dirty = 0;
+   return count;
+}
+
+//
+//  Draw every node that has a mesh
+//    material is called whenever the material changes (may be NULL)
+//
+void DrawScene(Scene* scene,void (*material)(int))
+{
+   int current=-1;
+   for (int k=0;k<scene->n;k++)
+   {
+      SceneNode* node = scene->node+k;
+      if (!node->mesh) continue;
+      if (material && node->material!=current)
+         material(current = node->material);
+      glPushMatrix();
+      glMultMatrixf(node->world);
+      DrawMesh(node->mesh);
+      glPopMatrix();
+   }
+}
+
+//
+//  Free scene memory
+//    Meshes are not owned by the scene
+//
+void FreeScene(Scene* scene)
+{
+   free(scene->node);
+   scene->node = NULL;
+   scene->n = scene->max = 0;
+}
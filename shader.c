@@ -0,0 +1,96 @@
+//  CSCIx229 library
+//  Shader programs
+#include "CSCIx229.h"
+
+//
+//  Read text file
+//
+static char* ReadText(const char* file)
+{
+   //  Open file
+   FILE* f = fopen(file,"rb");
+   if (!f) Fatal("Cannot open text file %s\n",file);
+   //  Seek to end to determine size, then rewind
+   fseek(f,0,SEEK_END);
+   int n = ftell(f);
+   rewind(f);
+   //  Allocate memory for the whole file
+   char* buffer = (char*)malloc(n+1);
+   if (!buffer) Fatal("Cannot allocate %d bytes for text file %s\n",n+1,file);
+   //  Snarf the file
+   if (fread(buffer,n,1,f)!=1 && n>0) Fatal("Cannot read %d bytes for text file %s\n",n,file);
+   buffer[n] = 0;
+   //  Close and return
+   fclose(f);
+   return buffer;
+}
+
+//
+//  Print shader or program log
+//    Exits if compile or link failed
+//
+static void PrintLog(int obj,const char* what,int shader)
+{
+   int len=0;
+   if (shader)
+      glGetShaderiv(obj,GL_INFO_LOG_LENGTH,&len);
+   else
+      glGetProgramiv(obj,GL_INFO_LOG_LENGTH,&len);
+   if (len>1)
+   {
+      char* buffer = (char*)malloc(len);
+      if (!buffer) Fatal("Cannot allocate %d bytes of text for log\n",len);
+      if (shader)
+         glGetShaderInfoLog(obj,len,NULL,buffer);
+      else
+         glGetProgramInfoLog(obj,len,NULL,buffer);
+      fprintf(stderr,"%s:\n%s\n",what,buffer);
+      free(buffer);
+   }
+   int ok;
+   if (shader)
+      glGetShaderiv(obj,GL_COMPILE_STATUS,&ok);
+   else
+      glGetProgramiv(obj,GL_LINK_STATUS,&ok);
+   if (!ok) Fatal("Error %s %s\n",shader?"compiling":"linking",what);
+}
+
+//
+//  Compile shader from file and attach to program
+//
+static void CreateShader(int prog,const GLenum type,const char* file)
+{
+   //  Create the shader
+   int shader = glCreateShader(type);
+   //  Load source code from file
+   char* source = ReadText(file);
+   glShaderSource(shader,1,(const char**)&source,NULL);
+   free(source);
+   //  Compile the shader
+   glCompileShader(shader);
+   //  Check for errors
+   PrintLog(shader,file,1);
+   //  Attach to shader program
+   glAttachShader(prog,shader);
+   //  The program keeps the shader alive
+   glDeleteShader(shader);
+}
+
+//
+//  Create shader program from vertex and fragment shader files
+//    Either file may be NULL
+//
+int CreateShaderProg(const char* VertFile,const char* FragFile)
+{
+   //  Create program
+   int prog = glCreateProgram();
+   //  Create and compile shaders
+   if (VertFile) CreateShader(prog,GL_VERTEX_SHADER,VertFile);
+   if (FragFile) CreateShader(prog,GL_FRAGMENT_SHADER,FragFile);
+   //  Link program
+   glLinkProgram(prog);
+   //  Check for errors
+   PrintLog(prog,VertFile?VertFile:FragFile,0);
+   //  Return name
+   return prog;
+}
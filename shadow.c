@@ -0,0 +1,138 @@
+//  CSCIx229 library
+//  Shadow map of one light
+#include "CSCIx229.h"
+
+//
+//  The scene is drawn from the light into a depth texture through a frame
+//  buffer object.  Shaders compare the depth of each fragment seen from the
+//  light with the map, averaging n by n taps of the map (percentage closer
+//  filtering) to soften the edges.  Drawing the map between BeginShadow and
+//  EndShadow is left to the caller, so it can keep the old map while
+//  neither the light nor anything casting shadows has moved.
+//
+
+//  Texture unit of the shadow map (unit 0 is left for BindTexture)
+#define UNIT 4
+
+static unsigned int fbo=0,depth=0;
+//  Requested size and filter and size of the texture
+static int size=1024,pcf=3,built=0;
+//  Viewport to restore
+static int viewport[4];
+//  Light projection times light view with the -1 to 1 to 0 to 1 bias
+static float shadow[16];
+
+//
+//  Set the size of the shadow map and the width of the filter (1 is none)
+//
+void ShadowMap(int n,int k)
+{
+   size = n;
+   pcf = k;
+}
+
+//
+//  Make the depth texture and frame buffer object of the shadow map
+//
+static void BuildShadow(void)
+{
+   if (!depth)
+   {
+      glGenTextures(1,&depth);
+      glGenFramebuffers(1,&fbo);
+   }
+   glActiveTexture(GL_TEXTURE0+UNIT);
+   glBindTexture(GL_TEXTURE_2D,depth);
+   glTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT24,size,size,0,GL_DEPTH_COMPONENT,GL_UNSIGNED_INT,NULL);
+   //  Linear filtering compares four texels per tap
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+   //  Outside the map is lit
+   const float border[] = {1,1,1,1};
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_BORDER);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_BORDER);
+   glTexParameterfv(GL_TEXTURE_2D,GL_TEXTURE_BORDER_COLOR,border);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_COMPARE_MODE,GL_COMPARE_REF_TO_TEXTURE);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_COMPARE_FUNC,GL_LEQUAL);
+   glActiveTexture(GL_TEXTURE0);
+   //  Depth only frame buffer
+   glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+   glFramebufferTexture2D(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_TEXTURE_2D,depth,0);
+   glDrawBuffer(GL_NONE);
+   glReadBuffer(GL_NONE);
+   if (glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE) Fatal("Cannot create %dx%d shadow map\n",size,size);
+   glBindFramebuffer(GL_FRAMEBUFFER,0);
+   built = size;
+}
+
+//
+//  Start drawing the shadow map
+//    The map looks from the light at a sphere around center
+//    Sets the projection with Project and returns the view from the light,
+//    so call Project again after EndShadow
+//
+void BeginShadow(const float light[3],const float center[3],float radius,float view[16])
+{
+   if (built!=size) BuildShadow();
+   glGetIntegerv(GL_VIEWPORT,viewport);
+   glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+   glViewport(0,0,size,size);
+   glClear(GL_DEPTH_BUFFER_BIT);
+   glColorMask(0,0,0,0);
+   //  Push depths back so lit surfaces do not shadow themselves
+   glEnable(GL_POLYGON_OFFSET_FILL);
+   glPolygonOffset(2,4);
+
+   //  Narrowest perspective holding the sphere
+   float dx=center[0]-light[0],dy=center[1]-light[1],dz=center[2]-light[2];
+   double d = sqrt(dx*dx+dy*dy+dz*dz);
+   double fov = (d>1.01*radius) ? 2*asin(radius/d)*180/3.14159265 : 150;
+   Project(fov,1,d>0 ? d : 1);
+   //  Look up Y unless looking along it
+   if (fabs(dy)>0.99*d)
+      gluLookAt(light[0],light[1],light[2],center[0],center[1],center[2],1,0,0);
+   else
+      gluLookAt(light[0],light[1],light[2],center[0],center[1],center[2],0,1,0);
+   glGetFloatv(GL_MODELVIEW_MATRIX,view);
+
+   float proj[16];
+   glGetFloatv(GL_PROJECTION_MATRIX,proj);
+   MatIdentity(shadow);
+   MatTranslate(shadow,0.5,0.5,0.5);
+   MatScale(shadow,0.5,0.5,0.5);
+   MatMultiply(shadow,shadow,proj);
+   MatMultiply(shadow,shadow,view);
+}
+
+//
+//  Finish drawing the shadow map
+//
+void EndShadow(void)
+{
+   glBindFramebuffer(GL_FRAMEBUFFER,0);
+   glViewport(viewport[0],viewport[1],viewport[2],viewport[3]);
+   glColorMask(1,1,1,1);
+   glDisable(GL_POLYGON_OFFSET_FILL);
+   ErrCheck("EndShadow");
+}
+
+//
+//  Give a shader program the shadow map
+//    view is the modelview matrix of the camera
+//    Sets the sampler2DShadow ShadowMap, mat4 ShadowMatrix from eye
+//    coordinates to the map, int ShadowPCF and bool Shadows
+//
+void UseShadow(int prog,const float view[16],int on)
+{
+   glUniform1i(glGetUniformLocation(prog,"ShadowMap"),UNIT);
+   glUniform1i(glGetUniformLocation(prog,"Shadows"),on && built);
+   if (!on || !built) return;
+   float mat[16];
+   if (!MatInverse(mat,view)) return;
+   MatMultiply(mat,shadow,mat);
+   glActiveTexture(GL_TEXTURE0+UNIT);
+   glBindTexture(GL_TEXTURE_2D,depth);
+   glActiveTexture(GL_TEXTURE0);
+   glUniformMatrix4fv(glGetUniformLocation(prog,"ShadowMatrix"),1,GL_FALSE,mat);
+   glUniform1i(glGetUniformLocation(prog,"ShadowPCF"),pcf);
+}
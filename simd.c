@@ -0,0 +1,220 @@
+//  CSCIx229 library
+//  SSE and AVX2 kernels for rings of vertexes and batches of points
+#include "CSCIx229.h"
+
+//
+//  Each kernel has a portable scalar version and, on x86 with gcc or clang,
+//  SSE and AVX2 versions compiled for those instruction sets with target
+//  attributes.  The best version the processor supports is picked the
+//  first time a kernel runs, so the library still runs on any x86 and
+//  builds on other processors.  Data is in structure of arrays form so
+//  each vector holds the same coordinate of consecutive vertexes.
+//
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define X86
+#include <immintrin.h>
+#endif
+
+//  Kernel set in use (-1 until picked)
+static int simd=-1;
+
+//
+//  Ring scalar kernel
+//
+static void RingScalar(int n,const float* u,const float* v,float a,float h,float b,float c,
+                       float* pu,float* pv,float* pw,float* nu,float* nv,float* nw)
+{
+   for (int k=0;k<n;k++)
+   {
+      pu[k] = a*u[k];
+      pv[k] = a*v[k];
+      pw[k] = h;
+      nu[k] = b*u[k];
+      nv[k] = b*v[k];
+      nw[k] = c;
+   }
+}
+
+//
+//  Transform scalar kernel
+//
+static void TransformScalar(const float m[16],int n,const float* x,const float* y,const float* z,float* X,float* Y,float* Z)
+{
+   for (int k=0;k<n;k++)
+   {
+      float px=x[k],py=y[k],pz=z[k];
+      X[k] = m[0]*px + m[4]*py + m[8] *pz + m[12];
+      Y[k] = m[1]*px + m[5]*py + m[9] *pz + m[13];
+      Z[k] = m[2]*px + m[6]*py + m[10]*pz + m[14];
+   }
+}
+
+#ifdef X86
+//
+//  Ring SSE kernel (4 vertexes at a time)
+//
+__attribute__((target("sse2")))
+static void RingSSE(int n,const float* u,const float* v,float a,float h,float b,float c,
+                    float* pu,float* pv,float* pw,float* nu,float* nv,float* nw)
+{
+   __m128 A=_mm_set1_ps(a),H=_mm_set1_ps(h),B=_mm_set1_ps(b),C=_mm_set1_ps(c);
+   int k=0;
+   for (;k+4<=n;k+=4)
+   {
+      __m128 U = _mm_loadu_ps(u+k);
+      __m128 V = _mm_loadu_ps(v+k);
+      _mm_storeu_ps(pu+k,_mm_mul_ps(A,U));
+      _mm_storeu_ps(pv+k,_mm_mul_ps(A,V));
+      _mm_storeu_ps(pw+k,H);
+      _mm_storeu_ps(nu+k,_mm_mul_ps(B,U));
+      _mm_storeu_ps(nv+k,_mm_mul_ps(B,V));
+      _mm_storeu_ps(nw+k,C);
+   }
+   RingScalar(n-k,u+k,v+k,a,h,b,c,pu+k,pv+k,pw+k,nu+k,nv+k,nw+k);
+}
+
+//
+//  Transform SSE kernel (4 points at a time)
+//
+__attribute__((target("sse2")))
+static void TransformSSE(const float m[16],int n,const float* x,const float* y,const float* z,float* X,float* Y,float* Z)
+{
+   __m128 M[12];
+   for (int i=0;i<12;i++)
+      M[i] = _mm_set1_ps(m[i<9 ? i/3*4+i%3 : 12+i-9]);
+   int k=0;
+   for (;k+4<=n;k+=4)
+   {
+      __m128 px = _mm_loadu_ps(x+k);
+      __m128 py = _mm_loadu_ps(y+k);
+      __m128 pz = _mm_loadu_ps(z+k);
+      _mm_storeu_ps(X+k,_mm_add_ps(_mm_add_ps(_mm_mul_ps(M[0],px),_mm_mul_ps(M[3],py)),_mm_add_ps(_mm_mul_ps(M[6],pz),M[9])));
+      _mm_storeu_ps(Y+k,_mm_add_ps(_mm_add_ps(_mm_mul_ps(M[1],px),_mm_mul_ps(M[4],py)),_mm_add_ps(_mm_mul_ps(M[7],pz),M[10])));
+      _mm_storeu_ps(Z+k,_mm_add_ps(_mm_add_ps(_mm_mul_ps(M[2],px),_mm_mul_ps(M[5],py)),_mm_add_ps(_mm_mul_ps(M[8],pz),M[11])));
+   }
+   TransformScalar(m,n-k,x+k,y+k,z+k,X+k,Y+k,Z+k);
+}
+
+//
+//  Ring AVX2 kernel (8 vertexes at a time)
+//
+__attribute__((target("avx2")))
+static void RingAVX2(int n,const float* u,const float* v,float a,float h,float b,float c,
+                     float* pu,float* pv,float* pw,float* nu,float* nv,float* nw)
+{
+   __m256 A=_mm256_set1_ps(a),H=_mm256_set1_ps(h),B=_mm256_set1_ps(b),C=_mm256_set1_ps(c);
+   int k=0;
+   for (;k+8<=n;k+=8)
+   {
+      __m256 U = _mm256_loadu_ps(u+k);
+      __m256 V = _mm256_loadu_ps(v+k);
+      _mm256_storeu_ps(pu+k,_mm256_mul_ps(A,U));
+      _mm256_storeu_ps(pv+k,_mm256_mul_ps(A,V));
+      _mm256_storeu_ps(pw+k,H);
+      _mm256_storeu_ps(nu+k,_mm256_mul_ps(B,U));
+      _mm256_storeu_ps(nv+k,_mm256_mul_ps(B,V));
+      _mm256_storeu_ps(nw+k,C);
+   }
+   //  The rest is done here since calling SSE code with the upper
+   //  halves of the registers in use costs a state transition
+   for (;k<n;k++)
+   {
+      pu[k] = a*u[k];
+      pv[k] = a*v[k];
+      pw[k] = h;
+      nu[k] = b*u[k];
+      nv[k] = b*v[k];
+      nw[k] = c;
+   }
+}
+
+//
+//  Transform AVX2 kernel (8 points at a time with fused multiply add)
+//
+__attribute__((target("avx2,fma")))
+static void TransformAVX2(const float m[16],int n,const float* x,const float* y,const float* z,float* X,float* Y,float* Z)
+{
+   __m256 M[12];
+   for (int i=0;i<12;i++)
+      M[i] = _mm256_set1_ps(m[i<9 ? i/3*4+i%3 : 12+i-9]);
+   int k=0;
+   for (;k+8<=n;k+=8)
+   {
+      __m256 px = _mm256_loadu_ps(x+k);
+      __m256 py = _mm256_loadu_ps(y+k);
+      __m256 pz = _mm256_loadu_ps(z+k);
+      _mm256_storeu_ps(X+k,_mm256_fmadd_ps(M[0],px,_mm256_fmadd_ps(M[3],py,_mm256_fmadd_ps(M[6],pz,M[9]))));
+      _mm256_storeu_ps(Y+k,_mm256_fmadd_ps(M[1],px,_mm256_fmadd_ps(M[4],py,_mm256_fmadd_ps(M[7],pz,M[10]))));
+      _mm256_storeu_ps(Z+k,_mm256_fmadd_ps(M[2],px,_mm256_fmadd_ps(M[5],py,_mm256_fmadd_ps(M[8],pz,M[11]))));
+   }
+   for (;k<n;k++)
+   {
+      float px=x[k],py=y[k],pz=z[k];
+      X[k] = m[0]*px + m[4]*py + m[8] *pz + m[12];
+      Y[k] = m[1]*px + m[5]*py + m[9] *pz + m[13];
+      Z[k] = m[2]*px + m[6]*py + m[10]*pz + m[14];
+   }
+}
+#endif
+
+//
+//  Best kernel set the processor supports
+//
+static int Supported(void)
+{
+#ifdef X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+   if (__builtin_cpu_supports("sse2")) return SIMD_SSE;
+#endif
+   return SIMD_SCALAR;
+}
+
+//
+//  Select scalar, SSE or AVX2 kernels
+//    Kernels the processor lacks fall back to the next best
+//    Returns the kernel set in use
+//
+int SIMDMode(int mode)
+{
+   int best = Supported();
+   simd = (mode<0 || mode>best) ? best : mode;
+   return simd;
+}
+
+//
+//  Ring of n vertexes around an axis
+//    u,v are the cosine and sine (or any two circle coordinates) of each vertex
+//    Positions are a*u,a*v,h and normals are b*u,b*v,c
+//    Outputs may be in any order to put the axis along x, y or z
+//
+void RingSoA(int n,const float* u,const float* v,float a,float h,float b,float c,
+             float* pu,float* pv,float* pw,float* nu,float* nv,float* nw)
+{
+   if (simd<0) SIMDMode(-1);
+#ifdef X86
+   if (simd==SIMD_AVX2)
+      RingAVX2(n,u,v,a,h,b,c,pu,pv,pw,nu,nv,nw);
+   else if (simd==SIMD_SSE)
+      RingSSE(n,u,v,a,h,b,c,pu,pv,pw,nu,nv,nw);
+   else
+#endif
+      RingScalar(n,u,v,a,h,b,c,pu,pv,pw,nu,nv,nw);
+}
+
+//
+//  Transform n points by a 4x4 matrix
+//    Outputs may be the inputs
+//
+void TransformSoA(const float mat[16],int n,const float* x,const float* y,const float* z,float* X,float* Y,float* Z)
+{
+   if (simd<0) SIMDMode(-1);
+#ifdef X86
+   if (simd==SIMD_AVX2)
+      TransformAVX2(mat,n,x,y,z,X,Y,Z);
+   else if (simd==SIMD_SSE)
+      TransformSSE(mat,n,x,y,z,X,Y,Z);
+   else
+#endif
+      TransformScalar(mat,n,x,y,z,X,Y,Z);
+}
@@ -0,0 +1,421 @@
+//  CSCIx229 library
+//  Mesh simplification into levels of detail
+#include "CSCIx229.h"
+
+//
+//  Levels of detail are extra index buffers into the vertexes of the mesh,
+//  built by collapsing edges in order of their quadric error (Garland and
+//  Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997).
+//  A vertex is only ever moved onto a neighbor, so no new vertexes are
+//  needed.  Vertexes on UV or normal seams, on material boundaries and on
+//  open edges are locked so those boundaries keep their shape.
+//
+
+//  Triangles kept at each level relative to the one before
+#define RATIO 4
+//  Smallest number of triangles worth reducing
+#define MINTRI 64
+//  Largest error on screen in pixels before a finer level is drawn
+#define LOD_PIXELS 1.0
+
+//  Doubles per quadric
+#define QUAD 11
+
+//
+//  Add plane ax+by+cz+d=0 with weight w to quadric Q
+//    Q holds the upper triangle of the 4x4 matrix and the total weight
+//
+static void AddPlane(double Q[QUAD],double a,double b,double c,double d,double w)
+{
+   Q[0] += w*a*a; Q[1] += w*a*b; Q[2] += w*a*c; Q[3] += w*a*d;
+                  Q[4] += w*b*b; Q[5] += w*b*c; Q[6] += w*b*d;
+                                 Q[7] += w*c*c; Q[8] += w*c*d;
+                                                Q[9] += w*d*d;
+   Q[10] += w;
+}
+
+//
+//  Mean squared distance from point p to the planes in Q
+//
+static double QuadError(const double Q[QUAD],const float p[3])
+{
+   double x=p[0],y=p[1],z=p[2];
+   double e = Q[0]*x*x + 2*Q[1]*x*y + 2*Q[2]*x*z + 2*Q[3]*x
+                       +   Q[4]*y*y + 2*Q[5]*y*z + 2*Q[6]*y
+                                    +   Q[7]*z*z + 2*Q[8]*z
+                                                 +   Q[9];
+   return (e>0 && Q[10]>0) ? e/Q[10] : 0;
+}
+
+//
+//  Normal of triangle abc (not normalized)
+//
+static void Normal(const float* a,const float* b,const float* c,double n[3])
+{
+   double u[] = {b[0]-a[0],b[1]-a[1],b[2]-a[2]};
+   double v[] = {c[0]-a[0],c[1]-a[1],c[2]-a[2]};
+   n[0] = u[1]*v[2]-u[2]*v[1];
+   n[1] = u[2]*v[0]-u[0]*v[2];
+   n[2] = u[0]*v[1]-u[1]*v[0];
+}
+
+//
+//  Hash table of integer triples
+//    Used to find vertexes with the same position and edges used once
+//
+typedef struct
+{
+   unsigned int size;   //  Number of slots (power of 2)
+   unsigned int* key;   //  Triples (0xFFFFFFFF for empty)
+   int* val;            //  Value of each triple
+} hash_t;
+
+static void NewHash(hash_t* h,int n)
+{
+   h->size = 1024;
+   while (h->size<2*(unsigned int)n) h->size *= 2;
+   h->key = (unsigned int*)malloc(3*h->size*sizeof(unsigned int));
+   h->val = (int*)malloc(h->size*sizeof(int));
+   if (!h->key || !h->val) Fatal("Cannot allocate memory\n");
+   memset(h->key,0xFF,3*h->size*sizeof(unsigned int));
+}
+
+//
+//  Find triple (a,b,c) and add it with value v if it is missing
+//    Returns pointer to the value
+//
+static int* Lookup(hash_t* h,unsigned int a,unsigned int b,unsigned int c,int v)
+{
+   unsigned int k = (a*73856093u ^ b*19349663u ^ c*83492791u)&(h->size-1);
+   unsigned int* K = h->key+3*k;
+   while (K[0]!=0xFFFFFFFF && (K[0]!=a || K[1]!=b || K[2]!=c))
+   {
+      k = (k+1)&(h->size-1);
+      K = h->key+3*k;
+   }
+   if (K[0]==0xFFFFFFFF)
+   {
+      K[0] = a;
+      K[1] = b;
+      K[2] = c;
+      h->val[k] = v;
+   }
+   return h->val+k;
+}
+
+static void FreeHash(hash_t* h)
+{
+   free(h->key);
+   free(h->val);
+}
+
+//
+//  Find vertexes that must not move
+//    rep is the first vertex with the same position
+//
+static void LockVertexes(const Mesh* mesh,const int* group,int* rep,char* lock)
+{
+   int nv = mesh->nv;
+   int nt = mesh->ni/3;
+   memset(lock,0,nv);
+   //  Weld vertexes by position, more than one vertex is a seam
+   hash_t h;
+   NewHash(&h,nv);
+   for (int v=0;v<nv;v++)
+   {
+      const unsigned int* p = (const unsigned int*)(mesh->vert+MESH_STRIDE*v);
+      rep[v] = *Lookup(&h,p[0],p[1],p[2],v);
+      if (rep[v]!=v) lock[v] = lock[rep[v]] = 1;
+   }
+   FreeHash(&h);
+   //  Vertexes used with more than one material
+   int* m = (int*)malloc(nv*sizeof(int));
+   if (!m) Fatal("Cannot allocate memory\n");
+   for (int v=0;v<nv;v++)
+      m[v] = -2;
+   for (int t=0;t<nt;t++)
+   {
+      int mtl = mesh->ng ? mesh->group[group[t]].mtl : -1;
+      for (int j=0;j<3;j++)
+      {
+         unsigned int v = mesh->index[3*t+j];
+         if (m[v]>-2 && m[v]!=mtl) lock[v] = 1;
+         m[v] = mtl;
+      }
+   }
+   free(m);
+   //  Count edges between welded positions in both directions
+   NewHash(&h,3*nt);
+   for (int t=0;t<nt;t++)
+      for (int j=0;j<3;j++)
+      {
+         unsigned int a = rep[mesh->index[3*t+j]];
+         unsigned int b = rep[mesh->index[3*t+(j+1)%3]];
+         (*Lookup(&h,a<b?a:b,a<b?b:a,0,0))++;
+      }
+   //  Edges of one triangle are open
+   for (unsigned int k=0;k<h.size;k++)
+      if (h.key[3*k]!=0xFFFFFFFF && h.val[k]==1)
+         lock[h.key[3*k]] = lock[h.key[3*k+1]] = 1;
+   FreeHash(&h);
+   //  Every vertex at a locked position is locked
+   for (int v=0;v<nv;v++)
+      if (lock[rep[v]]) lock[v] = 1;
+}
+
+//
+//  Cost used to sort collapses
+//
+static THREAD_LOCAL const double* sortcost;
+static int CompareCost(const void* a,const void* b)
+{
+   double x = sortcost[*(const int*)a];
+   double y = sortcost[*(const int*)b];
+   return (x>y) - (x<y);
+}
+
+//
+//  Collapse edges until there are at most target triangles
+//    index and group hold nt triangles and are compacted in place
+//    Returns the new number of triangles and raises error to the largest
+//    mean squared distance of a collapse
+//
+static int Reduce(const Mesh* mesh,unsigned int* index,int* group,int nt,int target,double* Q,const char* lock,double* error)
+{
+   int nv = mesh->nv;
+   int* first   = (int*)malloc((nv+1)*sizeof(int));
+   int* adj     = (int*)malloc(3*nt*sizeof(int)+1);
+   int* to      = (int*)malloc(nv*sizeof(int));
+   double* cost = (double*)malloc(nv*sizeof(double));
+   int* order   = (int*)malloc(nv*sizeof(int));
+   char* mark   = (char*)malloc(nv);
+   if (!first || !adj || !to || !cost || !order || !mark) Fatal("Cannot allocate memory\n");
+
+   while (nt>target)
+   {
+      //  Triangles around each vertex
+      memset(first,0,(nv+1)*sizeof(int));
+      for (int k=0;k<3*nt;k++)
+         first[index[k]+1]++;
+      for (int v=0;v<nv;v++)
+         first[v+1] += first[v];
+      for (int t=0;t<nt;t++)
+         for (int j=0;j<3;j++)
+            adj[first[index[3*t+j]]++] = t;
+      for (int v=nv;v>0;v--)
+         first[v] = first[v-1];
+      first[0] = 0;
+
+      //  Cheapest collapse of every free vertex onto a neighbor
+      int n=0;
+      for (int v=0;v<nv;v++)
+      {
+         to[v] = -1;
+         if (lock[v]) continue;
+         for (int a=first[v];a<first[v+1];a++)
+            for (int j=0;j<3;j++)
+            {
+               int u = index[3*adj[a]+j];
+               if (u==v) continue;
+               double e = QuadError(Q+QUAD*v,mesh->vert+MESH_STRIDE*u);
+               if (to[v]<0 || e<cost[v])
+               {
+                  to[v] = u;
+                  cost[v] = e;
+               }
+            }
+         if (to[v]>=0) order[n++] = v;
+      }
+      sortcost = cost;
+      qsort(order,n,sizeof(int),CompareCost);
+
+      //  Collapse in order of cost, leaving the neighborhood of each
+      //  collapse alone until the next pass
+      memset(mark,0,nv);
+      int removed=0,collapsed=0;
+      for (int k=0;k<n && removed<nt-target;k++)
+      {
+         int v = order[k];
+         int u = to[v];
+         if (mark[v] || mark[u]) continue;
+         //  Reject collapses that turn a triangle over
+         int ok=1,gone=0;
+         for (int a=first[v];a<first[v+1] && ok;a++)
+         {
+            unsigned int* T = index+3*adj[a];
+            if (T[0]==u || T[1]==u || T[2]==u)
+            {
+               gone++;
+               continue;
+            }
+            const float* p[3];
+            for (int j=0;j<3;j++)
+               p[j] = mesh->vert+MESH_STRIDE*T[j];
+            double n0[3],n1[3];
+            Normal(p[0],p[1],p[2],n0);
+            for (int j=0;j<3;j++)
+               if (T[j]==v) p[j] = mesh->vert+MESH_STRIDE*u;
+            Normal(p[0],p[1],p[2],n1);
+            double d = n0[0]*n1[0]+n0[1]*n1[1]+n0[2]*n1[2];
+            if (d<=0.2*sqrt(n0[0]*n0[0]+n0[1]*n0[1]+n0[2]*n0[2])*sqrt(n1[0]*n1[0]+n1[1]*n1[1]+n1[2]*n1[2])) ok = 0;
+         }
+         if (!ok) continue;
+         //  Move v onto u
+         for (int a=first[v];a<first[v+1];a++)
+         {
+            unsigned int* T = index+3*adj[a];
+            for (int j=0;j<3;j++)
+            {
+               mark[T[j]] = 1;
+               if (T[j]==v) T[j] = u;
+            }
+         }
+         for (int i=0;i<QUAD;i++)
+            Q[QUAD*u+i] += Q[QUAD*v+i];
+         if (cost[v]>*error) *error = cost[v];
+         removed += gone;
+         collapsed++;
+      }
+      if (!collapsed) break;
+
+      //  Drop triangles that collapsed
+      int m=0;
+      for (int t=0;t<nt;t++)
+      {
+         unsigned int* T = index+3*t;
+         if (T[0]==T[1] || T[1]==T[2] || T[2]==T[0]) continue;
+         memmove(index+3*m,T,3*sizeof(unsigned int));
+         group[m++] = group[t];
+      }
+      nt = m;
+   }
+   free(first);
+   free(adj);
+   free(to);
+   free(cost);
+   free(order);
+   free(mark);
+   return nt;
+}
+
+//
+//  Free levels of detail of a mesh
+//
+void FreeMeshLOD(Mesh* mesh)
+{
+   for (int l=0;l<mesh->nl;l++)
+   {
+      if (mesh->lod[l].ibo) glDeleteBuffers(1,&mesh->lod[l].ibo);
+      //  Indexes in a mapped cache file go with the mapping
+      if (!mesh->map) free(mesh->lod[l].index);
+      free(mesh->lod[l].group);
+   }
+   free(mesh->lod);
+   mesh->lod = NULL;
+   mesh->nl = 0;
+}
+
+//
+//  Build up to n levels of detail
+//    Each level has about a quarter of the triangles of the one before
+//    Levels stop when the locked vertexes prevent further reduction
+//
+void SimplifyMesh(Mesh* mesh,int n)
+{
+   if (!mesh->vert) Fatal("Cannot simplify a mesh without float vertexes (simplify before PackMesh)\n");
+   FreeMeshLOD(mesh);
+   int nv = mesh->nv;
+   int nt = mesh->ni/3;
+   if (n<1 || nt<RATIO*MINTRI) return;
+
+   //  Material group of every triangle
+   int* group = (int*)malloc(nt*sizeof(int));
+   if (!group) Fatal("Cannot allocate memory\n");
+   for (int t=0;t<nt;t++)
+      group[t] = 0;
+   for (int k=0;k<mesh->ng;k++)
+      for (int t=mesh->group[k].first/3;t<(mesh->group[k].first+mesh->group[k].count)/3;t++)
+         group[t] = k;
+
+   //  Locked vertexes
+   int* rep = (int*)malloc(nv*sizeof(int));
+   char* lock = (char*)malloc(nv);
+   if (!rep || !lock) Fatal("Cannot allocate memory\n");
+   LockVertexes(mesh,group,rep,lock);
+   free(rep);
+
+   //  Quadric of the planes of the triangles around each vertex
+   //  weighted by area
+   double* Q = (double*)calloc(QUAD*nv,sizeof(double));
+   if (!Q) Fatal("Cannot allocate memory\n");
+   for (int t=0;t<nt;t++)
+   {
+      const unsigned int* T = mesh->index+3*t;
+      const float* p = mesh->vert+MESH_STRIDE*T[0];
+      double N[3];
+      Normal(p,mesh->vert+MESH_STRIDE*T[1],mesh->vert+MESH_STRIDE*T[2],N);
+      double l = sqrt(N[0]*N[0]+N[1]*N[1]+N[2]*N[2]);
+      if (l==0) continue;
+      N[0] /= l; N[1] /= l; N[2] /= l;
+      for (int j=0;j<3;j++)
+         AddPlane(Q+QUAD*T[j],N[0],N[1],N[2],-(N[0]*p[0]+N[1]*p[1]+N[2]*p[2]),l/2);
+   }
+
+   //  Reduce a working copy one level at a time
+   unsigned int* index = (unsigned int*)malloc(mesh->ni*sizeof(unsigned int));
+   if (!index) Fatal("Cannot allocate memory\n");
+   memcpy(index,mesh->index,mesh->ni*sizeof(unsigned int));
+   mesh->lod = (MeshLOD*)calloc(n,sizeof(MeshLOD));
+   if (!mesh->lod) Fatal("Cannot allocate memory\n");
+   double error=0;
+   for (int l=0;l<n && nt>=RATIO*MINTRI;l++)
+   {
+      int m = Reduce(mesh,index,group,nt,nt/RATIO,Q,lock,&error);
+      //  Stop when the reduction stalls
+      if (m>nt*3/4) break;
+      nt = m;
+      //  Copy indexes and groups
+      MeshLOD* lod = mesh->lod+mesh->nl++;
+      lod->ni = 3*nt;
+      lod->index = (unsigned int*)malloc(lod->ni*sizeof(unsigned int)+1);
+      lod->group = (MeshGroup*)malloc(mesh->ng*sizeof(MeshGroup)+1);
+      if (!lod->index || !lod->group) Fatal("Cannot allocate memory\n");
+      memcpy(lod->index,index,lod->ni*sizeof(unsigned int));
+      for (int k=0;k<mesh->ng;k++)
+      {
+         lod->group[k] = mesh->group[k];
+         lod->group[k].first = lod->group[k].count = 0;
+      }
+      for (int t=0;t<nt;t++)
+         if (mesh->ng)
+         {
+            MeshGroup* g = lod->group+group[t];
+            if (!g->count) g->first = 3*t;
+            g->count += 3;
+         }
+      lod->error = sqrt(error);
+      lod->ibo = 0;
+   }
+   free(index);
+   free(group);
+   free(lock);
+   free(Q);
+}
+
+//
+//  Level of detail to draw
+//    mat is the modelview matrix of the mesh
+//    Returns the coarsest level with an error below a pixel (0 for full detail)
+//
+int MeshLevel(const Mesh* mesh,const float mat[16])
+{
+   if (!mesh->nl) return 0;
+   //  Largest scale in the matrix
+   float s=0;
+   for (int i=0;i<3;i++)
+      s = fmax(s,sqrt(mat[4*i]*mat[4*i]+mat[4*i+1]*mat[4*i+1]+mat[4*i+2]*mat[4*i+2]));
+   for (int l=mesh->nl;l>0;l--)
+      if (ProjectedSize(mat,s*mesh->lod[l-1].error)<=LOD_PIXELS)
+         return l;
+   return 0;
+}
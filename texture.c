@@ -0,0 +1,219 @@
+//  CSCIx229 library
+//  Shared textures
+#include "CSCIx229.h"
+
+//
+//  Textures are loaded once per file and shared.  GetTexture looks the
+//  file up by its canonical path (and the compression set by TexMode) and
+//  returns the resident texture with one more reference, or loads it with
+//  LoadTexBMP.  ReleaseTexture drops a reference.  Textures nobody uses
+//  stay resident so the next load is free, until the video memory of all
+//  textures is over the budget; then the least recently used of them are
+//  deleted.  Textures in use are never deleted, even over the budget.
+//  Textures read in the background are shared with FindTexture and
+//  AddTexture.
+//
+
+//  Resident texture
+typedef struct
+{
+   char* path;          //  Canonical path of the BMP file
+   unsigned int hash;   //  Hash of path
+   int mode;            //  TexMode when loaded
+   unsigned int tex;    //  Texture name
+   int refs;            //  References
+   long long bytes;     //  Video memory of all levels
+   unsigned long used;  //  Time of last use
+} texentry_t;
+
+static texentry_t* entry=NULL;
+static int n=0,size=0;
+//  Video memory for textures in bytes
+static long long budget=256<<20;
+//  Use counter for least recently used
+static unsigned long now=0;
+
+TextureStats TexStats;
+
+//
+//  FNV-1a hash of a string
+//
+static unsigned int HashPath(const char* path)
+{
+   unsigned int h = 2166136261u;
+   while (*path)
+      h = (h^(unsigned char)*path++)*16777619u;
+   return h;
+}
+
+//
+//  Canonical path of a file (same file, same path)
+//
+static char* CanonicalPath(const char* file)
+{
+#ifdef _WIN32
+   char* path = _fullpath(NULL,file,0);
+#else
+   char* path = realpath(file,NULL);
+#endif
+   //  Missing files keep their name and fail to load
+   if (!path)
+   {
+      path = (char*)malloc(strlen(file)+1);
+      if (!path) Fatal("Cannot allocate memory\n");
+      strcpy(path,file);
+   }
+   return path;
+}
+
+//
+//  Video memory of the bound texture
+//    Uncompressed texels are taken to be padded to 4 bytes
+//
+static long long TextureBytes(void)
+{
+   long long bytes=0;
+   for (int k=0;;k++)
+   {
+      int w,h,compressed,size;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D,k,GL_TEXTURE_WIDTH,&w);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D,k,GL_TEXTURE_HEIGHT,&h);
+      if (w<1 || h<1) break;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D,k,GL_TEXTURE_COMPRESSED,&compressed);
+      if (compressed)
+      {
+         glGetTexLevelParameteriv(GL_TEXTURE_2D,k,GL_TEXTURE_COMPRESSED_IMAGE_SIZE,&size);
+         bytes += size;
+      }
+      else
+         bytes += 4LL*w*h;
+   }
+   return bytes;
+}
+
+//
+//  Delete unused textures, least recently used first, until under budget
+//
+static void Evict(void)
+{
+   while (TexStats.bytes>budget)
+   {
+      int k=-1;
+      for (int i=0;i<n;i++)
+         if (!entry[i].refs && (k<0 || entry[i].used<entry[k].used))
+            k = i;
+      //  Every texture is in use
+      if (k<0) return;
+      glDeleteTextures(1,&entry[k].tex);
+      free(entry[k].path);
+      TexStats.bytes -= entry[k].bytes;
+      TexStats.textures--;
+      TexStats.evictions++;
+      entry[k] = entry[--n];
+   }
+}
+
+//
+//  Set video memory budget for textures in megabytes
+//
+void TextureBudget(int mb)
+{
+   budget = (long long)mb<<20;
+   Evict();
+}
+
+//
+//  Resident texture of a file
+//
+static texentry_t* Lookup(const char* path,unsigned int hash,int mode)
+{
+   for (int k=0;k<n;k++)
+      if (entry[k].hash==hash && entry[k].mode==mode && !strcmp(entry[k].path,path))
+         return entry+k;
+   return NULL;
+}
+
+//
+//  Share the resident texture of a file
+//    Returns 0 if it is not resident
+//
+unsigned int FindTexture(const char* file)
+{
+   char* path = CanonicalPath(file);
+   texentry_t* e = Lookup(path,HashPath(path),TexMode(-1));
+   free(path);
+   if (!e) return 0;
+   e->refs++;
+   e->used = ++now;
+   TexStats.hits++;
+   return e->tex;
+}
+
+//
+//  Keep a texture loaded from a file with one reference
+//    If the file became resident meanwhile tex is deleted and the resident
+//    texture is shared instead
+//
+unsigned int AddTexture(const char* file,unsigned int tex)
+{
+   char* path = CanonicalPath(file);
+   unsigned int hash = HashPath(path);
+   int mode = TexMode(-1);
+   texentry_t* e = Lookup(path,hash,mode);
+   if (e)
+   {
+      free(path);
+      glDeleteTextures(1,&tex);
+      e->refs++;
+      e->used = ++now;
+      TexStats.hits++;
+      return e->tex;
+   }
+
+   if (n==size)
+   {
+      size = size ? 2*size : 16;
+      entry = (texentry_t*)realloc(entry,size*sizeof(texentry_t));
+      if (!entry) Fatal("Cannot allocate %d textures\n",size);
+   }
+   e = entry+n++;
+   e->path = path;
+   e->hash = hash;
+   e->mode = mode;
+   e->tex = tex;
+   e->refs = 1;
+   glBindTexture(GL_TEXTURE_2D,tex);
+   e->bytes = TextureBytes();
+   e->used = ++now;
+   TexStats.misses++;
+   TexStats.textures++;
+   TexStats.bytes += e->bytes;
+   Evict();
+   return tex;
+}
+
+//
+//  Load texture from BMP file or share the resident one
+//    Call ReleaseTexture when done with it
+//
+unsigned int GetTexture(const char* file)
+{
+   unsigned int tex = FindTexture(file);
+   return tex ? tex : AddTexture(file,LoadTexBMP(file));
+}
+
+//
+//  Drop a reference to a texture from GetTexture
+//    Textures not from GetTexture are ignored
+//
+void ReleaseTexture(unsigned int tex)
+{
+   for (int k=0;k<n;k++)
+      if (entry[k].tex==tex)
+      {
+         if (entry[k].refs>0) entry[k].refs--;
+         entry[k].used = ++now;
+         Evict();
+         return;
+      }
+}